@@ -0,0 +1,1643 @@
+// Micro benchmarks for the ray tracer. Every benchmark prints its own
+// report, run without arguments for the list.
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "Camera.h"
+#include "DS.h"
+#include "Engine.h"
+#include "FlatScene.h"
+#include "Image.h"
+#include "Models.h"
+#include "Packet.h"
+#include "SceneFile.h"
+#include "SceneLoader.h"
+#include "Texture.h"
+#include "defs.h"
+#include "stb_image.h"
+#include "utils.h"
+
+using namespace std;
+
+// every heap allocation of the benchmark binary goes through here, the
+// plain, sized and aligned forms of delete all free what new returned.
+// None is inlined, where the compiler would see malloc paired with delete
+// or free with new
+static std::atomic<long> num_allocations{0};
+
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void* operator new(std::size_t size,
+                                             std::align_val_t align) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    // aligned_alloc wants a multiple of the alignment
+    const std::size_t a = static_cast<std::size_t>(align);
+    const std::size_t n = (std::max<std::size_t>(size, 1) + a - 1) / a * a;
+    if (void* p = std::aligned_alloc(a, n)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void* p,
+                                               std::align_val_t) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void* p, std::size_t,
+                                               std::align_val_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// best of a few runs, the first one warms the caches
+template <typename F>
+double best_time(int runs, F&& f) {
+    double best = std::numeric_limits<double>::infinity();
+    for (int r = 0; r < runs; r++) {
+        auto start = Clock::now();
+        f();
+        best = std::min(best, seconds_since(start));
+    }
+    return best;
+}
+
+// primary rays through the pixel centers, in the block order of the packets
+std::vector<Ray> primary_rays(const Camera& cam, int res, int block_w,
+                              int block_h) {
+    std::vector<Ray> rays;
+    for (int bi = 0; bi < res; bi += block_w)
+        for (int bj = 0; bj < res; bj += block_h)
+            for (int i = bi; i < std::min(bi + block_w, res); i++)
+                for (int j = bj; j < std::min(bj + block_h, res); j++)
+                    rays.push_back(cam.getRay((i + 0.5f) / res, (j + 0.5f) / res).value());
+    return rays;
+}
+
+// throughput of the scalar path and of packets of 4, 8 and 16 rays, each
+// packet hit compared against the scalar one of the same ray
+void packet_rows(const RenderEngine& engine, const Camera& cam, int res) {
+    std::vector<Ray> rays = primary_rays(cam, res, 4, 4);
+    std::vector<std::optional<SceneHit>> scalar_hits(rays.size());
+    double scalar = best_time(3, [&]() {
+        for (size_t r = 0; r < rays.size(); r++)
+            scalar_hits[r] = engine.intersect(rays[r]);
+    });
+    const double num_rays = rays.size();
+    cout << std::fixed << std::setprecision(2);
+    cout << "  scalar     " << std::setw(8) << num_rays / scalar / 1e6
+         << " Mrays/s" << endl;
+
+    for (int width : {4, 8, 16}) {
+        const int block_w = (width >= 8) ? 4 : 2;
+        const int block_h = width / block_w;
+        std::vector<Ray> block_rays = primary_rays(cam, res, block_w, block_h);
+        std::vector<RayPacket> packets;
+        size_t next = 0;
+        for (int bi = 0; bi < res; bi += block_w) {
+            for (int bj = 0; bj < res; bj += block_h) {
+                packets.emplace_back();
+                RayPacket& p = packets.back();
+                const int n = (std::min(bi + block_w, res) - bi) *
+                              (std::min(bj + block_h, res) - bj);
+                for (int k = 0; k < n; k++) p.push(block_rays[next++]);
+                p.pad();
+            }
+        }
+
+        // one result reused like the renderer does, the hit records do not
+        // fit in cache for a whole frame
+        PacketHits hits;
+        double packet = best_time(3, [&]() {
+            for (size_t p = 0; p < packets.size(); p++)
+                engine.intersect(packets[p], hits);
+        });
+
+        // compare against the scalar path ray by ray, the reused hits must
+        // not keep the instance of an earlier packet
+        int mismatches = 0;
+        next = 0;
+        for (size_t p = 0; p < packets.size(); p++) {
+            engine.intersect(packets[p], hits);
+            for (int lane = 0; lane < packets[p].size; lane++) {
+                auto ref = engine.intersect(block_rays[next++]);
+                const bool hit = hits.model[lane] != NULL;
+                if (hit != ref.has_value() ||
+                    (hit && (hits.model[lane] != ref.value().model ||
+                             hits.hit[lane].instance !=
+                                 ref.value().hit.instance ||
+                             fabs(hits.t[lane] - ref.value().hit.t) >
+                                 EPSILON * std::max(1.0f, ref.value().hit.t) ||
+                             (hits.hit[lane].normal - ref.value().hit.normal)
+                                     .norm() > 0.05f)))
+                    mismatches++;
+            }
+        }
+        cout << "  packet " << std::setw(2) << width << "  " << std::setw(8)
+             << num_rays / packet / 1e6 << " Mrays/s  speedup "
+             << scalar / packet << "x  mismatches " << mismatches << endl;
+    }
+}
+
+int bench_packet(const std::vector<string>& args) {
+    if (args.empty()) {
+        cout << "Usage: packet <Input JSON file> [resolution]" << endl;
+        return -1;
+    }
+    const int res = args.size() > 1 ? std::stoi(args[1]) : 512;
+    State state = get_state(args[0]);
+    Image img{res, res};
+    RenderEngine engine(*(state.cam), img, *(state.bg), state.models,
+                        state.lights, Color(0.2, 0.2, 0.2));
+
+    cout << "packet benchmark: " << res << "x" << res << " primary rays, "
+         << state.models.size() << " models, kernels: " << simd::isaName()
+         << endl;
+    packet_rows(engine, *(state.cam), res);
+
+    // instanced spheres on a checkerboard with bare triangles in the other
+    // squares, so lanes go from an instance to a triangle between packets
+    Material mat;
+    mat.Kd = Vector3f(0.5, 0.5, 0.5);
+    const MaterialId id = material_table().intern(mat);
+    auto ball = std::make_shared<const Sphere>(Point::Zero(), 0.9f, id,
+                                               IDENTITY_TRANS);
+    const int k = 8;
+    std::vector<Model*> models;
+    for (int i = 0; i < k; i++) {
+        for (int j = 0; j < k; j++) {
+            const Point c(2.0f * (i - k / 2.0f) + 1, 2.0f * (j - k / 2.0f) + 1,
+                          -2.0f * k);
+            if ((i + j) % 2 == 0)
+                models.push_back(new Instance(
+                    ball, Transformation(Matrix3f::Identity(), c)));
+            else
+                models.push_back(new Triangle(c + Vector3f(-1, -1, 0),
+                                              c + Vector3f(1, -1, 0),
+                                              c + Vector3f(0, 1, 0), id,
+                                              IDENTITY_TRANS));
+        }
+    }
+    Matrix4f cam_trans = Matrix4f::Identity();
+    Camera cam(cam_trans, 1, 60);
+    Background bg(Color(0.1, 0.1, 0.15));
+    std::vector<Light*> lights;
+    Image mixed_img{res, res};
+    RenderEngine mixed(cam, mixed_img, bg, models, lights,
+                       Color(0.2, 0.2, 0.2));
+    cout << "instances and bare triangles: " << models.size() << " models"
+         << endl;
+    packet_rows(mixed, cam, res);
+    for (Model* m : models) delete m;
+    return 0;
+}
+
+// apply_transformation as it was before the identity and rigid fast paths,
+// kept here as the baseline of the transform benchmark
+namespace legacy {
+Vector3f apply(const Vector3f& point, const Transformation& trans,
+               bool do_world_to_model, bool isDir, bool isNormal) {
+    Vector3f R = Vector3f::Zero();
+    Matrix3f M;
+    if (isNormal)
+        M = (do_world_to_model ? trans.T_M_W.transpose()
+                               : trans.T_W_M.transpose());
+    else
+        M = (do_world_to_model ? trans.T_W_M : trans.T_M_W);
+    if (!isDir) R = (do_world_to_model ? trans.R_W_M : trans.R_M_W);
+    return point * M + R;
+}
+
+Ray apply(const Ray& r, const Transformation& trans, bool do_world_to_model,
+          bool isNormal) {
+    return Ray(apply(r.src, trans, do_world_to_model, false, false),
+               apply(r.dir * r.length, trans, do_world_to_model, true,
+                     isNormal));
+}
+
+// intersection, normal and shading of one hit with the old transforms. It
+// shades in model space, which over-brightens scaled models, so the affine
+// case differs from the current code
+Color shade_hit(const Model& m, const Ray& r,
+                const std::vector<std::pair<Color, Vector3f>>& lights) {
+    const Transformation& t = m.trans;
+    Ray tr = apply(r, t, true, false);
+    auto el = m._intersect(tr);
+    if (!el) return Color::Zero();
+    Vector3f world_point =
+        apply(tr.src + el.value().t * tr.dir, t, false, false, false);
+    // the normal was found again at the point brought back to model space
+    Ray n(apply(world_point, t, true, false, false), el.value().normal);
+    Ray normal = apply(n, t, false, true);
+    Vector3f tn = apply(normal.dir, t, true, true, true);
+    Vector3f tv = apply(-r.dir, t, true, true, false);
+    std::vector<std::pair<Color, Vector3f>> tl;
+    for (auto el : lights)
+        tl.push_back({el.first, apply(el.second, t, true, true, true)});
+    return m._getIntensity(tn, tv, tl, NULL, NULL, NULL, {});
+}
+}  // namespace legacy
+
+// the same hit through the Model interface
+Color shade_hit(const Model& m, const Ray& r,
+                const std::vector<std::pair<Color, Vector3f>>& lights) {
+    auto hit = m.intersect(r);
+    if (!hit) return Color::Zero();
+    return m.getIntensity(hit.value().normal, -r.dir, lights, NULL, NULL,
+                          NULL, {});
+}
+
+int bench_transform(const std::vector<string>& args) {
+    const int num_rays = args.empty() ? 1 << 18 : std::stoi(args[0]);
+    Material mat;
+    mat.Kd = Vector3f(0.5, 0.5, 0.5);
+    mat.Ks = Vector3f(0.5, 0.5, 0.5);
+    mat.specular_coeff = 16;
+    const Matrix3f rot =
+        Eigen::AngleAxisf(0.7f, Vector3f(1, 2, 3).normalized().transpose())
+            .toRotationMatrix();
+    Matrix3f scale = Matrix3f::Identity();
+    scale.diagonal() = Vector3f(2.0f, 0.5f, 1.0f).transpose();
+    const std::vector<std::pair<string, Transformation>> transforms = {
+        {"identity", IDENTITY_TRANS},
+        {"rigid", Transformation(rot, Vector3f(0.1, 0.2, 0.3))},
+        {"affine", Transformation(scale * rot, Vector3f(0.1, 0.2, 0.3))},
+    };
+    const std::vector<std::pair<Color, Vector3f>> lights = {
+        {Color(1, 1, 1), Vector3f(0, 1, 0)},
+        {Color(0.5, 0.5, 0.5), Vector3f(1, 1, 0).normalized()},
+    };
+
+    // rays from a shell around the unit sphere aimed at points on it
+    std::mt19937 rng(42);
+    std::normal_distribution<float> gauss;
+    std::vector<Ray> rays;
+    for (int i = 0; i < num_rays; i++) {
+        Vector3f a(gauss(rng), gauss(rng), gauss(rng));
+        Vector3f b(gauss(rng), gauss(rng), gauss(rng));
+        rays.push_back(Ray(4 * a.normalized(), 0.5f * b.normalized() - 4 * a.normalized()));
+    }
+
+    cout << "transform benchmark: " << num_rays
+         << " sphere hits (intersection, normal, shading with "
+         << lights.size() << " lights)" << endl;
+    cout << std::fixed << std::setprecision(1);
+    for (const auto& tr : transforms) {
+        Sphere sphere(Vector3f::Zero(), 1, material_table().intern(mat), tr.second);
+        Color sum_before = Color::Zero(), sum_after = Color::Zero();
+        double before = best_time(3, [&]() {
+            sum_before = Color::Zero();
+            for (const Ray& r : rays)
+                sum_before += legacy::shade_hit(sphere, r, lights);
+        });
+        double after = best_time(3, [&]() {
+            sum_after = Color::Zero();
+            for (const Ray& r : rays) sum_after += shade_hit(sphere, r, lights);
+        });
+        cout << "  " << std::left << std::setw(9) << tr.first << std::right
+             << " before " << std::setw(6) << before / num_rays * 1e9
+             << " ns/hit  after " << std::setw(6)
+             << after / num_rays * 1e9 << " ns/hit  speedup "
+             << std::setprecision(2) << before / after << "x  rel diff "
+             << std::scientific
+             << (sum_before - sum_after).norm() / sum_before.norm()
+             << std::fixed << std::setprecision(1) << endl;
+    }
+    return 0;
+}
+
+int bench_alloc(const std::vector<string>& args) {
+    if (args.empty()) {
+        cout << "Usage: alloc <Input JSON file> [resolution]" << endl;
+        return -1;
+    }
+    const int res = args.size() > 1 ? std::stoi(args[1]) : 256;
+    State state = get_state(args[0]);
+    Image img{res, res};
+    RenderEngine engine(*(state.cam), img, *(state.bg), state.models,
+                        state.lights, Color(0.2, 0.2, 0.2));
+    engine.setNumThreads(1);
+    engine.setSeed(42);
+    const long pixels = (long)res * res;
+    cout << "allocation benchmark: " << res << "x" << res << ", "
+         << state.models.size() << " models, " << state.lights.size()
+         << " lights" << endl;
+
+    // trace() through the pixel centers, the first pass grows the per
+    // thread scratch buffers
+    std::vector<Ray> rays = primary_rays(*(state.cam), res, 1, 1);
+    const PathSample sample{0, 0, 1};
+    Color sum = Color::Zero();
+    for (const Ray& r : rays) sum += engine.trace(r, 1, 0, sample);
+    long before = num_allocations;
+    auto start = Clock::now();
+    for (const Ray& r : rays) sum += engine.trace(r, 1, 0, sample);
+    double secs = seconds_since(start);
+    long traced = num_allocations - before;
+    cout << "  trace()       " << std::setw(10) << traced << " allocations, "
+         << (double)traced / pixels << " per pixel, " << secs * 1e3 << " ms"
+         << endl;
+
+    for (const char* pass : {"render() cold", "render() warm"}) {
+        before = num_allocations;
+        start = Clock::now();
+        engine.render();
+        secs = seconds_since(start);
+        long rendered = num_allocations - before;
+        cout << "  " << std::left << std::setw(14) << pass << std::right
+             << std::setw(9) << rendered << " allocations, "
+             << (double)rendered / pixels << " per pixel, " << secs * 1e3
+             << " ms" << endl;
+    }
+
+    auto trace = engine.getTrace(res / 2, res / 2);
+    cout << "  getTrace(" << res / 2 << "," << res / 2 << ") recorded "
+         << trace.second.size() << " segments" << endl;
+    // keeps the traced colors alive
+    if (!std::isfinite(sum.sum())) cout << "  non finite color" << endl;
+    return 0;
+}
+
+// Image::write before the bulk writer, one stream insertion per byte
+std::ostream& legacy_write(std::ostream& os, const Image& img) {
+    const Color* data = img.data();
+    os << "P6\n" << img.width << " " << img.height << "\n255\n";
+    for (int i = 0; i < img.width * img.height; ++i) {
+        os << (unsigned char)(std::min(float(1), data[i][0]) * 255)
+           << (unsigned char)(std::min(float(1), data[i][1]) * 255)
+           << (unsigned char)(std::min(float(1), data[i][2]) * 255);
+    }
+    return os;
+}
+
+int bench_image(const std::vector<string>& /*args*/) {
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::vector<std::tuple<string, int, int>> sizes = {
+        {"1K", 1024, 1024}, {"4K", 3840, 2160}, {"8K", 7680, 4320}};
+    ToneMapping gamma;
+    gamma.op = ToneMap::REINHARD;
+    gamma.gamma = 2.2f;
+    cout << "image output benchmark, files in " << dir.string() << endl;
+    cout << std::fixed << std::setprecision(1);
+    for (const auto& [name, w, h] : sizes) {
+        Image img{w, h};
+        // HDR content, a quarter of the values is above 1
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> dis(0.0f, 1.3f);
+        for (int j = 0; j < h; j++)
+            for (int i = 0; i < w; i++)
+                img.set(i, j, Color(dis(rng), dis(rng), dis(rng)));
+
+        auto time_write = [&](const string& file, int runs, auto&& write) {
+            const std::filesystem::path path = dir / file;
+            double t = best_time(runs, [&]() {
+                std::ofstream ofs(path, std::ios::out | std::ios::binary);
+                write(ofs);
+            });
+            std::filesystem::remove(path);
+            return t * 1e3;
+        };
+        const double legacy = time_write("bench_legacy.ppm", 1, [&](std::ostream& os) {
+            legacy_write(os, img);
+        });
+        const double ppm = time_write("bench.ppm", 3, [&](std::ostream& os) {
+            img.write(os);
+        });
+        const double ppm_gamma = time_write("bench_gamma.ppm", 3, [&](std::ostream& os) {
+            img.write(os, gamma);
+        });
+        const double pfm = time_write("bench.pfm", 3, [&](std::ostream& os) {
+            img.writePFM(os);
+        });
+        cout << "  " << name << " " << w << "x" << h << ": per byte PPM "
+             << legacy << " ms, PPM " << ppm << " ms, PPM reinhard+gamma "
+             << ppm_gamma << " ms, PFM " << pfm << " ms" << endl;
+    }
+    return 0;
+}
+
+// Material texture before the cache: 8 bit planar image as CImg keeps it,
+// one nearest texel read per channel
+struct LegacyTexture {
+    int width, height;
+    std::vector<unsigned char> planes;
+    Color sample(float u, float v) const {
+        int w = std::min((int)(u * width), width - 1);
+        int h = std::min((int)(v * height), height - 1);
+        const unsigned char* p = planes.data() + h * width + w;
+        float r = (float)p[0] / 255.0;
+        float g = (float)p[width * height] / 255.0;
+        float b = (float)p[2 * width * height] / 255.0;
+        return Color(r, g, b);
+    }
+};
+
+LegacyTexture legacy_load(const string& path) {
+    int w, h, n;
+    unsigned char* data = stbi_load(path.c_str(), &w, &h, &n, 3);
+    if (!data) throw std::runtime_error("cannot load " + path);
+    LegacyTexture t{w, h, std::vector<unsigned char>(3 * w * h)};
+    for (int i = 0; i < w * h; i++)
+        for (int c = 0; c < 3; c++) t.planes[c * w * h + i] = data[3 * i + c];
+    stbi_image_free(data);
+    return t;
+}
+
+int bench_texture(const std::vector<string>& args) {
+    const string path = args.size() > 0 ? args[0] : "textures/envmap.jpg";
+    const int num_materials = 16;
+    const int num_samples = 1 << 20;
+    cout << "texture benchmark, " << path << endl;
+    cout << std::fixed << std::setprecision(1);
+
+    // one material per model, all using the same image
+    std::vector<LegacyTexture> copies;
+    const double legacy_load_ms = best_time(1, [&]() {
+        for (int i = 0; i < num_materials; i++) copies.push_back(legacy_load(path));
+    }) * 1e3;
+    size_t legacy_bytes = 0;
+    for (const auto& t : copies) legacy_bytes += t.planes.size();
+
+    texture_cache().clear();
+    std::vector<Material> materials(num_materials);
+    const double cache_load_ms = best_time(1, [&]() {
+        for (auto& m : materials) m.setTexture(path);
+    }) * 1e3;
+    const Texture& tex = texture_cache().get(materials[0].texture);
+    cout << "  " << num_materials << " materials: per material copies "
+         << legacy_load_ms << " ms, " << legacy_bytes / 1e6 << " MB | cache "
+         << cache_load_ms << " ms, " << texture_cache().size() << " texture, "
+         << tex.numLevels() << " levels, " << texture_cache().memoryBytes() / 1e6
+         << " MB" << endl;
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    // random: every lookup misses the cache, coherent: a 1024x1024 frame
+    // covering the texture in scanline order
+    std::vector<float> random_uvs(2 * num_samples), coherent_uvs(2 * num_samples);
+    std::vector<float> footprints(num_samples);
+    for (auto& x : random_uvs) x = dis(rng);
+    for (int i = 0; i < num_samples; i++) {
+        coherent_uvs[2 * i] = (i % 1024 + 0.5f) / 1024;
+        coherent_uvs[2 * i + 1] = (i / 1024 + 0.5f) / 1024;
+    }
+    // footprints from a texel to the whole image
+    for (auto& f : footprints)
+        f = std::exp2(-dis(rng) * std::log2((float)tex.width()));
+
+    Color sum = Color::Zero();
+    const LegacyTexture& legacy = copies[0];
+    const std::vector<std::pair<string, TextureFilter>> filters = {
+        {"nearest", TextureFilter::NEAREST},
+        {"bilinear", TextureFilter::BILINEAR},
+        {"trilinear", TextureFilter::TRILINEAR}};
+    for (const auto& [pattern, uvs] :
+         {std::make_pair("random", &random_uvs),
+          std::make_pair("coherent", &coherent_uvs)}) {
+        auto time_samples = [&](auto&& sample) {
+            double t = best_time(3, [&]() {
+                for (int i = 0; i < num_samples; i++)
+                    sum += sample((*uvs)[2 * i], (*uvs)[2 * i + 1], footprints[i]);
+            });
+            return t * 1e9 / num_samples;
+        };
+        const double t_legacy = time_samples(
+            [&](float u, float v, float) { return legacy.sample(u, v); });
+        cout << "  " << pattern << " per sample: legacy nearest " << t_legacy
+             << " ns";
+        for (const auto& [name, filter] : filters) {
+            TextureSampler s;
+            s.filter = filter;
+            const double t = time_samples([&](float u, float v, float f) {
+                return tex.sample(u, v, f, s);
+            });
+            cout << ", " << name << " " << t << " ns";
+        }
+        cout << endl;
+    }
+    if (!std::isfinite(sum.sum())) cout << "  non finite color" << endl;
+    return 0;
+}
+
+// lumpy sphere of about 2 * n * n triangles, stands in for a scanned model
+MeshData lumpy_sphere(int n) {
+    MeshData d;
+    for (int i = 0; i <= n; i++) {
+        const float theta = PI * i / n;
+        for (int j = 0; j <= n; j++) {
+            const float phi = 2 * PI * j / n;
+            const float r = 1 + 0.03f * std::sin(7 * theta) * std::cos(5 * phi);
+            d.px.push_back(r * std::sin(theta) * std::cos(phi));
+            d.py.push_back(r * std::cos(theta));
+            d.pz.push_back(r * std::sin(theta) * std::sin(phi));
+        }
+    }
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++) {
+            const int a = i * (n + 1) + j, b = a + n + 1;
+            for (int idx : {a, b, a + 1, a + 1, b, b + 1}) d.indices.push_back(idx);
+        }
+    return d;
+}
+
+int bench_mesh(const std::vector<string>& args) {
+    const int res = args.size() > 1 ? std::stoi(args[1]) : 512;
+    MeshData data;
+    string name = "lumpy sphere";
+    double load_ms = 0;
+    auto start = Clock::now();
+    if (!args.empty() && args[0] != "-") {
+        name = args[0];
+        data = load_obj(args[0]);
+    } else {
+        data = lumpy_sphere(224);
+    }
+    load_ms = seconds_since(start) * 1e3;
+
+    // fit into the unit sphere 3 units in front of the camera
+    AABB b;
+    for (int i = 0; i < data.numVertices(); i++)
+        b.expand(Vector3f(data.px[i], data.py[i], data.pz[i]));
+    const Vector3f c = b.centroid();
+    const float scale = 2 / (b.max - b.min).norm();
+    for (int i = 0; i < data.numVertices(); i++) {
+        data.px[i] = (data.px[i] - c[0]) * scale;
+        data.py[i] = (data.py[i] - c[1]) * scale;
+        data.pz[i] = (data.pz[i] - c[2]) * scale - 3;
+    }
+
+    Material mat;
+    mat.Ka = mat.Kd = Vector3f(0.5, 0.45, 0.4);
+    mat.Ks = Vector3f(0.2, 0.2, 0.2);
+    mat.specular_coeff = 20;
+    start = Clock::now();
+    TriangleMesh mesh(std::move(data), true, material_table().intern(mat),
+                      IDENTITY_TRANS);
+    const double build_ms = seconds_since(start) * 1e3;
+    const BVHBuildStats& bs = mesh.getBVH().getBuildStats();
+    cout << "mesh benchmark: " << name << ", " << mesh.getData().numTriangles()
+         << " triangles, " << mesh.getData().numVertices() << " vertices"
+         << endl;
+    cout << std::fixed << std::setprecision(1);
+    cout << "  load " << load_ms << " ms, normals + bvh " << build_ms
+         << " ms (" << bs.num_nodes << " nodes, depth " << bs.max_depth
+         << ")" << endl;
+
+    Matrix4f cam_trans = Matrix4f::Identity();
+    Camera cam(cam_trans, 1, 60);
+    Background bg(Color(0.1, 0.1, 0.15));
+    std::vector<Model*> models = {&mesh};
+    Light key(Point(-5, 5, 2), Color(1.2, 1.2, 1.2));
+    Light fill(Point(5, 2, 4), Color(0.5, 0.5, 0.5));
+    std::vector<Light*> lights = {&key, &fill};
+    Image img{res, res};
+    RenderEngine engine(cam, img, bg, models, lights, Color(0.2, 0.2, 0.2));
+    SamplingConfig one_sample;
+    one_sample.min_samples = one_sample.max_samples = 1;
+    engine.setSampling(one_sample);
+    engine.setSeed(42);
+    const double render_s = best_time(2, [&]() { engine.render(); });
+    cout << "  render " << res << "x" << res << " at 1 sample per pixel: "
+         << render_s * 1e3 << " ms, " << res * res / render_s / 1e6
+         << " Mpixels/s on " << std::thread::hardware_concurrency()
+         << " threads" << endl;
+    if (args.size() > 2) engine.writeImage(args[2]);
+    return 0;
+}
+
+// release what get_state made (with its arena) and empty the shared tables,
+// the next load starts cold
+void free_state(State& s) {
+    s = State();
+    texture_cache().clear();
+    material_table().clear();
+}
+
+int bench_scene(const std::vector<string>& args) {
+    if (args.empty()) {
+        cout << "scene benchmark: needs a JSON scene" << endl;
+        return -1;
+    }
+    const string scene = args[0];
+    const string compiled =
+        args.size() > 1 ? args[1]
+                        : (std::filesystem::temp_directory_path() /
+                           "ray_bench.rtscene").string();
+    const int res = 512;
+    cout << "scene benchmark: " << scene << endl;
+    cout << std::fixed << std::setprecision(1);
+
+    auto start = Clock::now();
+    State state = get_state(scene, false);
+    SceneFile::write(state, compiled);
+    const double compile_ms = seconds_since(start) * 1e3;
+    free_state(state);
+    cout << "  compile " << compile_ms << " ms, "
+         << std::filesystem::file_size(compiled) / 1e6 << " MB" << endl;
+
+    // load, engine setup and the center pixel, each run from empty caches
+    auto first_pixel = [&](const string& path) {
+        double total = std::numeric_limits<double>::infinity();
+        double load_ms = 0, setup_ms = 0, trace_ms = 0;
+        Color c;
+        // breakdown of the best of 3 runs
+        for (int run = 0; run < 3; run++) {
+            const auto t0 = Clock::now();
+            State s = get_state(path, false);
+            const auto t1 = Clock::now();
+            Image img{res, res};
+            RenderEngine engine(*s.cam, img, *s.bg, s.models, s.lights,
+                                Color(0.2, 0.2, 0.2), s.bvh.get());
+            const auto t2 = Clock::now();
+            c = engine.trace(s.cam->getRay(0.5f, 0.5f).value(), 1, 0,
+                             PathSample{0, 0, 1});
+            const double run_s = seconds_since(t0);
+            if (run_s < total) {
+                total = run_s;
+                load_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+                setup_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+                trace_ms = seconds_since(t2) * 1e3;
+            }
+            free_state(s);
+        }
+        cout << "  " << std::left << std::setw(8) << (path == scene ? "json" : "binary")
+             << std::right << " first pixel " << std::setw(8) << total * 1e3
+             << " ms (load " << load_ms << ", setup " << setup_ms
+             << ", trace " << trace_ms << ") color " << c << endl;
+        return total;
+    };
+    const double json_s = first_pixel(scene);
+    const double binary_s = first_pixel(compiled);
+    cout << "  speedup " << std::setprecision(2) << json_s / binary_s << "x"
+         << endl;
+    if (args.size() < 2) std::filesystem::remove(compiled);
+    return 0;
+}
+
+// scene loading before the streaming loader: the whole document as one
+// json value, then every section
+State legacy_load_scene(const string& path) {
+    std::ifstream ifile(path);
+    json j;
+    ifile >> j;
+    State s{};
+    for (const json& el : j["materials"]) {
+        auto m = parse_material(el);
+        s.materials[m.first] = m.second;
+    }
+    const string dir = std::filesystem::path(path).parent_path().string();
+    for (const json& el : j["models"])
+        s.models.push_back(
+            parse_model(el, s.materials, *s.arena, false, dir).first);
+    for (const json& el : j["lights"])
+        s.lights.push_back(parse_light(el, *s.arena));
+    s.cam = parse_camera(j["camera"], *s.arena);
+    s.bg = parse_background(j["background"], *s.arena);
+    return s;
+}
+
+double peak_rss_mb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;
+}
+
+int bench_parse(const std::vector<string>& args) {
+    const int n = args.size() > 0 ? std::stoi(args[0]) : 200000;
+    const string path =
+        (std::filesystem::temp_directory_path() / "ray_bench_spheres.json").string();
+    {
+        // a generated scene, one sphere per line
+        std::ofstream out(path);
+        out << "{\n\"materials\": [{\"name\": \"m\", \"Ka\": [0.1,0.1,0.1], "
+               "\"Kd\": [0.5,0.5,0.5], \"Ks\": [0.2,0.2,0.2], \"Krg\": [0,0,0], "
+               "\"Ktg\": [0,0,0], \"ri\": -1, \"sc\": 20}],\n"
+               "\"camera\": {\"ar\": 1, \"fov\": 60, \"trans\": "
+               "[1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1]},\n"
+               "\"background\": {\"color\": [0,0,0]},\n"
+               "\"lights\": [{\"loc\": [0,10,0], \"intensity\": [1,1,1]}],\n"
+               "\"models\": [\n";
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> dis(-100.0f, 100.0f);
+        for (int i = 0; i < n; i++)
+            out << "{\"type\": \"sphere\", \"material\": \"m\", \"center\": ["
+                << dis(rng) << ", " << dis(rng) << ", " << dis(rng) - 200
+                << "], \"radius\": 0.5}" << (i + 1 < n ? ",\n" : "\n");
+        out << "]}\n";
+    }
+    cout << "parse benchmark: " << n << " spheres, "
+         << std::filesystem::file_size(path) / 1e6 << " MB of JSON" << endl;
+    cout << std::fixed << std::setprecision(1);
+
+    // peak RSS only grows, the streaming loader goes first
+    const double base_mb = peak_rss_mb();
+    State s = load_scene(path, false);
+    const double stream_mb = peak_rss_mb();
+    const size_t num_models = s.models.size();
+    free_state(s);
+    s = legacy_load_scene(path);
+    const double dom_mb = peak_rss_mb();
+    free_state(s);
+
+    const double stream_ms = best_time(2, [&]() {
+        s = load_scene(path, false);
+        free_state(s);
+    }) * 1e3;
+    const double dom_ms = best_time(2, [&]() {
+        s = legacy_load_scene(path);
+        free_state(s);
+    }) * 1e3;
+
+    cout << "  streaming " << stream_ms << " ms, peak RSS " << stream_mb
+         << " MB (+" << stream_mb - base_mb << ")" << endl;
+    cout << "  document  " << dom_ms << " ms, peak RSS " << dom_mb
+         << " MB (+" << dom_mb - base_mb << ")" << endl;
+    cout << "  " << num_models << " models, " << n * 1e3 / stream_ms / 1e6
+         << " M models/s streaming" << endl;
+    std::filesystem::remove(path);
+    return 0;
+}
+
+int bench_instance(const std::vector<string>& args) {
+    const int n = args.size() > 0 ? std::stoi(args[0]) : 1000;
+    const int res = args.size() > 1 ? std::stoi(args[1]) : 256;
+    Material mat;
+    mat.Ka = mat.Kd = Vector3f(0.5, 0.45, 0.4);
+    mat.Ks = Vector3f(0.2, 0.2, 0.2);
+    mat.specular_coeff = 20;
+    auto mesh = std::make_shared<const TriangleMesh>(
+        lumpy_sphere(64), true, material_table().intern(mat), IDENTITY_TRANS);
+    cout << "instance benchmark: " << n << " placements of a "
+         << mesh->getData().numTriangles() << " triangle mesh" << endl;
+    cout << std::fixed << std::setprecision(1);
+
+    // a grid facing the camera, every object turned and scaled differently
+    const int k = std::ceil(std::sqrt(n));
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    std::vector<Transformation> placements;
+    for (int i = 0; i < n; i++) {
+        const float a = 2 * PI * dis(rng), scale = 0.6f + 0.4f * dis(rng);
+        Matrix3f m;
+        m << std::cos(a), 0, -std::sin(a), 0, 1, 0, std::sin(a), 0,
+            std::cos(a);
+        const Vector3f r(2.5f * (i % k - k / 2.0f), 2.5f * (i / k - k / 2.0f),
+                         -2.25f * k - 3);
+        placements.emplace_back(m * scale, r);
+    }
+
+    Matrix4f cam_trans = Matrix4f::Identity();
+    Camera cam(cam_trans, 1, 60);
+    Background bg(Color(0.1, 0.1, 0.15));
+    Light key(Point(-5, 5, 2), Color(1.2, 1.2, 1.2));
+    std::vector<Light*> lights = {&key};
+    SamplingConfig one_sample;
+    one_sample.min_samples = one_sample.max_samples = 1;
+    auto render = [&](const std::vector<Model*>& models, Image& img) {
+        RenderEngine engine(cam, img, bg, models, lights, Color(0.2, 0.2, 0.2));
+        engine.setSampling(one_sample);
+        engine.setSeed(42);
+        return best_time(2, [&]() { engine.render(); });
+    };
+
+    // peak RSS only grows, the smaller scene goes first
+    double base_mb = peak_rss_mb();
+    std::vector<Model*> instances;
+    for (const Transformation& t : placements)
+        instances.push_back(new Instance(mesh, t));
+    Image inst_img{res, res};
+    const double inst_s = render(instances, inst_img);
+    const double inst_mb = peak_rss_mb() - base_mb;
+
+    base_mb = peak_rss_mb();
+    std::vector<Model*> copies;
+    for (const Transformation& t : placements) {
+        TriangleMesh* copy = new TriangleMesh(*mesh);
+        copy->trans = t;
+        copies.push_back(copy);
+    }
+    Image copy_img{res, res};
+    const double copy_s = render(copies, copy_img);
+    const double copy_mb = peak_rss_mb() - base_mb;
+
+    float max_diff = 0;
+    for (int i = 0; i < res * res; i++)
+        max_diff = std::max(
+            max_diff, (inst_img.data()[i] - copy_img.data()[i]).cwiseAbs().maxCoeff());
+    cout << "  instances +" << inst_mb << " MB, render " << inst_s * 1e3
+         << " ms" << endl;
+    cout << "  copies    +" << copy_mb << " MB, render " << copy_s * 1e3
+         << " ms" << endl;
+    cout << "  largest pixel difference " << max_diff << endl;
+    for (Model* m : instances) delete m;
+    for (Model* m : copies) delete m;
+    return 0;
+}
+
+// Polygon::contains as it was before the 2D projection, a crossing ray
+// built in 3D for every query, kept as the baseline of the polygon benchmark
+namespace legacy {
+bool polygon_contains(const std::vector<Point>& points, const Plane& plane,
+                      const Point& p) {
+    if (!plane.contains(p)) return false;
+    Point other_p = (points[0] + points[1]) / 2;
+    if ((other_p - p).norm() <= EPSILON) other_p = (points[1] + points[2]) / 2;
+    Vector3f d = (p - other_p).normalized();
+    Vector3f n = (d.cross(plane.getNormal())).normalized();
+    int num_intersections = 0;
+    for (size_t i = 0; i + 1 < points.size(); i++) {
+        const Point& x = points[i];
+        const Point& y = points[i + 1];
+        float t = (p - y).dot(n) / (x - y).dot(n);
+        if (t <= 0 || t >= 1) continue;
+        Point intersect_point = x * t + (1 - t) * y;
+        if ((intersect_point - p).dot(d) < 0) continue;
+        num_intersections++;
+    }
+    return num_intersections % 2 == 1;
+}
+}  // namespace legacy
+
+int bench_polygon(const std::vector<string>& args) {
+    const int num_rays = args.empty() ? 1 << 18 : std::stoi(args[0]);
+    // star shaped, so not convex, in a tilted plane
+    const Matrix3f rot =
+        Eigen::AngleAxisf(0.4f, Vector3f(1, 2, 0).normalized().transpose())
+            .toRotationMatrix();
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    std::vector<Ray> rays;
+    const Vector3f eye = Vector3f(0.3f, -0.2f, 4) * rot;
+    for (int i = 0; i < num_rays; i++)
+        rays.push_back(Ray(eye, Vector3f(dis(rng), dis(rng), 0) * rot - eye));
+
+    cout << "polygon benchmark: " << num_rays
+         << " rays at a star shaped polygon" << endl;
+    cout << std::fixed << std::setprecision(1);
+    for (int corners : {4, 16, 64}) {
+        std::vector<Point> points;
+        for (int i = 0; i < corners; i++) {
+            const float a = 2 * PI * i / corners,
+                        r = i % 2 ? 0.5f : 1.0f;
+            points.push_back(Vector3f(r * std::cos(a), r * std::sin(a), 0) * rot);
+        }
+        Polygon polygon(points, 0, IDENTITY_TRANS);
+        std::vector<Point> closed = points;
+        closed.push_back(points[0]);
+        Plane plane(Ray(points[0], (points[0] - points[1]).cross(points[0] - points[2])),
+                    0, IDENTITY_TRANS);
+
+        std::vector<char> before_hit(rays.size()), after_hit(rays.size());
+        double before = best_time(3, [&]() {
+            for (size_t i = 0; i < rays.size(); i++) {
+                auto h = plane._intersect(rays[i]);
+                before_hit[i] =
+                    h && legacy::polygon_contains(
+                             closed, plane, rays[i].src + h.value().t * rays[i].dir);
+            }
+        });
+        double after = best_time(3, [&]() {
+            for (size_t i = 0; i < rays.size(); i++)
+                after_hit[i] = polygon._intersect(rays[i]).has_value();
+        });
+        long hits = 0, mismatches = 0;
+        for (size_t i = 0; i < rays.size(); i++) {
+            hits += after_hit[i];
+            mismatches += before_hit[i] != after_hit[i];
+        }
+        cout << "  " << std::setw(2) << corners << " corners  before "
+             << std::setw(6) << before / num_rays * 1e9 << " ns/ray  after "
+             << std::setw(6) << after / num_rays * 1e9 << " ns/ray  speedup "
+             << std::setprecision(2) << before / after << "x  hits "
+             << hits << "  mismatches " << mismatches << std::setprecision(1)
+             << endl;
+    }
+    return 0;
+}
+
+// Quadric intersection as it was before the coefficients were expanded,
+// three products with the 4x4 matrix through Eigen temporaries
+namespace legacy {
+std::optional<float> quadric_distance(const Matrix4f& M, const Ray& r) {
+    auto Ro = augment(r.src, 1.0);
+    auto Rd = augment(r.dir, 0.0);
+    float Aq = Rd * M * (Rd.transpose());
+    float Bq = Rd * M * (Ro.transpose());
+    Bq += Ro * M * (Rd.transpose());
+    float Cq = Ro * M * (Ro.transpose());
+    auto inters = solve_quadratic(Aq, Bq, Cq);
+    if (!inters) return {};
+    auto d = (inters.value().first < 0) ? (inters.value().second)
+                                        : (inters.value().first);
+    if (d < 0) return {};
+    return d;
+}
+}  // namespace legacy
+
+int bench_quadric(const std::vector<string>& args) {
+    const int num_rays = args.empty() ? 1 << 18 : std::stoi(args[0]);
+    // rays from around the unit cylinder along z aimed near its axis
+    std::mt19937 rng(5);
+    std::normal_distribution<float> gauss;
+    std::uniform_real_distribution<float> dis(-2.0f, 2.0f);
+    std::vector<Ray> rays;
+    for (int i = 0; i < num_rays; i++) {
+        Vector3f a(gauss(rng), gauss(rng), 0);
+        Vector3f src = 4 * a.normalized() + Vector3f(0, 0, dis(rng));
+        rays.push_back(Ray(src, Vector3f(0.5f * gauss(rng), 0.5f * gauss(rng),
+                                         dis(rng)) - src));
+    }
+    const QuadricParams cylinder({1, 0, 0, 0, 1, 0, 0, 0, 0, -1});
+    Matrix4f M;
+    M << 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1;
+
+    cout << "quadric benchmark: " << num_rays << " rays at a unit cylinder"
+         << endl;
+    cout << std::fixed << std::setprecision(1);
+    // the distance alone is timed, through the occlusion query
+    const float miss = -1;
+    std::vector<float> before_t(rays.size()), after_t(rays.size());
+    long before_hits = 0, after_hits = 0;
+    double before = best_time(3, [&]() {
+        before_hits = 0;
+        for (const Ray& r : rays)
+            before_hits += legacy::quadric_distance(M, r).has_value();
+    });
+    Quadric open(cylinder, 0, IDENTITY_TRANS);
+    const float inf = std::numeric_limits<float>::infinity();
+    double after = best_time(3, [&]() {
+        after_hits = 0;
+        for (const Ray& r : rays) after_hits += open._occluded(r, inf);
+    });
+    for (size_t i = 0; i < rays.size(); i++) {
+        before_t[i] = legacy::quadric_distance(M, rays[i]).value_or(miss);
+        auto h = open._intersect(rays[i]);
+        after_t[i] = h ? h.value().t : miss;
+    }
+    long hits = after_hits, mismatches = before_hits != after_hits;
+    for (size_t i = 0; i < rays.size(); i++) {
+        mismatches += (before_t[i] == miss) != (after_t[i] == miss) ||
+                      fabs(before_t[i] - after_t[i]) >
+                          EPSILON * std::max(1.0f, fabs(before_t[i]));
+    }
+    cout << "  unbounded   before " << std::setw(5)
+         << before / num_rays * 1e9 << " ns/ray  after " << std::setw(5)
+         << after / num_rays * 1e9 << " ns/ray  speedup "
+         << std::setprecision(2) << before / after << "x  hits " << hits
+         << "  mismatches " << mismatches << std::setprecision(1) << endl;
+
+    // the same cylinder cut to |z| <= 1, rays through the open ends see
+    // the inside
+    Quadric clipped(cylinder, 0, IDENTITY_TRANS,
+                    AABB(Vector3f(-1, -1, -1), Vector3f(1, 1, 1)));
+    long clipped_hits = 0, inside = 0;
+    double clipped_s = best_time(3, [&]() {
+        clipped_hits = inside = 0;
+        for (const Ray& r : rays) {
+            auto h = clipped.intersect(r);
+            clipped_hits += h.has_value();
+            inside += h && h.value().inside;
+        }
+    });
+    cout << "  clipped |z|<=1  " << std::setw(5)
+         << clipped_s / num_rays * 1e9 << " ns/ray with the hit record  hits "
+         << clipped_hits
+         << " (" << inside << " from inside)  bounds " << clipped.getBounds()
+         << endl;
+    return 0;
+}
+
+// spheres, triangles and clipped cylinders spread in front of the camera
+// over a floor plane, a third of the spheres placed by a rigid transform
+std::vector<Model*> mixed_scene(int n) {
+    Material mat;
+    mat.Kd = Vector3f(0.5, 0.5, 0.5);
+    const MaterialId id = material_table().intern(mat);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    auto position = [&]() {
+        return Vector3f(12 * dis(rng), 8 * dis(rng), -20 + 10 * dis(rng));
+    };
+    std::vector<Model*> models;
+    models.push_back(new Plane(Ray(Point(0, -9, 0), Vector3f(0, 1, 0)), id,
+                               IDENTITY_TRANS));
+    for (int i = 0; i < n; i++) {
+        switch (i % 3) {
+            case 0: {
+                const Matrix3f rot =
+                    Eigen::AngleAxisf(dis(rng), Vector3f(1, 1, 0).normalized().transpose())
+                        .toRotationMatrix();
+                const float r = 0.1f + 0.2f * (1 + dis(rng));
+                if (i % 9 == 0)
+                    models.push_back(new Sphere(Point::Zero(), r, id,
+                                                Transformation(rot, position())));
+                else
+                    models.push_back(new Sphere(position(), r, id, IDENTITY_TRANS));
+                break;
+            }
+            case 1: {
+                const Point p = position();
+                const Vector3f a(dis(rng), dis(rng), dis(rng)),
+                    b(dis(rng), dis(rng), dis(rng));
+                models.push_back(new Triangle(p, p + 0.6f * a, p + 0.6f * b, id,
+                                              IDENTITY_TRANS));
+                break;
+            }
+            default: {
+                const Point p = position();
+                const float r = 0.2f;
+                QuadricParams cylinder({1, 0, 0, -p[0], 1, 0, -p[1], 0, 0,
+                                        p[0] * p[0] + p[1] * p[1] - r * r});
+                models.push_back(new Quadric(
+                    cylinder, id, IDENTITY_TRANS,
+                    AABB(p - Vector3f(r, r, 0.5f), p + Vector3f(r, r, 0.5f))));
+            }
+        }
+    }
+    return models;
+}
+
+int bench_flat(const std::vector<string>& args) {
+    const int res = args.size() > 1 ? std::stoi(args[1]) : 512;
+    std::vector<Model*> owned;
+    std::vector<const Model*> models;
+    Matrix4f cam_trans = Matrix4f::Identity();
+    const Camera default_cam(cam_trans, 1, 60);
+    const Camera* cam = &default_cam;
+    State state;
+    if (!args.empty() && args[0] != "-") {
+        state = get_state(args[0], false);
+        models.assign(state.models.begin(), state.models.end());
+        cam = state.cam;
+    } else {
+        owned = mixed_scene(12000);
+        models.assign(owned.begin(), owned.end());
+    }
+
+    std::vector<AABB> bounds;
+    for (const Model* m : models) bounds.push_back(m->getBounds());
+    BVH bvh;
+    bvh.build(bounds);
+    FlatScene flat(models, bvh.getOrder());
+    cout << "flat benchmark: " << res << "x" << res << " primary rays, "
+         << models.size() << " models: " << flat.count(FlatScene::SPHERE)
+         << " spheres, " << flat.count(FlatScene::TRIANGLE) << " triangles, "
+         << flat.count(FlatScene::PLANE) << " planes, "
+         << flat.count(FlatScene::QUADRIC) << " quadrics, "
+         << flat.count(FlatScene::MODEL) << " others" << endl;
+
+    const std::vector<Ray> rays = primary_rays(*cam, res, res, res);
+    const Point light(0, 20, 0);
+    std::vector<SceneHit> model_hits(rays.size()), flat_hits(rays.size());
+    std::vector<char> model_shadow(rays.size()), flat_shadow(rays.size());
+    // closest hit of every ray, then a shadow ray from every hit
+    auto run = [&](std::vector<SceneHit>& hits, std::vector<char>& shadow,
+                   auto&& closest, auto&& occluded) {
+        for (size_t i = 0; i < rays.size(); i++) {
+            hits[i] = SceneHit{NULL, Hit()};
+            float tmax = std::numeric_limits<float>::infinity();
+            bvh.intersect(rays[i], tmax, [&](int idx, float t) {
+                return closest(idx, rays[i], t, hits[i]);
+            });
+            shadow[i] = false;
+            if (!hits[i].model) continue;
+            const Point p = rays[i].src + hits[i].hit.t * rays[i].dir +
+                            EPSILON * hits[i].hit.normal;
+            const Ray to_light(p, light - p);
+            shadow[i] = bvh.occluded(to_light, to_light.length, [&](int idx, float t) {
+                return occluded(idx, to_light, t);
+            });
+        }
+    };
+    auto model_closest = [&](int idx, const Ray& r, float tmax,
+                             SceneHit& hit) -> std::optional<float> {
+        auto h = models[idx]->intersect(r);
+        if (!h || h.value().t >= tmax) return {};
+        hit = SceneHit{models[idx], h.value()};
+        return h.value().t;
+    };
+    auto model_occluded = [&](int idx, const Ray& r, float tmax) {
+        return models[idx]->occluded(r, tmax);
+    };
+    auto flat_closest = [&](int idx, const Ray& r, float tmax,
+                            SceneHit& hit) -> std::optional<float> {
+        if (!flat.intersect(idx, r, tmax, hit.hit)) return {};
+        hit.model = models[idx];
+        return hit.hit.t;
+    };
+    auto flat_occluded = [&](int idx, const Ray& r, float tmax) {
+        return flat.occluded(idx, r, tmax);
+    };
+
+    const double before = best_time(3, [&]() {
+        run(model_hits, model_shadow, model_closest, model_occluded);
+    });
+    const double after = best_time(3, [&]() {
+        run(flat_hits, flat_shadow, flat_closest, flat_occluded);
+    });
+    long hits = 0, mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i++) {
+        const SceneHit &a = model_hits[i], &b = flat_hits[i];
+        hits += a.model != NULL;
+        mismatches +=
+            a.model != b.model ||
+            (a.model && (fabs(a.hit.t - b.hit.t) > EPSILON * std::max(1.0f, a.hit.t) ||
+                         (a.hit.normal - b.hit.normal).norm() > 0.05f ||
+                         model_shadow[i] != flat_shadow[i]));
+    }
+    const long num_rays = rays.size() + hits;
+    cout << std::fixed << std::setprecision(2);
+    cout << "  Model  " << std::setw(6) << num_rays / before / 1e6
+         << " Mrays/s" << endl;
+    cout << "  flat   " << std::setw(6) << num_rays / after / 1e6
+         << " Mrays/s  speedup " << before / after << "x  hits " << hits
+         << "  mismatches " << mismatches << endl;
+    for (Model* m : owned) delete m;
+    return 0;
+}
+
+// glass spheres in front of a mirror floor and wall, every glass hit spawns
+// a reflected and a refracted ray
+std::vector<std::unique_ptr<Model>> glass_scene() {
+    const MaterialId glass = material_table().intern(
+        Material(Vector3f::Zero(), Vector3f::Constant(0.05f),
+                 Vector3f::Constant(0.5f), Vector3f::Constant(0.3f),
+                 Vector3f::Constant(0.9f), 1.5f, 125));
+    const MaterialId mirror = material_table().intern(
+        Material(Vector3f::Zero(), Vector3f::Constant(0.1f),
+                 Vector3f::Constant(0.5f), Vector3f::Constant(0.8f),
+                 Vector3f::Zero(), -1, 500));
+    const MaterialId rubber = material_table().intern(
+        Material(Vector3f(0.27, 0.09, 0.09), Vector3f(0.27, 0.09, 0.09),
+                 Vector3f::Constant(0.1f), Vector3f::Zero(), Vector3f::Zero(),
+                 -1, 10));
+    std::vector<std::unique_ptr<Model>> models;
+    models.emplace_back(new Plane(Ray(Point(0, -1.5, 0), Vector3f(0, 1, 0)),
+                                  mirror, IDENTITY_TRANS));
+    models.emplace_back(new Plane(Ray(Point(0, 0, -14), Vector3f(0, 0, 1)),
+                                  mirror, IDENTITY_TRANS));
+    for (int i = 0; i < 5; i++)
+        for (int j = 0; j < 3; j++)
+            models.emplace_back(new Sphere(
+                Point(2.2f * (i - 2), 1.8f * (j - 1), -8 - (i + j) % 2),
+                0.8f, (i + j) % 3 ? glass : rubber, IDENTITY_TRANS));
+    return models;
+}
+
+int bench_trace(const std::vector<string>& args) {
+    const int res = args.size() > 0 ? std::stoi(args[0]) : 256;
+    std::vector<std::unique_ptr<Model>> owned = glass_scene();
+    std::vector<Model*> models;
+    for (const auto& m : owned) models.push_back(m.get());
+
+    Matrix4f cam_trans = Matrix4f::Identity();
+    Camera cam(cam_trans, 1, 60);
+    Background bg(Color(0.3, 0.5, 0.7));
+    Light key(Point(-4, 6, 0), Color(1, 1, 1));
+    std::vector<Light*> lights = {&key};
+    SamplingConfig sampling;
+    sampling.min_samples = sampling.max_samples = 4;
+    auto render = [&](const TraceConfig& tc, Image& img) {
+        RenderEngine engine(cam, img, bg, models, lights, Color(0.2, 0.2, 0.2));
+        engine.setSampling(sampling);
+        engine.setTracing(tc);
+        engine.setSeed(42);
+        return best_time(2, [&]() { engine.render(); });
+    };
+    cout << "trace benchmark: " << res << "x" << res << ", "
+         << sampling.min_samples << " samples per pixel, " << owned.size()
+         << " models" << endl;
+    cout << std::fixed << std::setprecision(4);
+
+    // every ray of nonzero weight to depth 8, the others are measured
+    // against it
+    TraceConfig full;
+    full.max_depth = 8;
+    full.min_contribution = 0;
+    Image reference{res, res};
+    const double full_s = render(full, reference);
+    double mean = 0;
+    for (int i = 0; i < res * res; i++) mean += reference.data()[i].mean();
+    cout << "  mean pixel value " << mean / (res * res) << endl;
+    auto report = [&](const string& name, const TraceConfig& tc) {
+        Image img{res, res};
+        const double t = render(tc, img);
+        double sq = 0;
+        for (int i = 0; i < res * res; i++)
+            sq += (img.data()[i] - reference.data()[i]).squaredNorm() / 3;
+        cout << "  " << std::left << std::setw(28) << name << std::right
+             << std::setw(10) << t * 1e3 << " ms  " << std::setw(6)
+             << full_s / t << "x  RMSE " << std::sqrt(sq / (res * res))
+             << endl;
+    };
+    report("depth 8, no pruning", full);
+    TraceConfig shallow;
+    report("depth 3", shallow);
+    TraceConfig pruned = full;
+    pruned.min_contribution = TraceConfig().min_contribution;
+    report("depth 8, pruned", pruned);
+    for (int depth : {2, 3}) {
+        TraceConfig roulette = pruned;
+        roulette.roulette_depth = depth;
+        report("depth 8, roulette from " + std::to_string(depth), roulette);
+    }
+    TraceConfig deep = pruned;
+    deep.max_depth = 16;
+    deep.roulette_depth = 3;
+    report("depth 16, roulette from 3", deep);
+    return 0;
+}
+
+// the glass scene traced recursively and breadth first, a scene file can be
+// given instead. The images must match up to rounding
+int bench_wavefront(const std::vector<string>& args) {
+    const int res = args.size() > 0 ? std::stoi(args[0]) : 256;
+    std::vector<std::unique_ptr<Model>> owned;
+    std::vector<Model*> models;
+    const Camera* cam;
+    const Background* bg;
+    std::vector<Light*> lights;
+    SamplingConfig sampling;
+    TraceConfig tracing;
+    tracing.max_depth = 8;
+    State state;
+    Matrix4f cam_trans = Matrix4f::Identity();
+    Camera default_cam(cam_trans, 1, 60);
+    Background default_bg(Color(0.3, 0.5, 0.7));
+    Light key(Point(-4, 6, 0), Color(1, 1, 1));
+    if (args.size() > 1) {
+        state = get_state(args[1]);
+        models = state.models;
+        cam = state.cam;
+        bg = state.bg;
+        lights = state.lights;
+        sampling = state.sampling;
+        tracing = state.tracing;
+    } else {
+        owned = glass_scene();
+        for (const auto& m : owned) models.push_back(m.get());
+        cam = &default_cam;
+        bg = &default_bg;
+        lights = {&key};
+        sampling.min_samples = sampling.max_samples = 4;
+    }
+    sampling.max_samples = sampling.min_samples;  // no adaptive samples
+    cout << "wavefront benchmark: " << res << "x" << res << ", "
+         << sampling.min_samples << " samples per pixel, depth "
+         << tracing.max_depth << ", " << models.size() << " models, 1 thread"
+         << endl;
+    cout << std::fixed << std::setprecision(4);
+
+    auto render = [&](bool wavefront, int packet_size, Image& img) {
+        RenderEngine engine(*cam, img, *bg, models, lights,
+                            Color(0.2, 0.2, 0.2));
+        engine.setSampling(sampling);
+        engine.setTracing(tracing);
+        engine.setNumThreads(1);
+        engine.setPacketSize(packet_size);
+        engine.setWavefront(wavefront);
+        engine.setSeed(42);
+        return best_time(3, [&]() { engine.render(); });
+    };
+    // the packet kernels round differently from the scalar ones, so both
+    // tracers use the same packets
+    for (int packet_size : {1, 4, 8, 16}) {
+        Image recursive{res, res}, wavefront{res, res};
+        const double recursive_s = render(false, packet_size, recursive);
+        const double wavefront_s = render(true, packet_size, wavefront);
+        float max_diff = 0;
+        double sq = 0;
+        for (int i = 0; i < res * res; i++) {
+            const Color d = wavefront.data()[i] - recursive.data()[i];
+            max_diff = std::max(max_diff, d.cwiseAbs().maxCoeff());
+            sq += d.squaredNorm() / 3;
+        }
+        cout << "  packets of " << std::setw(2) << packet_size
+             << "  recursive " << std::setw(10) << recursive_s * 1e3
+             << " ms  wavefront " << std::setw(10) << wavefront_s * 1e3
+             << " ms  " << std::setw(6) << recursive_s / wavefront_s
+             << "x  max diff " << max_diff << "  RMSE "
+             << std::sqrt(sq / (res * res)) << endl;
+    }
+    return 0;
+}
+
+// error against a reference image of every sampler at growing sample counts,
+// on the glass scene with Russian roulette (or a scene file), so both the
+// positions in the pixels and the decisions of the paths are sampled
+int bench_sampler(const std::vector<string>& args) {
+    const int res = args.size() > 0 ? std::stoi(args[0]) : 64;
+    std::vector<std::unique_ptr<Model>> owned;
+    std::vector<Model*> models;
+    const Camera* cam;
+    const Background* bg;
+    std::vector<Light*> lights;
+    TraceConfig tracing;
+    tracing.max_depth = 8;
+    tracing.roulette_depth = 1;
+    State state;
+    Matrix4f cam_trans = Matrix4f::Identity();
+    Camera default_cam(cam_trans, 1, 60);
+    Background default_bg(Color(0.3, 0.5, 0.7));
+    Light key(Point(-4, 6, 0), Color(1, 1, 1));
+    if (args.size() > 1) {
+        state = get_state(args[1]);
+        models = state.models;
+        cam = state.cam;
+        bg = state.bg;
+        lights = state.lights;
+        tracing = state.tracing;
+    } else {
+        owned = glass_scene();
+        for (const auto& m : owned) models.push_back(m.get());
+        cam = &default_cam;
+        bg = &default_bg;
+        lights = {&key};
+    }
+    const int reference_samples = 1024;
+    const unsigned int num_seeds = 4;
+    cout << "sampler benchmark: " << res << "x" << res << ", depth "
+         << tracing.max_depth << ", roulette from " << tracing.roulette_depth
+         << ", " << models.size() << " models, RMSE against "
+         << reference_samples << " Sobol samples per pixel, mean of "
+         << num_seeds << " seeds" << endl;
+
+    auto render = [&](SamplerType type, int samples, unsigned int seed,
+                      Image& img) {
+        RenderEngine engine(*cam, img, *bg, models, lights,
+                            Color(0.2, 0.2, 0.2));
+        SamplingConfig sampling;
+        sampling.min_samples = sampling.max_samples = samples;
+        sampling.sampler = type;
+        engine.setSampling(sampling);
+        engine.setTracing(tracing);
+        engine.setSeed(seed);
+        return best_time(1, [&]() { engine.render(); });
+    };
+    Image reference{res, res};
+    render(SamplerType::SOBOL, reference_samples, 0, reference);
+
+    const std::vector<int> counts = {1, 4, 16, 64};
+    cout << "  " << std::left << std::setw(12) << "samples" << std::right;
+    for (int n : counts) cout << std::setw(10) << n;
+    cout << std::setw(12) << "ms at " << counts.back() << endl;
+    cout << std::fixed;
+    for (auto sampler : {std::make_pair("random", SamplerType::RANDOM),
+                         std::make_pair("stratified", SamplerType::STRATIFIED),
+                         std::make_pair("halton", SamplerType::HALTON),
+                         std::make_pair("sobol", SamplerType::SOBOL)}) {
+        cout << "  " << std::left << std::setw(12) << sampler.first
+             << std::right << std::setprecision(5);
+        double ms = 0;
+        for (int n : counts) {
+            // a few bright pixels dominate the error of one image, the
+            // squared error is averaged over seeds
+            double sq = 0;
+            ms = 0;
+            for (unsigned int seed = 1; seed <= num_seeds; seed++) {
+                Image img{res, res};
+                ms += render(sampler.second, n, seed, img) * 1e3 / num_seeds;
+                for (int i = 0; i < res * res; i++)
+                    sq += (img.data()[i] - reference.data()[i]).squaredNorm() / 3;
+            }
+            cout << std::setw(10) << std::sqrt(sq / (res * res * num_seeds));
+        }
+        cout << std::setprecision(1) << std::setw(12) << ms << endl;
+    }
+    return 0;
+}
+
+// scene objects as they were made before the arena, one new and one delete
+// each, kept as the baseline of the arena benchmark
+namespace legacy {
+struct HeapMaker {
+    std::vector<Model*> owned;
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        T* object = new T(std::forward<Args>(args)...);
+        owned.push_back(object);
+        return object;
+    }
+    ~HeapMaker() {
+        for (Model* m : owned) delete m;
+    }
+};
+}  // namespace legacy
+
+// spheres, triangles, boxes and collections of 8 triangles made by maker,
+// n models in all
+template <typename Maker>
+std::vector<Model*> make_models(Maker& maker, int n, MaterialId id) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dis(-10.0f, 10.0f);
+    auto position = [&]() { return Point(dis(rng), dis(rng), dis(rng) - 30); };
+    std::vector<Model*> models;
+    for (int i = 0; i < n; i++) {
+        const Point p = position();
+        switch (i % 4) {
+            case 0:
+                models.push_back(maker.template make<Sphere>(p, 0.5f, id, IDENTITY_TRANS));
+                break;
+            case 1:
+                models.push_back(maker.template make<Triangle>(
+                    p, p + Vector3f(1, 0, 0), p + Vector3f(0, 1, 0), id,
+                    IDENTITY_TRANS));
+                break;
+            case 2:
+                models.push_back(maker.template make<Box>(
+                    p, Vector3f(1, 0, 0), Vector3f(0, 1, 0), 1, 1, 1, id,
+                    IDENTITY_TRANS));
+                break;
+            default: {
+                Collection* c = maker.template make<Collection>(id, IDENTITY_TRANS);
+                for (int k = 0; k < 8; k++)
+                    c->addModel(maker.template make<Triangle>(
+                        p + Vector3f(k, 0, 0), p + Vector3f(k + 1, 0, 0),
+                        p + Vector3f(k, 1, 0), id, IDENTITY_TRANS));
+                c->buildBVH();
+                models.push_back(c);
+            }
+        }
+    }
+    return models;
+}
+
+// resident set size now, unlike the peak it also goes down
+double rss_mb() {
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE) / 1e6;
+}
+
+int bench_arena(const std::vector<string>& args) {
+    const int n = args.size() > 0 ? std::stoi(args[0]) : 100000;
+    Material mat;
+    const MaterialId id = material_table().intern(mat);
+    cout << "arena benchmark: " << n << " models" << endl;
+    cout << std::fixed << std::setprecision(2);
+
+    // a scene file loaded and released again and again keeps its memory,
+    // first while the heap is still small
+    const string path =
+        (std::filesystem::temp_directory_path() / "ray_bench_arena.json").string();
+    {
+        std::ofstream out(path);
+        out << "{\n\"materials\": [{\"name\": \"m\", \"Ka\": [0.1,0.1,0.1], "
+               "\"Kd\": [0.5,0.5,0.5], \"Ks\": [0.2,0.2,0.2], \"Krg\": [0,0,0], "
+               "\"Ktg\": [0,0,0], \"ri\": -1, \"sc\": 20}],\n"
+               "\"camera\": {\"ar\": 1, \"fov\": 60, \"trans\": "
+               "[1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1]},\n"
+               "\"background\": {\"color\": [0,0,0]},\n"
+               "\"lights\": [{\"loc\": [0,10,0], \"intensity\": [1,1,1]}],\n"
+               "\"models\": [\n";
+        for (int i = 0; i < n / 4; i++)
+            out << "{\"type\": \"box\", \"material\": \"m\", \"center\": [" << i
+                << ", 0, -20], \"x_axis\": [1,0,0], \"y_axis\": [0,1,0], "
+                   "\"length\": 1, \"breadth\": 1, \"height\": 1},\n"
+                << "{\"type\": \"sphere\", \"material\": \"m\", \"center\": ["
+                << i << ", 2, -20], \"radius\": 0.5}" << (i + 1 < n / 4 ? ",\n" : "\n");
+        out << "]}\n";
+    }
+    cout << "  reloads of " << n / 2 << " models, RSS";
+    const double base_mb = rss_mb();
+    for (int r = 0; r < 5; r++) {
+        State s = load_scene(path, false);
+        cout << " " << rss_mb() - base_mb;
+        s = State();
+        cout << "/" << rss_mb() - base_mb;
+    }
+    cout << " MB (loaded/released)" << endl;
+    std::filesystem::remove(path);
+
+    {
+        SceneArena arena;
+        make_models(arena, n, id);
+        arena.printStats(cout);
+    }
+
+    // build and teardown, the teardown timed on its own
+    auto run = [&](auto&& build) {
+        double make_s = std::numeric_limits<double>::infinity(),
+               free_s = make_s;
+        long allocs = 0;
+        for (int r = 0; r < 3; r++) {
+            const long before = num_allocations.load();
+            auto start = Clock::now();
+            auto owner = build();
+            make_s = std::min(make_s, seconds_since(start));
+            allocs = num_allocations.load() - before;
+            start = Clock::now();
+            owner.reset();
+            free_s = std::min(free_s, seconds_since(start));
+        }
+        cout << std::setw(8) << make_s * 1e3 << " ms to make, " << std::setw(7)
+             << free_s * 1e3 << " ms to free, " << allocs << " allocations"
+             << endl;
+    };
+    cout << "  heap  ";
+    run([&]() {
+        auto heap = std::make_unique<legacy::HeapMaker>();
+        make_models(*heap, n, id);
+        return heap;
+    });
+    cout << "  arena ";
+    run([&]() {
+        auto arena = std::make_unique<SceneArena>();
+        make_models(*arena, n, id);
+        return arena;
+    });
+    return 0;
+}
+
+const std::map<string, std::pair<string, std::function<int(const std::vector<string>&)>>>
+    BENCHMARKS = {
+        {"alloc",
+         {"heap allocations of the render path", bench_alloc}},
+        {"arena",
+         {"bytes per model type, make and free time of scene objects against "
+          "the heap and memory across reloads",
+          bench_arena}},
+        {"flat",
+         {"closest hit and shadow rays through Model and through FlatScene",
+          bench_flat}},
+        {"image",
+         {"PPM and PFM output of 1K, 4K and 8K frames", bench_image}},
+        {"instance",
+         {"memory and render time of instances against copies of a mesh",
+          bench_instance}},
+        {"mesh",
+         {"OBJ load, BVH build and render time of a triangle mesh",
+          bench_mesh}},
+        {"parse",
+         {"streaming and whole document loading of a large JSON scene",
+          bench_parse}},
+        {"polygon",
+         {"ray hits on polygons of 4 to 64 corners", bench_polygon}},
+        {"packet",
+         {"primary ray throughput of the scalar and the SIMD packet path",
+          bench_packet}},
+        {"quadric",
+         {"ray hits on an unbounded and a clipped cylinder", bench_quadric}},
+        {"scene",
+         {"time to first pixel of a JSON scene and of its compiled form",
+          bench_scene}},
+        {"texture",
+         {"texture load sharing and per sample cost of the filters",
+          bench_texture}},
+        {"sampler",
+         {"image error of the random, stratified, Halton and Sobol samplers "
+          "per sample count",
+          bench_sampler}},
+        {"trace",
+         {"render time and error of recursion depths, contribution pruning "
+          "and Russian roulette on a glass scene",
+          bench_trace}},
+        {"wavefront",
+         {"recursive against breadth first tracing of the camera samples",
+          bench_wavefront}},
+        {"transform",
+         {"per hit cost of the model space transforms", bench_transform}},
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2 || BENCHMARKS.find(argv[1]) == BENCHMARKS.end()) {
+        cout << "Usage: " << argv[0] << " <benchmark> [args]" << endl;
+        for (const auto& b : BENCHMARKS)
+            cout << "  " << std::left << std::setw(12) << b.first
+                 << b.second.first << endl;
+        return -1;
+    }
+    std::vector<string> args(argv + 2, argv + argc);
+    return BENCHMARKS.at(argv[1]).second(args);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Owner of the objects of one scene. Objects are placed one after the other
+ * in large blocks in the order they are made, so the parts of a Collection
+ * parsed in a row sit next to each other, and the whole scene is released
+ * at once by the destructor: one pass over the destructors that have work
+ * to do and a free per block, instead of a delete per object.
+ *
+ * Objects made by the arena must not be deleted and must not outlive it.
+ * Heap memory an object owns itself (mesh arrays, the BVH of a collection)
+ * is freed by its destructor.
+ */
+class SceneArena {
+   public:
+    // objects and bytes made of one type
+    struct TypeStats {
+        long count = 0;
+        size_t bytes = 0;
+    };
+
+   private:
+    struct Destructor {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    const size_t _block_size;
+    std::vector<std::unique_ptr<char[]>> _blocks;
+    char* _next;     // free space of the last block
+    size_t _left;
+    size_t _reserved;
+    std::vector<Destructor> _destructors;
+    std::unordered_map<std::type_index, TypeStats> _stats;
+
+    void* allocate(size_t size, size_t align);
+
+   public:
+    explicit SceneArena(size_t block_size = 64 * 1024);
+    ~SceneArena();
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+
+    // a T made from args, destroyed with the arena
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        void* p = allocate(sizeof(T), alignof(T));
+        T* object = new (p) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            _destructors.push_back(
+                {[](void* o) { static_cast<T*>(o)->~T(); }, object});
+        TypeStats& s = _stats[std::type_index(typeid(T))];
+        s.count++;
+        s.bytes += sizeof(T);
+        return object;
+    }
+
+    // bytes handed out and bytes of the blocks holding them
+    size_t bytesUsed() const;
+    size_t bytesReserved() const { return _reserved; }
+    // objects and bytes of every type made, largest first
+    void printStats(std::ostream& os) const;
+};
+
+// a shared_ptr to an object of an arena that does not own it
+template <typename T>
+std::shared_ptr<T> borrowed(T* object) {
+    return std::shared_ptr<T>(std::shared_ptr<T>(), object);
+}
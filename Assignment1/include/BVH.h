@@ -0,0 +1,247 @@
+#pragma once
+
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <vector>
+#include "DS.h"
+#include "Packet.h"
+#include "defs.h"
+
+// Node of the flattened hierarchy. The left child of an interior node is
+// always the next node in the array, offset points to the right child.
+// For a leaf offset is the first entry in the primitive index list.
+struct BVHNode {
+    AABB bounds;
+    int offset;
+    unsigned short count;  // number of primitives, 0 for interior nodes
+    unsigned char axis;    // split axis of interior nodes
+};
+
+struct BVHBuildStats {
+    int num_primitives = 0;
+    int num_unbounded = 0;  // primitives with infinite bounds (planes, ...)
+    int num_nodes = 0;
+    int num_leaves = 0;
+    int max_depth = 0;
+    double build_ms = 0;
+    float sah_cost = 0;
+};
+
+struct BVHTraversalStats {
+    long rays = 0;
+    long nodes_visited = 0;
+    long primitives_tested = 0;
+    void add(const BVHTraversalStats& o) {
+        rays += o.rays;
+        nodes_visited += o.nodes_visited;
+        primitives_tested += o.primitives_tested;
+    }
+};
+
+/**
+ * Bounding volume hierarchy over an indexed list of primitives. It only
+ * knows the primitive bounds, intersecting a primitive is delegated to the
+ * callback given to the traversal functions so the same structure is used
+ * for the scene model list and for the parts of a Collection.
+ */
+class BVH {
+   private:
+    friend class SceneFile;
+    std::vector<BVHNode> _nodes;
+    std::vector<int> _indices;    // primitive ids in leaf order
+    std::vector<int> _unbounded;  // tested for every ray
+    BVHBuildStats _build_stats;
+
+    int buildRecursive(const std::vector<AABB>& bounds,
+                       std::vector<Vector3f>& centroids, int begin, int end,
+                       int depth, int max_leaf_size);
+
+   public:
+    static const int MAX_DEPTH = 64;
+
+    void build(const std::vector<AABB>& bounds, int max_leaf_size = 4);
+    bool isBuilt() const {
+        return !_nodes.empty() || !_unbounded.empty();
+    }
+    const BVHBuildStats& getBuildStats() const { return _build_stats; }
+    const std::vector<BVHNode>& getNodes() const { return _nodes; }
+    // every primitive id, the unbounded ones and then the leaves from left
+    // to right, roughly the order the traversal tests them
+    std::vector<int> getOrder() const {
+        std::vector<int> order(_unbounded);
+        order.insert(order.end(), _indices.begin(), _indices.end());
+        return order;
+    }
+
+    /**
+     * Finds the closest primitive along the ray
+     * @param{tmax} closest distance found so far, updated on every hit
+     * @param{f} f(prim, tmax) intersects primitive prim and returns the hit
+     * distance if it is smaller than tmax
+     * @return {int} index of the closest primitive, -1 if nothing was hit
+     */
+    template <typename F>
+    int intersect(const Ray& r, float& tmax, F&& f,
+                  BVHTraversalStats* stats = NULL) const;
+
+    /**
+     * Any-hit query, stops at the first primitive for which f(prim, tmax)
+     * returns true
+     */
+    template <typename F>
+    bool occluded(const Ray& r, float tmax, F&& f,
+                  BVHTraversalStats* stats = NULL) const;
+
+    /**
+     * Closest hit for a packet of coherent rays. A node is entered if any
+     * lane overlaps it closer than its tmax.
+     * @param{f} f(prim) intersects the whole packet with primitive prim and
+     * lowers tmax of the lanes it hits
+     */
+    template <typename F>
+    void intersectPacket(const RayPacket& p, const float* tmax, F&& f,
+                         BVHTraversalStats* stats = NULL) const;
+
+    friend std::ostream& operator<<(std::ostream& os, const BVH& bvh);
+};
+
+inline Vector3f reciprocal(const Vector3f& d) {
+    return Vector3f(1.0f / d[0], 1.0f / d[1], 1.0f / d[2]);
+}
+
+template <typename F>
+int BVH::intersect(const Ray& r, float& tmax, F&& f,
+                   BVHTraversalStats* stats) const {
+    int closest = -1;
+    if (stats) stats->rays++;
+    for (int prim : _unbounded) {
+        if (stats) stats->primitives_tested++;
+        auto len = f(prim, tmax);
+        if (len && len.value() < tmax) {
+            tmax = len.value();
+            closest = prim;
+        }
+    }
+    if (_nodes.empty()) return closest;
+
+    const Vector3f inv_dir = reciprocal(r.dir);
+    const bool dir_neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+    int stack[MAX_DEPTH];
+    int top = 0;
+    int node = 0;
+    while (true) {
+        const BVHNode& n = _nodes[node];
+        if (stats) stats->nodes_visited++;
+        if (n.bounds.intersects(r.src, inv_dir, tmax)) {
+            if (n.count > 0) {
+                for (int i = n.offset; i < n.offset + n.count; i++) {
+                    if (stats) stats->primitives_tested++;
+                    auto len = f(_indices[i], tmax);
+                    if (len && len.value() < tmax) {
+                        tmax = len.value();
+                        closest = _indices[i];
+                    }
+                }
+                if (top == 0) break;
+                node = stack[--top];
+            } else if (dir_neg[n.axis]) {
+                // visit the child nearer to the ray source first
+                stack[top++] = node + 1;
+                node = n.offset;
+            } else {
+                stack[top++] = n.offset;
+                node = node + 1;
+            }
+        } else {
+            if (top == 0) break;
+            node = stack[--top];
+        }
+    }
+    return closest;
+}
+
+template <typename F>
+bool BVH::occluded(const Ray& r, float tmax, F&& f,
+                   BVHTraversalStats* stats) const {
+    if (stats) stats->rays++;
+    for (int prim : _unbounded) {
+        if (stats) stats->primitives_tested++;
+        if (f(prim, tmax)) return true;
+    }
+    if (_nodes.empty()) return false;
+
+    const Vector3f inv_dir = reciprocal(r.dir);
+    int stack[MAX_DEPTH];
+    int top = 0;
+    int node = 0;
+    while (true) {
+        const BVHNode& n = _nodes[node];
+        if (stats) stats->nodes_visited++;
+        if (n.bounds.intersects(r.src, inv_dir, tmax)) {
+            if (n.count > 0) {
+                for (int i = n.offset; i < n.offset + n.count; i++) {
+                    if (stats) stats->primitives_tested++;
+                    if (f(_indices[i], tmax)) return true;
+                }
+                if (top == 0) break;
+                node = stack[--top];
+            } else {
+                stack[top++] = n.offset;
+                node = node + 1;
+            }
+        } else {
+            if (top == 0) break;
+            node = stack[--top];
+        }
+    }
+    return false;
+}
+
+template <typename F>
+void BVH::intersectPacket(const RayPacket& p, const float* tmax, F&& f,
+                          BVHTraversalStats* stats) const {
+    if (stats) stats->rays += p.size;
+    for (int prim : _unbounded) {
+        if (stats) stats->primitives_tested += p.size;
+        f(prim);
+    }
+    if (_nodes.empty() || p.size == 0) return;
+
+    alignas(64) float inv_dx[RayPacket::MAX_SIZE];
+    alignas(64) float inv_dy[RayPacket::MAX_SIZE];
+    alignas(64) float inv_dz[RayPacket::MAX_SIZE];
+    for (int lane = 0; lane < RayPacket::MAX_SIZE; lane++) {
+        inv_dx[lane] = 1.0f / p.dx[lane];
+        inv_dy[lane] = 1.0f / p.dy[lane];
+        inv_dz[lane] = 1.0f / p.dz[lane];
+    }
+    // the rays are coherent, order children by the first ray
+    const bool dir_neg[3] = {inv_dx[0] < 0, inv_dy[0] < 0, inv_dz[0] < 0};
+    int stack[MAX_DEPTH];
+    int top = 0;
+    int node = 0;
+    while (true) {
+        const BVHNode& n = _nodes[node];
+        if (stats) stats->nodes_visited++;
+        if (packetIntersectsBox(n.bounds, p, inv_dx, inv_dy, inv_dz, tmax)) {
+            if (n.count > 0) {
+                for (int i = n.offset; i < n.offset + n.count; i++) {
+                    if (stats) stats->primitives_tested += p.size;
+                    f(_indices[i]);
+                }
+                if (top == 0) break;
+                node = stack[--top];
+            } else if (dir_neg[n.axis]) {
+                stack[top++] = node + 1;
+                node = n.offset;
+            } else {
+                stack[top++] = n.offset;
+                node = node + 1;
+            }
+        } else {
+            if (top == 0) break;
+            node = stack[--top];
+        }
+    }
+}
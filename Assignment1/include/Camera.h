@@ -7,6 +7,7 @@
 
 class Camera {
    private:
+    friend class SceneFile;
     const Matrix4f _transformation;
     const float _ar;          // aspect ratio
     const float _fov_degree;  // field of view in degrees
@@ -23,6 +24,10 @@ class Camera {
         _y_correction = _x_correction / _ar;
     }
     std::optional<Ray> getRay(float i, float j) const;
+    // angle between the rays of neighbouring pixels at the image center
+    float getPixelSpread(int image_width) const {
+        return 2 * _x_correction / image_width;
+    }
     friend std::ostream& operator<<(std::ostream& os, const Camera& cam);
     const Matrix4f& getTransformation() const { return _transformation; }
 };
\ No newline at end of file
@@ -1,8 +1,9 @@
 #pragma once
 
 #include <bits/stdc++.h>
+#include <Eigen/LU>
 #include "defs.h"
-#include "CImg.h"
+#include "Material.h"
 
 class Ray {
    public:
@@ -11,11 +12,101 @@ class Ray {
     const float length;
     Ray(const Point& source, const Vector3f& direction)
         : src{source}, dir{direction.normalized()}, length{direction.norm()} {}
+    // for a direction that is already unit length, skips the normalization
+    Ray(const Point& source, const Vector3f& unit_direction, float length)
+        : src{source}, dir{unit_direction}, length{length} {}
     friend std::ostream& operator<<(std::ostream& os, const Ray& r) {
         return (os << "Ray{" << r.src << " -> " << r.dir << "}");
     }
 };
 
+class Model;
+class Instance;
+
+/**
+ * Record of a ray hitting a model, filled in by the intersection query
+ * while the geometry is at hand so that shading never has to find the
+ * point on the surface again. In the space of the query, the world space
+ * functions of Model convert t and the normal.
+ */
+struct Hit {
+    float t = std::numeric_limits<float>::infinity();
+    // part that was hit, its material and transformation shade the point
+    const Model* part = NULL;
+    // instance placing part in the scene, NULL if the part is not in one
+    const Instance* instance = NULL;
+    // unit outward normal, interpolated on smooth meshes
+    Vector3f normal = Vector3f::Zero();
+    // barycentric weights of the second and third vertex on triangles
+    float u = 0, v = 0;
+    // triangle of a mesh, -1 on other models
+    int prim = -1;
+    // the ray arrived from behind the normal, set in world space
+    bool inside = false;
+};
+
+// Axis aligned bounding box, an empty box has min > max
+struct AABB {
+    Vector3f min, max;
+    AABB()
+        : min{Vector3f::Constant(std::numeric_limits<float>::infinity())},
+          max{Vector3f::Constant(-std::numeric_limits<float>::infinity())} {}
+    AABB(const Vector3f& mn, const Vector3f& mx) : min{mn}, max{mx} {}
+    static AABB infinite() {
+        return AABB(
+            Vector3f::Constant(-std::numeric_limits<float>::infinity()),
+            Vector3f::Constant(std::numeric_limits<float>::infinity()));
+    }
+
+    bool isEmpty() const {
+        return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+    }
+    bool isFinite() const {
+        return min.allFinite() && max.allFinite();
+    }
+    void expand(const Vector3f& p) {
+        min = min.cwiseMin(p);
+        max = max.cwiseMax(p);
+    }
+    void expand(const AABB& b) {
+        min = min.cwiseMin(b.min);
+        max = max.cwiseMax(b.max);
+    }
+    Vector3f centroid() const { return 0.5f * (min + max); }
+    // p inside the box grown by eps on every side
+    bool contains(const Point& p, float eps) const {
+        return p[0] >= min[0] - eps && p[0] <= max[0] + eps &&
+               p[1] >= min[1] - eps && p[1] <= max[1] + eps &&
+               p[2] >= min[2] - eps && p[2] <= max[2] + eps;
+    }
+    float surfaceArea() const {
+        if (isEmpty()) return 0;
+        Vector3f d = max - min;
+        return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+    /**
+     * Slab test against a ray given by its source and the reciprocal of its
+     * direction
+     * @return {bool} true if the box overlaps the ray segment [0,tmax]
+     */
+    bool intersects(const Point& src, const Vector3f& inv_dir,
+                    float tmax) const {
+        float t0 = 0, t1 = tmax;
+        for (int a = 0; a < 3; a++) {
+            float tn = (min[a] - src[a]) * inv_dir[a];
+            float tf = (max[a] - src[a]) * inv_dir[a];
+            if (tn > tf) std::swap(tn, tf);
+            t0 = tn > t0 ? tn : t0;
+            t1 = tf < t1 ? tf : t1;
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+    friend std::ostream& operator<<(std::ostream& os, const AABB& b) {
+        return (os << "AABB{" << b.min << " -> " << b.max << "}");
+    }
+};
+
 struct QuadricParams {
     float A, B, C, D, E, F, G, H, I, J;
     QuadricParams(const std::vector<float>& qp) {
@@ -36,40 +127,54 @@ struct QuadricParams {
 struct Transformation{
     Matrix3f T_M_W, T_W_M;
     Vector3f R_M_W, R_W_M;
-    Transformation(const Matrix3f &m, const Vector3f &r): T_M_W(m) , T_W_M(m.inverse()), R_M_W(r), R_W_M(-1*r*T_W_M) {}
+    // normal matrices, the inverse transposes of T_W_M and T_M_W
+    Matrix3f N_W_M, N_M_W;
+    // is_identity: every apply is a no-op
+    // is_rigid: rotation (or reflection), lengths are preserved
+    bool is_identity, is_rigid;
+    Transformation(const Matrix3f &m, const Vector3f &r)
+        : T_M_W(m),
+          T_W_M(m.inverse()),
+          R_M_W(r),
+          R_W_M(-1 * r * T_W_M),
+          N_W_M(T_M_W.transpose()),
+          N_M_W(T_W_M.transpose()),
+          is_identity(m.isIdentity(0) && r.isZero(0)),
+          is_rigid((m * m.transpose()).isIdentity(1e-6)) {}
 };
 
 extern const Transformation IDENTITY_TRANS;
 
-struct Material {
-    Vector3f Ka, Kd, Ks, Krg, Ktg;
-    float refractive_index, specular_coeff;
-    cimg_library::CImg<unsigned char>* img;
-    
-    Material()
-        : Ka{Vector3f::Zero()},
-          Kd{Vector3f::Zero()},
-          Ks{Vector3f::Zero()},
-          Krg{Vector3f::Zero()},
-          Ktg{Vector3f::Zero()},
-          refractive_index{-1},
-          specular_coeff{1} {}
-    Material(const Vector3f& ka, const Vector3f& kd, const Vector3f& ks,
-             const Vector3f& krg, const Vector3f& ktg, float ri, float sc)
-        : Ka{ka},
-          Kd{kd},
-          Ks{ks},
-          Krg{krg},
-          Ktg{ktg},
-          refractive_index{ri},
-          specular_coeff{sc},
-          img{NULL} {}
-    void setTexture(const std::string& path) {
-        using namespace cimg_library;
-        img = new CImg<unsigned char>(path.c_str());
-    }
-    void removeTexture() {
-        delete img;
-        img = NULL;
-    }
-};
\ No newline at end of file
+// Where the positions in a pixel and the random decisions come from, see
+// Sampler
+enum class SamplerType { RANDOM, STRATIFIED, SOBOL, HALTON };
+
+/**
+ * Samples per pixel. Every pixel gets min_samples, pixels whose standard
+ * error of the mean luminance is still above threshold get more, one at a
+ * time, up to max_samples. min_samples == max_samples is plain supersampling.
+ */
+struct SamplingConfig {
+    int min_samples = 5;
+    int max_samples = 5;
+    float threshold = 0.0f;
+    SamplerType sampler = SamplerType::SOBOL;
+    bool isAdaptive() const { return max_samples > min_samples; }
+};
+
+/**
+ * Recursion of the tracer. Every ray carries its throughput, the product of
+ * the Krg or Ktg of the bounces that led to it, and a reflected or
+ * refracted ray whose throughput is at most min_contribution in every
+ * channel is not traced. From roulette_depth on, a hit traces at most one
+ * of the two, chosen with probability proportional to its throughput and
+ * ended with probability 1 - throughput, the result is divided by the
+ * probability of the choice so that the mean is unchanged. Materials can
+ * opt out (Material::roulette), their hits always trace both.
+ */
+struct TraceConfig {
+    int max_depth = 3;
+    float min_contribution = 1e-3f;
+    int roulette_depth = -1;  // -1: off
+    bool hasRoulette() const { return roulette_depth >= 0; }
+};
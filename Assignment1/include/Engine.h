@@ -1,18 +1,63 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
-#include <random>
 #include <vector>
 
+#include "BVH.h"
 #include "Camera.h"
 #include "DS.h"
+#include "FlatScene.h"
 #include "Image.h"
 #include "Models.h"
+#include "SampleBuffer.h"
+#include "Sampler.h"
+#include "Scheduler.h"
 #include "defs.h"
 #include "utils.h"
 
 using namespace std;
 
+// Closest model along a ray and the record of the hit on it, in world space
+struct SceneHit {
+    const Model* model;
+    Hit hit;
+};
+
+// The camera sample a ray belongs to and the branches that led to it: path
+// starts at 1 and gets a bit per bounce, 0 reflected, 1 refracted
+struct PathSample {
+    SampleStream stream;
+    uint32_t index;
+    uint32_t path;
+};
+
+/**
+ * Progressive render: passes of samples accumulated into a float buffer,
+ * see RenderEngine::renderProgressive
+ */
+struct ProgressiveConfig {
+    int passes = 1;
+    std::string checkpoint_path;    // empty: no checkpoints
+    std::string image_path;         // preview written with every checkpoint
+    int checkpoint_passes = 0;      // checkpoint every N passes, 0: off
+    double checkpoint_seconds = 0;  // or after this much time, 0: off
+    bool resume = false;            // continue from checkpoint_path
+};
+
+// Segments of a traced path (camera and bounce rays, shadow rays) for the
+// OpenGL ray visualizer
+struct TraceRecorder {
+    std::vector<pair<Vector3f, Vector3f>> segments;
+    void add(const Vector3f& from, const Vector3f& to) {
+        segments.push_back({from, to});
+    }
+};
+
+// Recorder of the render path, keeps nothing
+struct NullRecorder {
+    void add(const Vector3f&, const Vector3f&) {}
+};
+
 class RenderEngine {
    private:
     const Camera& _cam;
@@ -20,27 +65,159 @@ class RenderEngine {
     Image& _img;
     std::vector<const Model*> _models;
     std::vector<const Light*> _lights;
+    BVH _bvh;  // over _models
+    FlatScene _flat;  // _models for the scalar intersection queries
     const Color _ambient;
-    // const int max_trace_depth = 4;
-    const int max_trace_depth = 3;
-    // const int max_trace_depth = 1;
-    // const int num_sample = 5;
-    const int num_sample = 5;
+    float _pixel_spread;  // radians per pixel, sizes texture footprints
+    SamplingConfig _sampling;
+    TraceConfig _tracing;
+    ToneMapping _tone_mapping;
+
+    int _num_threads;
+    int _tile_size;
+    int _packet_size;  // primary rays per packet, 1 traces them one by one
+    bool _wavefront;   // camera samples through traceWavefront
+    unsigned int _seed;
+    std::unique_ptr<Sampler> _sampler;  // of _sampling and _seed
+    std::unique_ptr<ThreadPool> _pool;
+    int _tiles_x;
+    std::vector<TileStat> _tile_stats;
+    std::vector<BVHTraversalStats> _tile_traversal_stats;
+    std::vector<Tile> _tiles;
+    SampleBuffer _accum;
+    int _passes;  // passes in _accum
+
+    void buildBVH();
+    // _sampler for the current sampling and seed
+    void makeSampler();
+    // tiles, statistics and thread pool for a new render
+    void beginRender();
+    // one pass over all tiles, adds its samples to _accum
+    void renderPass(int pass);
+    // _accum to _img
+    void resolve();
+    // probabilities of tracing the reflected and the refracted ray of a hit
+    // on mat, 0 for a ray that is pruned or ended (TraceConfig). Roulette
+    // draws are taken from _sampler for the path of the hit
+    void branchProbabilities(const Material& mat, int depth,
+                             const Color& reflected_throughput,
+                             bool refractive,
+                             const Color& refracted_throughput,
+                             const PathSample& sample, float& p_reflected,
+                             float& p_refracted) const;
+    /**
+     * Breadth first tracing of camera rays, colors[i] is the color of
+     * primary[i] taken for samples[i]. The rays of one depth are traced as a queue: sorted by
+     * direction octant and origin, intersected in packets, their shadow
+     * rays tested a light at a time, and the hits shaded grouped by
+     * material, queueing the reflected and refracted rays of the next
+     * depth. Colors match trace() up to rounding, the sums are formed in
+     * another order.
+     */
+    void traceWavefront(const std::vector<Ray>& primary,
+                        const std::vector<PathSample>& samples,
+                        std::vector<Color>& colors);
+    template <typename Recorder>
+    Color traceRecorded(const Ray& r, float refractive_index, int depth,
+                        const Color& throughput, const PathSample& sample,
+                        Recorder& rec);
+    template <typename Recorder>
+    Color shadeRecorded(const Ray& r, float refractive_index, int depth,
+                        const Color& throughput,
+                        const std::optional<SceneHit>& hit,
+                        const PathSample& sample, Recorder& rec);
 
    public:
+    // bvh: hierarchy over models built earlier (State::bvh), NULL builds it
     RenderEngine(const Camera& cam, Image& img, const Background& background,
                  const std::vector<Model*>& models,
-                 const std::vector<Light*>& lights, const Color ambient)
+                 const std::vector<Light*>& lights, const Color ambient,
+                 const BVH* bvh = NULL)
         : _cam{cam},
           _background{background},
           _img{img},
           _models{models.begin(), models.end()},
           _lights{lights.begin(), lights.end()},
-          _ambient{ambient} {}
+          _ambient{ambient},
+          _pixel_spread{cam.getPixelSpread(img.width)},
+          _num_threads{std::max(1, (int)std::thread::hardware_concurrency())},
+          _tile_size{16},
+          _packet_size{16},
+          _wavefront{false},
+          _seed{0},
+          _tiles_x{0},
+          _passes{0} {
+        if (bvh) {
+            _bvh = *bvh;
+            _flat = FlatScene(_models, _bvh.getOrder());
+        } else {
+            buildBVH();
+        }
+        makeSampler();
+    }
+
+    void setNumThreads(int num_threads) { _num_threads = std::max(1, num_threads); }
+    void setTileSize(int tile_size) { _tile_size = std::max(1, tile_size); }
+    // Image is byte identical across runs, thread counts and tile sizes for
+    // a seed, 0 unless set
+    void setSeed(unsigned int seed) {
+        _seed = seed;
+        makeSampler();
+    }
+    // 1, 4, 8 or 16
+    void setPacketSize(int packet_size) {
+        _packet_size = std::min(RayPacket::MAX_SIZE, std::max(1, packet_size));
+    }
+
+    // the camera samples of a tile are traced breadth first, see
+    // traceWavefront. Extra adaptive samples are traced recursively
+    void setWavefront(bool wavefront) { _wavefront = wavefront; }
+
+    void setSampling(const SamplingConfig& sampling) {
+        _sampling = sampling;
+        makeSampler();
+    }
+    void setTracing(const TraceConfig& tracing) { _tracing = tracing; }
+    // used by writeImage for 8-bit formats
+    void setToneMapping(const ToneMapping& tm) { _tone_mapping = tm; }
 
     void addModel(const Model* model);
-    pair<Color,std::vector<pair<Vector3f,Vector3f>>> trace(Ray r, float refractive_index, int depth);
+    std::optional<SceneHit> intersect(const Ray& r) const;
+    // closest hit of every lane, used for coherent primary rays
+    void intersect(const RayPacket& p, PacketHits& hits) const;
+    // Render path, does not allocate once the per thread scratch buffers
+    // have grown to the scene's light count. throughput: weight of the ray
+    // in the pixel, prunes the recursion (TraceConfig). sample: the camera
+    // sample and path of r, the roulette draws are taken for it
+    Color trace(const Ray& r, float refractive_index, int depth,
+                const PathSample& sample,
+                const Color& throughput = Color::Ones());
+    // shading of a ray whose closest hit is already known
+    Color shade(const Ray& r, float refractive_index, int depth, const std::optional<SceneHit>& hit,
+                const PathSample& sample,
+                const Color& throughput = Color::Ones());
+    // Color of pixel (i,j) through its center along with every segment
+    // traced for it
     pair<Color,std::vector<pair<Vector3f,Vector3f>>> getTrace(int i, int j);
     void render();
+    /**
+     * Renders cfg.passes passes. Every pass takes the configured samples per
+     * pixel, pass p the samples after those of the passes before it in the
+     * sequence of the sampler, so an interrupted and resumed render
+     * produces the same image as an uninterrupted one. A checkpoint writes
+     * the float accumulation buffer to cfg.checkpoint_path, and the image so
+     * far to cfg.image_path. The last pass always writes one.
+     * @return {int} passes rendered by this call
+     */
+    int renderProgressive(const ProgressiveConfig& cfg);
+    const std::vector<TileStat>& getTileStats() const { return _tile_stats; }
+    void printTileStats(std::ostream& os) const;
+    // build statistics and the traversal counters of the last render
+    void printBVHStats(std::ostream& os) const;
+    // samples spent by the last render
+    long getTotalSamples() const;
+    void printSamplingStats(std::ostream& os) const;
+    // .pfm paths get the linear float image, everything else a tone mapped
+    // PPM. Throws std::runtime_error if path can not be written
     void writeImage(const std::string& path);
 };
\ No newline at end of file
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "DS.h"
+#include "Models.h"
+#include "Packet.h"
+#include "defs.h"
+
+/**
+ * The scene models for the hot loop of the scalar tracer, in contiguous
+ * arrays per primitive type. Spheres, triangles, planes and quadrics are
+ * baked into world space as plain structs and tested inline after a switch
+ * on their type, without a virtual call or a ray transformation. The other
+ * models (collections, meshes, boxes, polygons, instances, spheres scaled
+ * into ellipsoids and clipped quadrics that are not axis aligned in the
+ * world) stay behind their Model.
+ *
+ * The Model hierarchy remains the authoring API and the source of
+ * materials and textures: every hit reports the Model it belongs to as its
+ * part. Primitive ids are the indices of the model list, so the scene BVH
+ * is shared with the Model path.
+ */
+class FlatScene {
+   public:
+    enum Type : uint8_t { SPHERE, TRIANGLE, PLANE, QUADRIC, MODEL, NUM_TYPES };
+
+    FlatScene() = default;
+    // order lists every id of models once, the arrays are laid out in it
+    // so that primitives tested together are close in memory
+    FlatScene(const std::vector<const Model*>& models,
+              const std::vector<int>& order);
+
+    // the hit on primitive prim if it is closer than tmax, a NaN distance
+    // (from a NaN ray) is no hit as in the BVH
+    bool intersect(int prim, const Ray& r, float tmax, Hit& hit) const;
+    bool occluded(int prim, const Ray& r, float tmax) const;
+    // primitives stored as type
+    int count(Type type) const;
+
+   private:
+    struct Ref {
+        Type type;
+        uint32_t index;  // in the array of type
+    };
+    struct SpherePrim {
+        Point center;
+        float radius_sq, inv_radius;
+        const Model* model;
+    };
+    // Moller-Trumbore data of Triangle
+    struct TrianglePrim {
+        Point p1;
+        Vector3f e1, e2, normal;
+        float det_eps;
+        const Model* model;
+    };
+    struct PlanePrim {
+        Point src;
+        Vector3f normal;
+        const Model* model;
+    };
+    struct QuadricPrim {
+        float q[10];  // A..J as in QuadricParams
+        AABB clip;
+        const Model* model;
+    };
+
+    std::vector<Ref> _refs;  // by primitive id
+    std::vector<SpherePrim> _spheres;
+    std::vector<TrianglePrim> _triangles;
+    std::vector<PlanePrim> _planes;
+    std::vector<QuadricPrim> _quadrics;
+    std::vector<const Model*> _models;
+
+    // stores m in the array of its type
+    Ref add(const Model* m);
+    static std::optional<float> distance(const SpherePrim& s, const Ray& r);
+    static std::optional<TriangleHit> distance(const TrianglePrim& tri,
+                                               const Ray& r);
+    static std::optional<float> distance(const PlanePrim& p, const Ray& r);
+};
+
+inline std::optional<float> FlatScene::distance(const SpherePrim& s,
+                                                const Ray& r) {
+    const Vector3f src_center = s.center - r.src;
+    const float src_center_sq = src_center.squaredNorm();
+    const float proj = src_center.dot(r.dir);
+    if (src_center_sq > s.radius_sq && proj <= 0) return {};
+    const float center_ray_sq = src_center_sq - proj * proj;
+    if (center_ray_sq > s.radius_sq) return {};
+    const float d = std::sqrt(s.radius_sq - center_ray_sq);
+    // the far root from inside
+    return (proj - d < 0) ? proj + d : proj - d;
+}
+
+inline std::optional<TriangleHit> FlatScene::distance(const TrianglePrim& tri,
+                                                      const Ray& r) {
+    const Vector3f pvec = r.dir.cross(tri.e2);
+    const float det = tri.e1.dot(pvec);
+    if (std::fabs(det) <= tri.det_eps) return {};
+    const float inv_det = 1.0f / det;
+    const Vector3f tvec = r.src - tri.p1;
+    const float u = tvec.dot(pvec) * inv_det;
+    if (u < 0 || u > 1) return {};
+    const Vector3f qvec = tvec.cross(tri.e1);
+    const float v = r.dir.dot(qvec) * inv_det;
+    if (v < 0 || u + v > 1) return {};
+    const float t = tri.e2.dot(qvec) * inv_det;
+    if (t < 0) return {};
+    return TriangleHit{t, u, v};
+}
+
+inline std::optional<float> FlatScene::distance(const PlanePrim& p,
+                                                const Ray& r) {
+    const float cos_theta = r.dir.dot(p.normal);
+    if (std::fabs(cos_theta) <= EPSILON) return {};
+    const float t = (p.src - r.src).dot(p.normal) / cos_theta;
+    if (t < 0) return {};
+    return t;
+}
+
+inline bool FlatScene::intersect(int prim, const Ray& r, float tmax,
+                                 Hit& hit) const {
+    const Ref ref = _refs[prim];
+    switch (ref.type) {
+        case SPHERE: {
+            const SpherePrim& s = _spheres[ref.index];
+            auto t = distance(s, r);
+            if (!t || !(t.value() < tmax)) return false;
+            hit = Hit();
+            hit.t = t.value();
+            hit.part = s.model;
+            hit.normal = (r.src + hit.t * r.dir - s.center) * s.inv_radius;
+            break;
+        }
+        case TRIANGLE: {
+            const TrianglePrim& tri = _triangles[ref.index];
+            auto t = distance(tri, r);
+            if (!t || !(t.value().t < tmax)) return false;
+            hit = Hit();
+            hit.t = t.value().t;
+            hit.part = tri.model;
+            hit.normal = tri.normal;
+            hit.u = t.value().u;
+            hit.v = t.value().v;
+            break;
+        }
+        case PLANE: {
+            const PlanePrim& p = _planes[ref.index];
+            auto t = distance(p, r);
+            if (!t || !(t.value() < tmax)) return false;
+            hit = Hit();
+            hit.t = t.value();
+            hit.part = p.model;
+            hit.normal = p.normal;
+            break;
+        }
+        case QUADRIC: {
+            const QuadricPrim& q = _quadrics[ref.index];
+            auto t = quadricDistance(r, q.q, q.clip);
+            if (!t || !(t.value() < tmax)) return false;
+            const Point x = r.src + t.value() * r.dir;
+            hit = Hit();
+            hit.t = t.value();
+            hit.part = q.model;
+            // gradient of the quadric
+            hit.normal = Vector3f(q.q[0] * x[0] + q.q[1] * x[1] + q.q[2] * x[2] + q.q[3],
+                                  q.q[1] * x[0] + q.q[4] * x[1] + q.q[5] * x[2] + q.q[6],
+                                  q.q[2] * x[0] + q.q[5] * x[1] + q.q[7] * x[2] + q.q[8])
+                             .normalized();
+            break;
+        }
+        default: {
+            auto h = _models[ref.index]->intersect(r);
+            if (!h || !(h.value().t < tmax)) return false;
+            hit = h.value();
+            return true;
+        }
+    }
+    hit.inside = hit.normal.dot(r.dir) > 0;
+    return true;
+}
+
+inline bool FlatScene::occluded(int prim, const Ray& r, float tmax) const {
+    const Ref ref = _refs[prim];
+    switch (ref.type) {
+        case SPHERE: {
+            auto t = distance(_spheres[ref.index], r);
+            return t && t.value() < tmax;
+        }
+        case TRIANGLE: {
+            auto t = distance(_triangles[ref.index], r);
+            return t && t.value().t < tmax;
+        }
+        case PLANE: {
+            auto t = distance(_planes[ref.index], r);
+            return t && t.value() < tmax;
+        }
+        case QUADRIC: {
+            const QuadricPrim& q = _quadrics[ref.index];
+            auto t = quadricDistance(r, q.q, q.clip);
+            return t && t.value() < tmax;
+        }
+        default:
+            return _models[ref.index]->occluded(r, tmax);
+    }
+}
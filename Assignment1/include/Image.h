@@ -5,6 +5,20 @@
 #include <vector>
 #include "defs.h"
 
+// Operator applied before gamma when an image is quantized to 8 bits
+enum class ToneMap { CLAMP, REINHARD };
+
+/**
+ * Linear float to display bytes: scale by exposure, compress with op,
+ * encode with 1/gamma and quantize. The defaults reproduce the plain
+ * clamp of the original PPM writer.
+ */
+struct ToneMapping {
+    ToneMap op = ToneMap::CLAMP;
+    float exposure = 1.0f;
+    float gamma = 1.0f;
+};
+
 class Image {
    private:
     int _width, _height;
@@ -33,5 +47,12 @@ class Image {
     std::optional<Color> get(int image_i, int image_j) const;
     bool set(int image_i, int image_j, Color c);
     friend std::ostream& operator<<(std::ostream& os, const Image& img);
-    std::ostream& write(std::ostream& os) const;
+    const Color* data() const { return _image.data(); }
+
+    // 8-bit RGB, row by row from the top, into rgb (resized to 3*w*h)
+    void toneMap(const ToneMapping& tm, std::vector<unsigned char>& rgb) const;
+    // binary PPM (P6) of the tone mapped image in a single write
+    std::ostream& write(std::ostream& os, const ToneMapping& tm = ToneMapping()) const;
+    // PFM in host byte order of the linear colors, HDR values are kept
+    std::ostream& writePFM(std::ostream& os) const;
 };
\ No newline at end of file
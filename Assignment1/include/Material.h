@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Texture.h"
+#include "defs.h"
+
+struct Material {
+    Vector3f Ka, Kd, Ks, Krg, Ktg;
+    float refractive_index, specular_coeff;
+    TextureHandle texture;  // into texture_cache(), NO_TEXTURE if untextured
+    TextureSampler sampler;
+    // rays leaving it may be ended by Russian roulette, see TraceConfig
+    bool roulette;
+
+    Material()
+        : Ka{Vector3f::Zero()},
+          Kd{Vector3f::Zero()},
+          Ks{Vector3f::Zero()},
+          Krg{Vector3f::Zero()},
+          Ktg{Vector3f::Zero()},
+          refractive_index{-1},
+          specular_coeff{1},
+          texture{NO_TEXTURE},
+          roulette{true} {}
+    Material(const Vector3f& ka, const Vector3f& kd, const Vector3f& ks,
+             const Vector3f& krg, const Vector3f& ktg, float ri, float sc)
+        : Ka{ka},
+          Kd{kd},
+          Ks{ks},
+          Krg{krg},
+          Ktg{ktg},
+          refractive_index{ri},
+          specular_coeff{sc},
+          texture{NO_TEXTURE},
+          roulette{true} {}
+    // images are shared, loading a file a second time returns its handle
+    void setTexture(const std::string& path) {
+        texture = texture_cache().load(path);
+    }
+    void removeTexture() { texture = NO_TEXTURE; }
+    bool hasTexture() const { return texture != NO_TEXTURE; }
+    /**
+     * @param{footprint} size of the filtered region in uv units
+     */
+    Color sampleTexture(float u, float v, float footprint) const {
+        return texture_cache().get(texture).sample(u, v, footprint, sampler);
+    }
+    bool operator==(const Material& o) const;
+};
+
+// index of a material in the MaterialTable
+using MaterialId = uint16_t;
+
+/**
+ * Every distinct material of the process, stored once. Primitives keep a
+ * MaterialId and shading looks the material up here, so a mesh with
+ * thousands of triangles holds one copy of its material instead of one
+ * per triangle. Like the texture cache it is filled while the scene is
+ * parsed and read only while rendering.
+ */
+class MaterialTable {
+   private:
+    std::mutex _mutex;
+    std::vector<Material> _materials;
+    std::unordered_map<size_t, std::vector<MaterialId>> _by_hash;
+
+   public:
+    static const int MAX_MATERIALS = 1 << 16;
+
+    // id of an equal material if one exists, otherwise adds m. Throws
+    // std::runtime_error when the table is full
+    MaterialId intern(const Material& m);
+    const Material& operator[](MaterialId id) const { return _materials[id]; }
+    int size() const { return _materials.size(); }
+    void clear();
+};
+
+MaterialTable& material_table();
+
+/**
+ * Held by every State. When the last holder goes the material table and
+ * the texture cache are cleared, so loading scene after scene does not fill
+ * them up. Ids interned outside of a State stay valid while one is alive.
+ */
+std::shared_ptr<void> hold_scene_tables();
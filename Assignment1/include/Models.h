@@ -4,22 +4,36 @@
 #include <cassert>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include "Arena.h"
+#include "BVH.h"
 #include "Camera.h"
 #include "DS.h"
 #include "defs.h"
 #include "OGLModels.h"
+#include "Packet.h"
 
 class Model {
    public:
-    std::optional<float> _getRefractiveIndex(Vector3f incident,
-                                             Vector3f normal) const;
-    // This function return the intersection length and a pointer to the base
-    // part for getting normal efficiently
-    virtual std::optional<std::pair<float, const Model*>>
-    _getIntersectionLengthAndPart(const Ray&) const = 0;
-    virtual std::optional<Ray> _getNormal(const Point&) const = 0;
-    virtual bool _isOnSurface(const Point&) const = 0;
+    // Closest hit in model space with everything shading needs, inside is
+    // left to intersect
+    virtual std::optional<Hit> _intersect(const Ray&) const = 0;
+    // Bounds in model space, AABB::infinite() for unbounded models
+    virtual AABB _getBounds() const = 0;
+    // Any-hit query in model space, true if the model is hit closer than tmax.
+    // Defaults to the closest hit query, primitives override it to stop early.
+    virtual bool _occluded(const Ray& r, float tmax) const;
+    /**
+     * Packet query in model space
+     * @param{t} distance bound of every lane, lowered where the model is
+     * hit closer
+     * @param{hits} receives the hit of the lanes whose t was lowered, the
+     * others are left alone so that only closer hits pay for the record
+     * The default intersects the lanes one at a time.
+     */
+    virtual void _intersectPacket(const RayPacket& p, float* t,
+                                  Hit* hits) const;
 
     /**
      * @param{normal} Normal ray with source at the point of contact
@@ -48,6 +62,8 @@ class Model {
      * @param{ambient} ambient intensity in the room
      * @param{reflected} reflected intensity at the point of color
      * @param{refracted} refracted intensity at the point of color
+     * Unlike the other _ functions it works in world space, all directions
+     * are unit length
      */
     virtual Color _getIntensity(
         const Vector3f& normal, const Vector3f& view,
@@ -56,24 +72,34 @@ class Model {
         const Color* refracted, std::optional<Color> texture) const;
     
     /**
-     * @param{intensity} Intensity of illumination at the point of interest
      * @param{p} point of interest for which texture value is required
+     * @param{hit} hit at p, triangles read their barycentrics from it
+     * @param{footprint} model space width of the pixel at p, selects the
+     * mip level of trilinear filtering
      */
-    virtual std::optional<Color> _getTexture(const Point& p) const;
+    virtual std::optional<Color> _getTexture(const Point& p, const Hit& hit,
+                                             float footprint) const;
 
-    const Material mat;
+    const MaterialId mat_id;  // into material_table()
     Transformation trans;
 
-    Model(const Material& mat, const Transformation& trans)
-        : mat{mat}, trans(trans) {}
+    Model(MaterialId mat_id, const Transformation& trans)
+        : mat_id{mat_id}, trans(trans) {}
+    const Material& getMaterial() const { return material_table()[mat_id]; }
     virtual ~Model() = default;
 
-    std::optional<float> getRefractiveIndex(Vector3f incident,
-                                            Vector3f normal) const;
-    std::optional<std::pair<float, const Model*>> getIntersectionLengthAndPart(
-        const Ray&) const;
-    std::optional<Ray> getNormal(const Point&) const;
-    bool isOnSurface(const Point&) const;
+    // index on the far side of the surface at hit, 1 (the outside world)
+    // when leaving the model, nothing if the material is opaque
+    std::optional<float> getRefractiveIndex(const Hit& hit) const;
+    // Closest hit in world space
+    std::optional<Hit> intersect(const Ray&) const;
+    // Occlusion test for shadow rays, tmax is a world space distance
+    bool occluded(const Ray& r, float tmax) const;
+    // Updates the lanes of hits that hit this model closer than their
+    // current world space distance
+    void intersectPacket(const RayPacket& p, PacketHits& hits) const;
+    // Bounds in world space
+    AABB getBounds() const;
 
     Ray getReflected(const Ray& incident, const Ray& normal) const;
     Ray getRefracted(const Ray& incident, const Ray& normal,
@@ -83,7 +109,9 @@ class Model {
                        const std::vector<std::pair<Color, Vector3f>>& lights,
                        const Color* ambient, const Color* reflected,
                        const Color* refracted, std::optional<Color> texture) const;
-    std::optional<Color> getTexture(const Point& p) const;
+    // footprint: world space width of the pixel at p, 0 for the finest level
+    std::optional<Color> getTexture(const Point& p, const Hit& hit,
+                                    float footprint = 0) const;
 
     virtual std::ostream& print(std::ostream& os) const = 0;
     friend std::ostream& operator<<(std::ostream& os, const Model& m) {
@@ -109,123 +137,212 @@ class Light {
 
 class Sphere : public Model {
    private:
+    friend class SceneFile;
+    friend class FlatScene;
     const Point _center;
     const float _radius;
     const float _radius_sq;
 
+    // hit at point p, t along the ray
+    Hit hitAt(const Point& p, float t) const;
+
    public:
-    std::optional<std::pair<float, const Model*>> _getIntersectionLengthAndPart(
-        const Ray& r) const;
-    bool _isOnSurface(const Point& p) const;
-    // returns outward normal
-    std::optional<Ray> _getNormal(const Point& p) const;
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
+    void _intersectPacket(const RayPacket& p, float* t,
+                          Hit* hits) const;
 
-    Sphere(Point center, float radius, Material mat, Transformation t)
+    Sphere(Point center, float radius, MaterialId mat, Transformation t)
         : Model{mat, t},
           _center{center},
           _radius{radius},
           _radius_sq{_radius * _radius} {}
     Sphere(const Sphere& s)
-        : Model{s.mat, s.trans},
+        : Model{s.mat_id, s.trans},
           _center{s._center},
           _radius{s._radius},
           _radius_sq{s._radius_sq} {}
     Sphere& operator=(const Sphere& s) = delete;
     std::ostream& print(std::ostream& os) const;
 
-    std::optional<Color> _getTexture(const Point& p) const override;
+    std::optional<Color> _getTexture(const Point& p, const Hit& hit,
+                                     float footprint) const override;
 };
 
 class Plane : public Model {
    private:
+    friend class SceneFile;
+    friend class FlatScene;
     const Ray _normal;
 
    public:
-    std::optional<std::pair<float, const Model*>> _getIntersectionLengthAndPart(
-        const Ray& r) const;
-    bool _isOnSurface(const Point& p) const;
-    std::optional<Ray> _getNormal(const Point& p) const;
+    std::optional<Hit> _intersect(const Ray& r) const;
+    // p is within EPSILON of the plane
+    bool contains(const Point& p) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
 
-    Plane(const Ray& normal, Material mat, Transformation t)
+    Plane(const Ray& normal, MaterialId mat, Transformation t)
         : Model{mat, t}, _normal{normal} {}
+    // unit normal, the same everywhere on the plane
+    const Vector3f& getNormal() const { return _normal.dir; }
     std::ostream& print(std::ostream& os) const;
 };
 
+// Barycentric hit on a triangle, u and v are the weights of p2 and p3
+struct TriangleHit {
+    float t;
+    float u;
+    float v;
+};
+
 class Triangle : public Model {
    private:
+    friend class SceneFile;
+    friend class FlatScene;
     const Point _p1;
     const Point _p2;
     const Point _p3;
-    const Plane _plane;
-    const float _area;
-    static float getArea(Point a, Point b, Point c) {
-        return fabs((a - b).cross(a - c).norm() / 2);
-    }
+    // edges from p1 and unit normal along e1 x e2, fixed at construction
+    const Vector3f _e1;
+    const Vector3f _e2;
+    const Vector3f _normal;
+    const float _det_eps;
+
+    // Moller-Trumbore intersection in model space
+    std::optional<TriangleHit> intersectTriangle(const Ray& r) const;
 
    public:
-    bool _isOnSurface(const Point& p) const;
-    std::optional<std::pair<float, const Model*>> _getIntersectionLengthAndPart(
-        const Ray& r) const;
-    std::optional<Ray> _getNormal(const Point& p) const;
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
+    void _intersectPacket(const RayPacket& p, float* t,
+                          Hit* hits) const;
 
     Triangle(const Point& p1, const Point& p2, const Point& p3,
-             const Material& mat, const Transformation& t)
-        : Model{mat, t},
-          _p1{p1},
-          _p2{p2},
-          _p3{p3},
-          _plane{Ray(_p1, ((_p1 - _p2).cross(_p1 - _p3))), mat, t},
-          _area{getArea(_p1, _p2, _p3)} {}
+             MaterialId mat, const Transformation& t);
     std::ostream& print(std::ostream& os) const;
-    std::optional<Color> _getTexture(const Point& p) const override;
+    std::optional<Color> _getTexture(const Point& p, const Hit& hit,
+                                     float footprint) const override;
 };
 
 class Collection : public Model {
-    // TODO: CHANGE TO UNIQUE_PTR
    private:
+    friend class SceneFile;
+    // owned by the scene arena (or the model holding the collection)
     std::vector<const Model*> _parts;
-    std::optional<const Model*> getWhichPart(const Point& p) const;
+    BVH _bvh;
+    bool _bvh_dirty;
 
    public:
-    std::optional<std::pair<float, const Model*>> _getIntersectionLengthAndPart(
-        const Ray& r) const;
-    bool _isOnSurface(const Point& p) const;
-    std::optional<Ray> _getNormal(const Point& p) const;
+    // the part in the hit is the direct child of the collection
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
 
-    Collection(Material mat, Transformation t) : Model{mat, t} {}
+    Collection(MaterialId mat, Transformation t)
+        : Model{mat, t}, _bvh_dirty{false} {}
 
     void addModel(Model* part) { 
         part->trans = this->trans;
         _parts.push_back(part); 
+        _bvh_dirty = true;
     }
+    // Builds the hierarchy over the parts, call after the last addModel.
+    // Until then intersections fall back to testing every part.
+    void buildBVH();
+    const BVH& getBVH() const { return _bvh; }
 
     std::ostream& print(std::ostream& os) const;
 };
 
+/**
+ * Indexed triangles with per vertex attributes in separate arrays. A vertex
+ * is one combination of position, normal and uv index of the source file.
+ */
+struct MeshData {
+    std::vector<float> px, py, pz;
+    std::vector<float> nx, ny, nz;  // empty if the file has no normals
+    std::vector<float> u, v;        // empty if the file has no uvs
+    std::vector<int> indices;       // 3 vertices per triangle
+    int numVertices() const { return px.size(); }
+    int numTriangles() const { return indices.size() / 3; }
+};
+
+class TriangleMesh : public Model {
+   private:
+    friend class SceneFile;
+    MeshData _data;
+    BVH _bvh;  // over the triangles
+    AABB _bounds;
+
+    Vector3f position(int vertex) const {
+        return Vector3f(_data.px[vertex], _data.py[vertex], _data.pz[vertex]);
+    }
+    // Moller-Trumbore against triangle tri, same rules as Triangle
+    std::optional<TriangleHit> intersectTriangle(int tri, const Ray& r) const;
+    // data and hierarchy of a mesh built earlier, read from a compiled scene
+    TriangleMesh(MeshData data, BVH bvh, MaterialId mat,
+                 const Transformation& t);
+
+   public:
+    // the normal is the interpolated vertex normal if the mesh has normals,
+    // else the face normal
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
+    std::optional<Color> _getTexture(const Point& p, const Hit& hit,
+                                     float footprint) const override;
+
+    // smooth: interpolate vertex normals, computed from the faces when the
+    // data has none. Otherwise normals are dropped and faces shade flat
+    TriangleMesh(MeshData data, bool smooth, MaterialId mat,
+                 const Transformation& t);
+    const MeshData& getData() const { return _data; }
+    const BVH& getBVH() const { return _bvh; }
+    std::ostream& print(std::ostream& os) const;
+};
+
+/**
+ * Surface Ax^2 + 2Bxy + 2Cxz + 2Dx + Ey^2 + 2Fyz + 2Gy + Hz^2 + 2Iz + J = 0,
+ * optionally clipped to an axis aligned box: only the part of the surface
+ * inside clip exists, which gives cylinders and cones a finite extent and
+ * bounds for the BVH. Unclipped quadrics are unbounded.
+ */
 class Quadric : public Model {
    private:
-    const QuadricParams _qp;
-    Matrix4f M;
+    friend class SceneFile;
+    friend class FlatScene;
+    // A..J of QuadricParams, the order the packet kernel takes them in
+    float _q[10];
+    AABB _clip;
+
+    // hit at point p, t along the ray, the normal is the gradient
+    Hit hitAt(const Point& p, float t) const;
+    // the symmetric matrix Q of the surface p Q p^T = 0, p homogeneous
+    Matrix4f matrix() const;
 
    public:
-    std::optional<std::pair<float, const Model*>> _getIntersectionLengthAndPart(
-        const Ray& r) const;
-    bool _isOnSurface(const Point& p) const;
-    std::optional<Ray> _getNormal(const Point& p) const;
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
+    void _intersectPacket(const RayPacket& p, float* t,
+                          Hit* hits) const;
 
     using Model::Model;
-    Quadric(const QuadricParams& qp, const Material& mp,
-            const Transformation& t)
-        : _qp(qp), Model(mp, t) {
-        M << qp.A, qp.B, qp.C, qp.D, qp.B, qp.E, qp.F, qp.G, qp.C, qp.F, qp.H,
-            qp.I, qp.D, qp.G, qp.I, qp.J;
-    }
+    Quadric(const QuadricParams& qp, MaterialId mp, const Transformation& t,
+            const AABB& clip = AABB::infinite())
+        : Model(mp, t),
+          _q{qp.A, qp.B, qp.C, qp.D, qp.E, qp.F, qp.G, qp.H, qp.I, qp.J},
+          _clip{clip} {}
 
     std::ostream& print(std::ostream& os) const;
 };
 
 class Box : public Model {
    private:
+    friend class SceneFile;
     const Point _center;
     const float _l;
     const float _b;
@@ -234,52 +351,112 @@ class Box : public Model {
     const Vector3f _az;
     const Vector3f _ay;
     Collection _coll;
+    // the parts of _coll, next to each other
+    std::vector<Triangle> _faces;
 
    public:
-    std::optional<std::pair<float, const Model*>> _getIntersectionLengthAndPart(
-        const Ray& r) const;
-    bool _isOnSurface(const Point& p) const;
-    std::optional<Ray> _getNormal(const Point& p) const;
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
 
     Box(const Point& center, const Vector3f& x, const Vector3f& y, float l,
-        float b, float h, const Material& mat, const Transformation& t);
+        float b, float h, MaterialId mat, const Transformation& t);
+    // _coll points into _faces
+    Box(const Box&) = delete;
     std::ostream& print(std::ostream& os) const;
 };
 
 
+/**
+ * Planar polygon. At construction the corners are projected to the
+ * coordinate plane the polygon is least tilted against (the largest
+ * component of the normal is dropped), so a hit is a ray plane
+ * intersection followed by a 2D crossing test over the precomputed edges,
+ * without divisions or normalization.
+ */
 class Polygon : public Model {
    private:
+    friend class SceneFile;
+    // the corners, the last one repeats the first
     std::vector<Point> _points;
-    Plane* _plane;
+    // unit normal, points p of the plane have _normal.dot(p) == _offset
+    Vector3f _normal;
+    float _offset;
+    // the axes of the projection and the 2D bounds of the corners
+    int _u, _v;
+    float _min_u, _max_u, _min_v, _max_v;
+    // edge i goes from corner (_edge_u, _edge_v) to a corner at _edge_v_next
+    // with du/dv _edge_slope, separate arrays so the test vectorizes
+    std::vector<float> _edge_u, _edge_v, _edge_v_next, _edge_slope;
+
+    // the projection of a point of the plane is inside the polygon
+    bool contains(float u, float v) const;
 
    public:
-    bool _isOnSurface(const Point& p) const;
-    std::optional<std::pair<float, const Model*>> _getIntersectionLengthAndPart(
-        const Ray& r) const;
-    std::optional<Ray> _getNormal(const Point& p) const;
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
 
     // assume that points are given in counter clockwise order and outward
     // normal is given by right hand curl rule
-    Polygon(const std::vector<Point>& points, const Material& mat,
+    Polygon(const std::vector<Point>& points, MaterialId mat,
             const Transformation& t);
     std::ostream& print(std::ostream& os) const;
 };
 
+/**
+ * Geometry placed in the scene by its own transformation. The geometry is
+ * shared by every instance of it and lives in the model space of the
+ * instance, its own transformation included, so one mesh or collection is
+ * stored once however often it is placed. The scene BVH over the instances
+ * is the top level and the hierarchy inside the geometry the bottom level.
+ *
+ * Hits keep the part of the geometry, which shades with its own material,
+ * and name the instance, whose transformation is applied around the one
+ * of the part for the rays leaving it. Instances are placed in the scene
+ * directly, a Collection part gets the transform of the collection and
+ * would lose its own.
+ */
+class Instance : public Model {
+   private:
+    friend class SceneFile;
+    std::shared_ptr<const Model> _geometry;
+
+   public:
+    std::optional<Hit> _intersect(const Ray& r) const;
+    AABB _getBounds() const;
+    bool _occluded(const Ray& r, float tmax) const;
+    void _intersectPacket(const RayPacket& p, float* t,
+                          Hit* hits) const;
+    std::optional<Color> _getTexture(const Point& p, const Hit& hit,
+                                     float footprint) const override;
+
+    Instance(std::shared_ptr<const Model> geometry, const Transformation& t);
+    const Model& getGeometry() const { return *_geometry; }
+    // getReflected and getRefracted of a part of the geometry, in world space
+    Ray getReflected(const Model& part, const Ray& incident,
+                     const Ray& normal) const;
+    Ray getRefracted(const Model& part, const Ray& incident,
+                     const Ray& normal, const float incident_ref_idx,
+                     const float transfer_ref_idx) const;
+    std::ostream& print(std::ostream& os) const;
+};
+
 class Background {
     private:
-        Sphere* world;
+        friend class SceneFile;
+        // unit sphere carrying the texture, made in the arena of the scene
+        const Sphere* world;
         Color background;
         bool has_background;
     public:
         Background(Color c): world(NULL),background(c),has_background(false) {}
-        Background(const std::string& img_path): world(NULL),background(Vector3f::Zero()),has_background(true) {
-            Material background_material;
-            background_material.setTexture(img_path);
-            world = new Sphere(Vector3f::Zero(),1,background_material,IDENTITY_TRANS);
-        }
-        Color getTexture(const Ray& r) const {
+        Background(const Sphere* world): world(world),background(Vector3f::Zero()),has_background(true) {}
+        // spread: angle covered by the pixel, the unit sphere turns it
+        // into a footprint directly
+        Color getTexture(const Ray& r, float spread = 0) const {
             if(!has_background) return background;
-            auto texture = world->getTexture(r.dir);
+            auto texture = world->getTexture(r.dir, Hit(), spread);
             if(!(texture)) {
                 std::cerr<<"WARNING: Background did not return any texture for ray: "<<r<<" with sphere as: "<<world<<std::endl;
                 return background;
@@ -290,11 +467,23 @@ class Background {
 
 
 struct State {
+    // keeps the materials and textures of the scene, declared before the
+    // arena so the objects go first
+    std::shared_ptr<void> tables = hold_scene_tables();
+    // owner of the models, lights, camera and background below
+    std::shared_ptr<SceneArena> arena = std::make_shared<SceneArena>();
     std::vector<Model*> models;
     std::vector<ogl::BaseModel *> oglModels;
     std::vector<Light*> lights;
-    std::unordered_map<std::string, Material*> materials;
+    std::unordered_map<std::string, MaterialId> materials;
+    // shared geometry by name, placed by the Instance models
+    std::unordered_map<std::string, std::shared_ptr<const Model>> geometry;
     Camera* cam;
     Background* bg;
     std::pair<int,int> tracePoint;
+    SamplingConfig sampling;
+    TraceConfig tracing;
+    // hierarchy over models read from a compiled scene, NULL if the engine
+    // has to build it
+    std::shared_ptr<const BVH> bvh;
 };
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <limits>
+#include <optional>
+#include "DS.h"
+#include "Simd.h"
+#include "defs.h"
+
+class Model;
+
+/**
+ * Structure of arrays bundle of up to MAX_SIZE rays. Lanes past size are
+ * padding: they repeat the last active ray and carry a negative distance bound
+ * so kernels can always process whole SIMD registers.
+ */
+struct alignas(64) RayPacket {
+    static const int MAX_SIZE = 16;
+    float ox[MAX_SIZE], oy[MAX_SIZE], oz[MAX_SIZE];
+    float dx[MAX_SIZE], dy[MAX_SIZE], dz[MAX_SIZE];
+    int size;
+
+    RayPacket() : size{0} {}
+    void set(int lane, const Ray& r) {
+        ox[lane] = r.src[0];
+        oy[lane] = r.src[1];
+        oz[lane] = r.src[2];
+        dx[lane] = r.dir[0];
+        dy[lane] = r.dir[1];
+        dz[lane] = r.dir[2];
+    }
+    void push(const Ray& r) { set(size++, r); }
+    // fill the padding lanes, call after the last push
+    void pad();
+    Ray ray(int lane) const {
+        return Ray(Point(ox[lane], oy[lane], oz[lane]),
+                   Vector3f(dx[lane], dy[lane], dz[lane]));
+    }
+};
+
+// Closest hit per lane, model is NULL where nothing was hit and hit is only
+// written for the lanes with a model
+struct alignas(64) PacketHits {
+    float t[RayPacket::MAX_SIZE];
+    const Model* model[RayPacket::MAX_SIZE];
+    Hit hit[RayPacket::MAX_SIZE];
+    // unlimited distance for active lanes, a negative bound for the padding
+    // lanes so that they never register a hit
+    void reset(const RayPacket& p);
+};
+
+// point at distance t along the ray of lane
+inline Point packetPoint(const RayPacket& p, int lane, float t) {
+    return Point(p.ox[lane] + t * p.dx[lane], p.oy[lane] + t * p.dy[lane],
+                 p.oz[lane] + t * p.dz[lane]);
+}
+
+/**
+ * Transforms a world space packet to model space. The directions are
+ * normalized again and scale receives the factor from world to model
+ * distances of every lane.
+ */
+void transformPacket(const RayPacket& p, const Transformation& trans,
+                     RayPacket& out, float* scale);
+
+// true if any active lane overlaps the box closer than its t bound
+bool packetIntersectsBox(const AABB& b, const RayPacket& p,
+                         const float* inv_dx, const float* inv_dy,
+                         const float* inv_dz, const float* tmax);
+
+// SIMD kernels in model space for the instruction set of simd::isa(), t
+// receives the hit distance of every lane (infinity on a miss)
+void sphereKernel(const RayPacket& p, const Point& center, float radius_sq,
+                  float* t);
+// Moller-Trumbore with edges e1 = p2 - p1 and e2 = p3 - p1, rays more
+// parallel to the triangle than det_eps are rejected. u and v receive the
+// barycentric weights of p2 and p3, meaningful where t is finite
+void triangleKernel(const RayPacket& p, const Point& p1, const Vector3f& e1,
+                    const Vector3f& e2, float det_eps, float* t, float* u,
+                    float* v);
+// q holds the quadric parameters A..J, roots outside clip are skipped
+void quadricKernel(const RayPacket& p, const float* q, const AABB& clip,
+                   float* t);
+// one ray through the same arithmetic, the distance to the hit if any
+std::optional<float> quadricDistance(const Ray& r, const float* q,
+                                     const AABB& clip);
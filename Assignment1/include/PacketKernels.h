@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cmath>
+#include "Packet.h"
+#include "Simd.h"
+
+/**
+ * Bodies of the packet kernels, instantiated for every register type by
+ * src/Packet.cpp and for AVX2 by src/PacketAvx2.cpp, which is compiled with
+ * its own instruction set flags. Only plain floats and simd types are used
+ * in here: an inline function from elsewhere emitted by the AVX2 translation
+ * unit could be picked by the linker for the baseline code as well.
+ */
+namespace kernels {
+
+// t receives the hit distance of every lane (infinity on a miss), the lanes
+// are processed a register at a time up to the last active one
+
+template <typename V>
+bool box(const float* bmin, const float* bmax, const RayPacket& p,
+         const float* inv_dx, const float* inv_dy, const float* inv_dz,
+         const float* tmax) {
+    const V minx(bmin[0]), miny(bmin[1]), minz(bmin[2]);
+    const V maxx(bmax[0]), maxy(bmax[1]), maxz(bmax[2]);
+    for (int i = 0; i < p.size; i += V::width) {
+        V t0(0.0f);
+        V t1 = V::load(tmax + i);
+        V o = V::load(p.ox + i), inv = V::load(inv_dx + i);
+        V tn = (minx - o) * inv, tf = (maxx - o) * inv;
+        t0 = max(t0, min(tn, tf));
+        t1 = min(t1, max(tn, tf));
+        o = V::load(p.oy + i);
+        inv = V::load(inv_dy + i);
+        tn = (miny - o) * inv;
+        tf = (maxy - o) * inv;
+        t0 = max(t0, min(tn, tf));
+        t1 = min(t1, max(tn, tf));
+        o = V::load(p.oz + i);
+        inv = V::load(inv_dz + i);
+        tn = (minz - o) * inv;
+        tf = (maxz - o) * inv;
+        t0 = max(t0, min(tn, tf));
+        t1 = min(t1, max(tn, tf));
+        if (any(t0 <= t1)) return true;
+    }
+    return false;
+}
+
+template <typename V>
+void sphere(const RayPacket& p, const float* center, float radius_sq,
+            float* t) {
+    const V cx(center[0]), cy(center[1]), cz(center[2]);
+    const V r2(radius_sq), zero(0.0f), inf(INFINITY);
+    for (int i = 0; i < p.size; i += V::width) {
+        const V ocx = cx - V::load(p.ox + i);
+        const V ocy = cy - V::load(p.oy + i);
+        const V ocz = cz - V::load(p.oz + i);
+        const V dx = V::load(p.dx + i), dy = V::load(p.dy + i),
+                dz = V::load(p.dz + i);
+        const V proj = fmadd(ocx, dx, fmadd(ocy, dy, ocz * dz));
+        const V oc2 = fmadd(ocx, ocx, fmadd(ocy, ocy, ocz * ocz));
+        const V center_ray_sq = oc2 - proj * proj;
+        // outside and pointing away, or passing the sphere
+        const V miss = ((oc2 > r2) & (proj <= zero)) | (center_ray_sq > r2);
+        const V d = sqrt(max(r2 - center_ray_sq, zero));
+        const V t_near = proj - d;
+        const V dist = select(t_near < zero, proj + d, t_near);
+        select(miss, inf, dist).store(t + i);
+    }
+}
+
+template <typename V>
+void triangle(const RayPacket& p, const float* p1, const float* e1,
+              const float* e2, float det_eps, float* t, float* u_out,
+              float* v_out) {
+    const V e1x(e1[0]), e1y(e1[1]), e1z(e1[2]);
+    const V e2x(e2[0]), e2y(e2[1]), e2z(e2[2]);
+    const V p1x(p1[0]), p1y(p1[1]), p1z(p1[2]);
+    const V zero(0.0f), one(1.0f), inf(INFINITY), eps(det_eps);
+    for (int i = 0; i < p.size; i += V::width) {
+        const V dx = V::load(p.dx + i), dy = V::load(p.dy + i),
+                dz = V::load(p.dz + i);
+        // pvec = d x e2
+        const V px = dy * e2z - dz * e2y;
+        const V py = dz * e2x - dx * e2z;
+        const V pz = dx * e2y - dy * e2x;
+        const V det = fmadd(e1x, px, fmadd(e1y, py, e1z * pz));
+        const V inv_det = one / det;
+        const V tx = V::load(p.ox + i) - p1x;
+        const V ty = V::load(p.oy + i) - p1y;
+        const V tz = V::load(p.oz + i) - p1z;
+        const V u = fmadd(tx, px, fmadd(ty, py, tz * pz)) * inv_det;
+        // qvec = tvec x e1
+        const V qx = ty * e1z - tz * e1y;
+        const V qy = tz * e1x - tx * e1z;
+        const V qz = tx * e1y - ty * e1x;
+        const V v = fmadd(dx, qx, fmadd(dy, qy, dz * qz)) * inv_det;
+        const V dist = fmadd(e2x, qx, fmadd(e2y, qy, e2z * qz)) * inv_det;
+        const V hit = (abs(det) > eps) & (u >= zero) & (v >= zero) &
+                      ((u + v) <= one) & (dist >= zero);
+        select(hit, dist, inf).store(t + i);
+        u.store(u_out + i);
+        v.store(v_out + i);
+    }
+}
+
+template <typename V>
+void quadric(const RayPacket& p, const float* q, const float* clip_min,
+             const float* clip_max, float* t) {
+    const V A(q[0]), B(q[1]), C(q[2]), D(q[3]), E(q[4]), F(q[5]), G(q[6]),
+        H(q[7]), I(q[8]), J(q[9]);
+    const V zero(0.0f), two(2.0f), four(4.0f), half(0.5f), inf(INFINITY),
+        tiny(1e-12f);
+    const V min_x(clip_min[0]), min_y(clip_min[1]), min_z(clip_min[2]),
+        max_x(clip_max[0]), max_y(clip_max[1]), max_z(clip_max[2]);
+    for (int i = 0; i < p.size; i += V::width) {
+        const V ox = V::load(p.ox + i), oy = V::load(p.oy + i),
+                oz = V::load(p.oz + i);
+        const V dx = V::load(p.dx + i), dy = V::load(p.dy + i),
+                dz = V::load(p.dz + i);
+        // rows of the 4x4 quadric matrix applied to the augmented source
+        const V mo0 = fmadd(A, ox, fmadd(B, oy, fmadd(C, oz, D)));
+        const V mo1 = fmadd(B, ox, fmadd(E, oy, fmadd(F, oz, G)));
+        const V mo2 = fmadd(C, ox, fmadd(F, oy, fmadd(H, oz, I)));
+        const V mo3 = fmadd(D, ox, fmadd(G, oy, fmadd(I, oz, J)));
+        const V md0 = fmadd(A, dx, fmadd(B, dy, C * dz));
+        const V md1 = fmadd(B, dx, fmadd(E, dy, F * dz));
+        const V md2 = fmadd(C, dx, fmadd(F, dy, H * dz));
+        const V a = fmadd(dx, md0, fmadd(dy, md1, dz * md2));
+        const V b = two * fmadd(dx, mo0, fmadd(dy, mo1, dz * mo2));
+        const V c = fmadd(ox, mo0, fmadd(oy, mo1, fmadd(oz, mo2, mo3)));
+
+        const V linear = abs(a) < tiny;
+        const V disc = b * b - four * a * c;
+        const V sq = sqrt(max(disc, zero));
+        const V x1 = (zero - b - sq) * half / a;
+        const V x2 = (zero - b + sq) * half / a;
+        const V dist_lin = (zero - c) / b;
+        const V lo = select(linear, dist_lin, min(x1, x2));
+        const V hi = select(linear, dist_lin, max(x1, x2));
+        // a root counts if it is ahead and its point is inside clip
+        auto valid = [&](V d) {
+            const V x = fmadd(d, dx, ox), y = fmadd(d, dy, oy),
+                    z = fmadd(d, dz, oz);
+            return (d >= zero) & (d < inf) & (x >= min_x) & (x <= max_x) &
+                   (y >= min_y) & (y <= max_y) & (z >= min_z) & (z <= max_z);
+        };
+        const V lo_hit = valid(lo), hi_hit = valid(hi);
+        const V dist = select(lo_hit, lo, hi);
+        const V hit = (linear | (disc >= zero)) & (lo_hit | hi_hit);
+        select(hit, dist, inf).store(t + i);
+    }
+}
+
+// the AVX2/FMA instances, defined in src/PacketAvx2.cpp and only called
+// when simd::isa() is AVX2
+bool boxAvx2(const float* bmin, const float* bmax, const RayPacket& p,
+             const float* inv_dx, const float* inv_dy, const float* inv_dz,
+             const float* tmax);
+void sphereAvx2(const RayPacket& p, const float* center, float radius_sq,
+                float* t);
+void triangleAvx2(const RayPacket& p, const float* p1, const float* e1,
+                  const float* e2, float det_eps, float* t, float* u,
+                  float* v);
+void quadricAvx2(const RayPacket& p, const float* q, const float* clip_min,
+                 const float* clip_max, float* t);
+
+}  // namespace kernels
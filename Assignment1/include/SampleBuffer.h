@@ -0,0 +1,55 @@
+#pragma once
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+#include "defs.h"
+
+// What a checkpoint was rendered with, a resumed render has to match it
+struct CheckpointInfo {
+    int width;
+    int height;
+    unsigned int seed;
+    int passes;  // completed passes
+};
+
+/**
+ * Float accumulation buffer: sum of the sample colors and the sample count
+ * of every pixel. Unlike the 8-bit image it loses nothing, so a render can
+ * be stopped after any pass and continued from a checkpoint of it.
+ */
+class SampleBuffer {
+   private:
+    int _width, _height;
+    std::vector<Color> _sum;
+    std::vector<int> _count;
+
+   public:
+    SampleBuffer() : _width{0}, _height{0} {}
+    void reset(int width, int height);
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    void add(int i, int j, const Color& sum, int n) {
+        const int index = j * _width + i;
+        _sum[index] += sum;
+        _count[index] += n;
+    }
+    int count(int i, int j) const { return _count[j * _width + i]; }
+    // mean of the samples of pixel (i,j), black if it has none
+    Color mean(int i, int j) const;
+    long totalSamples() const;
+
+    /**
+     * Writes a checkpoint next to path and renames it over path, so an
+     * interrupted write never destroys the previous checkpoint
+     * @return {bool} false if the file couldn't be written
+     */
+    bool save(const std::string& path, const CheckpointInfo& info) const;
+    // Restores the buffer, returns the checkpoint's info or nothing if the
+    // file is missing or not a checkpoint
+    std::optional<CheckpointInfo> load(const std::string& path);
+    // Reads just the info of a checkpoint
+    static std::optional<CheckpointInfo> peek(const std::string& path);
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "DS.h"
+
+// a sequence of samples: the samples of a pixel, or the decisions taken
+// along one branch of the paths of a pixel
+using SampleStream = uint32_t;
+
+// the stream of branch branch of stream, see Sampler
+SampleStream substream(SampleStream stream, uint32_t branch);
+
+/**
+ * Source of the random numbers of a render. A value is a function of the
+ * seed, the stream, the index of the sample in the stream and the
+ * dimension only, so an image does not depend on the tile size, the number
+ * of threads or the order the tracer takes its decisions in. The camera
+ * uses dimensions 0 and 1 of the stream of a pixel for the position in the
+ * pixel, the tracer takes the decision at depth d of a path from dimension
+ * 2 + d of the substream of the branches leading to it.
+ */
+class Sampler {
+   protected:
+    const uint32_t _seed;
+
+   public:
+    explicit Sampler(uint32_t seed) : _seed{seed} {}
+    virtual ~Sampler() = default;
+    // in [0, 1)
+    virtual float get(SampleStream stream, uint32_t index,
+                      uint32_t dim) const = 0;
+
+    // samples_per_stream is the size of a stratified set
+    static std::unique_ptr<Sampler> make(SamplerType type, uint32_t seed,
+                                         int samples_per_stream);
+};
+
+// independent uniform values, a hash of the arguments
+class RandomSampler : public Sampler {
+   public:
+    using Sampler::Sampler;
+    float get(SampleStream stream, uint32_t index, uint32_t dim) const override;
+};
+
+/**
+ * Sets of count samples: dimensions 0 and 1 are correlated multi-jittered
+ * (Kensler 2013), stratified on a grid of about sqrt(count) x sqrt(count)
+ * cells and in each of the two axes, the other dimensions are stratified
+ * in count intervals. Index count onwards starts a new set.
+ */
+class StratifiedSampler : public Sampler {
+    const uint32_t _count;
+
+   public:
+    StratifiedSampler(uint32_t seed, int count);
+    float get(SampleStream stream, uint32_t index, uint32_t dim) const override;
+};
+
+/**
+ * Sobol sequence, Owen scrambled per stream and dimension with the hash of
+ * Burley 2020, and the indices of a stream shuffled the same way. Every
+ * prefix of 2^k samples of a stream is stratified in every dimension and
+ * in dimensions 0 and 1 together. There are direction numbers for the
+ * first dimensions, the later ones repeat them with other scrambles.
+ */
+class SobolSampler : public Sampler {
+   public:
+    using Sampler::Sampler;
+    float get(SampleStream stream, uint32_t index, uint32_t dim) const override;
+};
+
+/**
+ * Halton sequence, the radical inverse of the index in the dim-th prime
+ * base, with the digits Owen scrambled per stream and dimension. Later
+ * dimensions repeat the bases of the first ones with other scrambles.
+ */
+class HaltonSampler : public Sampler {
+   public:
+    using Sampler::Sampler;
+    float get(SampleStream stream, uint32_t index, uint32_t dim) const override;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "BVH.h"
+#include "Models.h"
+
+/**
+ * Compiled scene: the State parsed from a JSON scene stored in a versioned
+ * binary file along with everything derived from it at load time, the
+ * decoded textures and their mip chains, the material table, mesh data
+ * with smoothed normals and the mesh, collection and scene BVHs. Reading
+ * one maps the file and copies the arrays out of it, no JSON or OBJ is
+ * parsed, no image decoded and none of those BVHs built. The small per
+ * model data is still derived by the constructors: a Box rebuilds its 12
+ * triangles and their BVH, a Polygon its 2D projection and a Triangle its
+ * edges and normal.
+ *
+ * Layout: a header (magic, version, byte order, BVH node size), then the
+ * sections textures, materials, material names, camera, background,
+ * lights, sampling, tracing, trace point, shared geometry, models and the scene
+ * BVH. Models are written depth first with a type tag, Collections are
+ * followed by their parts and Instances by the index of their geometry. Arrays are prefixed by their length and start 16 byte aligned.
+ * The file is only readable by builds with the same byte order and BVH
+ * node layout, the header check rejects others.
+ */
+class SceneFile {
+   public:
+    static constexpr uint32_t VERSION = 5;
+
+    // Throws std::runtime_error if path can not be written
+    static void write(const State& s, const std::string& path);
+    // Throws std::runtime_error if path is not a compiled scene of this
+    // VERSION or is truncated. The State has no OpenGL preview models.
+    static State read(const std::string& path);
+    // true if path starts with the compiled scene magic
+    static bool isCompiled(const std::string& path);
+
+   private:
+    struct Writer;
+    struct Reader;
+
+    static void writeBVH(Writer& w, const BVH& bvh);
+    // num_primitives bounds the primitive ids of the hierarchy
+    static BVH readBVH(Reader& r, size_t num_primitives);
+    static void writeModel(Writer& w, const Model& m);
+    static Model* readModel(Reader& r);
+};
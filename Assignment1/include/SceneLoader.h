@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include "Models.h"
+
+/**
+ * Streaming reader of a JSON scene. The file goes through a SAX parser and
+ * only the element being read is held as a json value: every material,
+ * model and light is built as soon as its closing brace is read and then
+ * dropped. The exception are models and geometry that refer to a material
+ * or geometry defined later in the file: they are kept whole as json until
+ * the end. Memory is independent of the size of the document only if
+ * every material and geometry is defined before its first use.
+ *
+ * Errors are std::runtime_error with the location of the element,
+ * "scene.json:12:9: models[3]: missing key "radius"". Syntax errors point
+ * at the offending character. Unknown top level keys and model types are
+ * reported on stderr and skipped. A model whose material (or an instance
+ * whose geometry) is defined further down is kept until the end of the
+ * file, it is an error if it never appears. "camera" is required, "background" defaults to
+ * black, "tracePoint" to pixel (0, 0), "sampling" and "tracing" to the
+ * defaults of SamplingConfig and TraceConfig.
+ *
+ * "geometry" is a list of models with a "name", they are not part of the
+ * scene but placed any number of times by models of type "instance":
+ * {"type": "instance", "geometry": "crate", "transformation": {...}}
+ */
+State load_scene(const std::string& path, bool with_preview = true);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Rectangular block of pixels [x0,x1) x [y0,y1) rendered as one unit of work
+struct Tile {
+    int id;
+    int x0, y0, x1, y1;
+};
+
+// Wall time spent on one tile and the worker that rendered it
+struct TileStat {
+    int tile_id;
+    int worker;
+    double ms;
+};
+
+class TileScheduler {
+   private:
+    int _tiles_x, _tiles_y;
+    std::vector<Tile> _tiles;
+
+   public:
+    TileScheduler(int width, int height, int tile_size);
+    const std::vector<Tile>& tiles() const { return _tiles; }
+    int tilesX() const { return _tiles_x; }
+    int tilesY() const { return _tiles_y; }
+};
+
+/**
+ * Fixed size pool of worker threads with one task deque per worker. Tasks
+ * of a job are dealt out in contiguous blocks, every worker pops from the
+ * front of its own deque and, once it runs dry, steals from the back of
+ * the other deques. Workers stay alive between jobs.
+ */
+class ThreadPool {
+   private:
+    struct WorkQueue {
+        std::mutex m;
+        std::deque<int> tasks;
+    };
+
+    std::vector<std::thread> _workers;
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
+    std::mutex _m;
+    std::condition_variable _start_cv;
+    std::condition_variable _done_cv;
+    const std::function<void(int, int)>* _job;
+    long _generation;
+    int _busy;
+    bool _stop;
+
+    void workerLoop(int worker);
+    std::optional<int> popTask(int worker);
+
+   public:
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return _workers.size(); }
+    /**
+     * @param{num_tasks} number of tasks, tasks are identified by [0,num_tasks)
+     * @param{f} called as f(task, worker) exactly once for every task
+     * Blocks till all the tasks are finished
+     */
+    void parallelFor(int num_tasks, const std::function<void(int, int)>& f);
+};
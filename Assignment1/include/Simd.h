@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cmath>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Thin wrappers over the vector registers used by the packet kernels. Every
+// type offers the same operations so a kernel is written once as a template
+// (see PacketKernels.h) and instantiated for each of them, isa() picks the
+// one used at run time. vfloat8 is only declared where AVX2 is enabled, in
+// the baseline build that is src/PacketAvx2.cpp alone.
+namespace simd {
+
+struct vfloat1 {
+    static const int width = 1;
+    float v;
+    vfloat1() {}
+    vfloat1(float f) : v{f} {}
+    static vfloat1 load(const float* p) { return vfloat1(*p); }
+    void store(float* p) const { *p = v; }
+    // masks are all-ones/all-zeros bit patterns like the vector variants
+    static vfloat1 mask(bool b) { return vfloat1(b ? -NAN : 0.0f); }
+    bool lane(int) const { return std::signbit(v) && std::isnan(v); }
+};
+inline vfloat1 operator+(vfloat1 a, vfloat1 b) { return a.v + b.v; }
+inline vfloat1 operator-(vfloat1 a, vfloat1 b) { return a.v - b.v; }
+inline vfloat1 operator*(vfloat1 a, vfloat1 b) { return a.v * b.v; }
+inline vfloat1 operator/(vfloat1 a, vfloat1 b) { return a.v / b.v; }
+inline vfloat1 fmadd(vfloat1 a, vfloat1 b, vfloat1 c) { return a.v * b.v + c.v; }
+inline vfloat1 sqrt(vfloat1 a) { return std::sqrt(a.v); }
+inline vfloat1 abs(vfloat1 a) { return std::fabs(a.v); }
+inline vfloat1 min(vfloat1 a, vfloat1 b) { return a.v < b.v ? a.v : b.v; }
+inline vfloat1 max(vfloat1 a, vfloat1 b) { return a.v > b.v ? a.v : b.v; }
+inline vfloat1 operator<(vfloat1 a, vfloat1 b) { return vfloat1::mask(a.v < b.v); }
+inline vfloat1 operator<=(vfloat1 a, vfloat1 b) { return vfloat1::mask(a.v <= b.v); }
+inline vfloat1 operator>(vfloat1 a, vfloat1 b) { return vfloat1::mask(a.v > b.v); }
+inline vfloat1 operator>=(vfloat1 a, vfloat1 b) { return vfloat1::mask(a.v >= b.v); }
+inline vfloat1 operator&(vfloat1 a, vfloat1 b) { return vfloat1::mask(a.lane(0) && b.lane(0)); }
+inline vfloat1 operator|(vfloat1 a, vfloat1 b) { return vfloat1::mask(a.lane(0) || b.lane(0)); }
+inline vfloat1 andnot(vfloat1 m, vfloat1 a) { return vfloat1::mask(!m.lane(0) && a.lane(0)); }
+// select(m, a, b) = m ? a : b per lane
+inline vfloat1 select(vfloat1 m, vfloat1 a, vfloat1 b) { return m.lane(0) ? a : b; }
+inline bool any(vfloat1 m) { return m.lane(0); }
+
+#if defined(__SSE2__)
+struct vfloat4 {
+    static const int width = 4;
+    __m128 v;
+    vfloat4() {}
+    vfloat4(__m128 x) : v{x} {}
+    vfloat4(float f) : v{_mm_set1_ps(f)} {}
+    static vfloat4 load(const float* p) { return _mm_load_ps(p); }
+    void store(float* p) const { _mm_store_ps(p, v); }
+    bool lane(int i) const { return (_mm_movemask_ps(v) >> i) & 1; }
+};
+inline vfloat4 operator+(vfloat4 a, vfloat4 b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat4 operator-(vfloat4 a, vfloat4 b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat4 operator*(vfloat4 a, vfloat4 b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat4 operator/(vfloat4 a, vfloat4 b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat4 fmadd(vfloat4 a, vfloat4 b, vfloat4 c) {
+#if defined(__FMA__)
+    return _mm_fmadd_ps(a.v, b.v, c.v);
+#else
+    return _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v);
+#endif
+}
+inline vfloat4 sqrt(vfloat4 a) { return _mm_sqrt_ps(a.v); }
+inline vfloat4 abs(vfloat4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline vfloat4 min(vfloat4 a, vfloat4 b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat4 max(vfloat4 a, vfloat4 b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat4 operator<(vfloat4 a, vfloat4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vfloat4 operator<=(vfloat4 a, vfloat4 b) { return _mm_cmple_ps(a.v, b.v); }
+inline vfloat4 operator>(vfloat4 a, vfloat4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vfloat4 operator>=(vfloat4 a, vfloat4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vfloat4 operator&(vfloat4 a, vfloat4 b) { return _mm_and_ps(a.v, b.v); }
+inline vfloat4 operator|(vfloat4 a, vfloat4 b) { return _mm_or_ps(a.v, b.v); }
+inline vfloat4 andnot(vfloat4 m, vfloat4 a) { return _mm_andnot_ps(m.v, a.v); }
+inline vfloat4 select(vfloat4 m, vfloat4 a, vfloat4 b) {
+    return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+}
+inline bool any(vfloat4 m) { return _mm_movemask_ps(m.v) != 0; }
+#endif
+
+#if defined(__AVX2__)
+struct vfloat8 {
+    static const int width = 8;
+    __m256 v;
+    vfloat8() {}
+    vfloat8(__m256 x) : v{x} {}
+    vfloat8(float f) : v{_mm256_set1_ps(f)} {}
+    static vfloat8 load(const float* p) { return _mm256_load_ps(p); }
+    void store(float* p) const { _mm256_store_ps(p, v); }
+    bool lane(int i) const { return (_mm256_movemask_ps(v) >> i) & 1; }
+};
+inline vfloat8 operator+(vfloat8 a, vfloat8 b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat8 operator-(vfloat8 a, vfloat8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat8 operator*(vfloat8 a, vfloat8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat8 operator/(vfloat8 a, vfloat8 b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat8 fmadd(vfloat8 a, vfloat8 b, vfloat8 c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a.v, b.v, c.v);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v);
+#endif
+}
+inline vfloat8 sqrt(vfloat8 a) { return _mm256_sqrt_ps(a.v); }
+inline vfloat8 abs(vfloat8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline vfloat8 min(vfloat8 a, vfloat8 b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat8 max(vfloat8 a, vfloat8 b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat8 operator<(vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vfloat8 operator<=(vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vfloat8 operator>(vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vfloat8 operator>=(vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vfloat8 operator&(vfloat8 a, vfloat8 b) { return _mm256_and_ps(a.v, b.v); }
+inline vfloat8 operator|(vfloat8 a, vfloat8 b) { return _mm256_or_ps(a.v, b.v); }
+inline vfloat8 andnot(vfloat8 m, vfloat8 a) { return _mm256_andnot_ps(m.v, a.v); }
+inline vfloat8 select(vfloat8 m, vfloat8 a, vfloat8 b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+inline bool any(vfloat8 m) { return _mm256_movemask_ps(m.v) != 0; }
+#endif
+
+// instruction sets the packet kernels are built for
+enum class Isa { SCALAR, SSE, AVX2 };
+
+// widest set the CPU runs and the kernels were built for, detected on the
+// first call
+Isa isa();
+
+// name of isa()
+const char* isaName();
+
+}  // namespace simd
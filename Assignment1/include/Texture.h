@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "defs.h"
+
+// index of a texture in the TextureCache
+using TextureHandle = int;
+const TextureHandle NO_TEXTURE = -1;
+
+// What happens to texture coordinates outside of [0, 1]
+enum class WrapMode { REPEAT, CLAMP, MIRROR };
+
+enum class TextureFilter { NEAREST, BILINEAR, TRILINEAR };
+
+// How a material looks up its texture
+struct TextureSampler {
+    TextureFilter filter = TextureFilter::BILINEAR;
+    WrapMode wrap_u = WrapMode::REPEAT;
+    WrapMode wrap_v = WrapMode::CLAMP;
+};
+
+/**
+ * Image converted once to packed RGBA with a full mip chain, a texel is one
+ * 32 bit load and is scaled to [0, 1] floats when sampled. Level 0 is the
+ * source image, every further level halves both sides with a box filter
+ * down to 1x1. Row 0 is the top of the image, v grows downwards.
+ */
+class Texture {
+   private:
+    friend class SceneFile;
+    struct Level {
+        int width, height;
+        std::vector<uint32_t> texels;  // r | g << 8 | b << 16 | a << 24
+    };
+    std::vector<Level> _levels;
+
+    static uint32_t texel(const Level& l, int x, int y) {
+        return l.texels[y * l.width + x];
+    }
+    void fetchNearest(const Level& l, float u, float v,
+                      const TextureSampler& s, float* out) const;
+    void fetchBilinear(const Level& l, float u, float v,
+                       const TextureSampler& s, float* out) const;
+    // mip chain computed earlier, read from a compiled scene
+    explicit Texture(std::vector<Level> levels) : _levels{std::move(levels)} {}
+
+   public:
+    // channels is 1 (gray), 3 (RGB) or 4 (RGBA), data is interleaved
+    Texture(int width, int height, int channels, const unsigned char* data);
+
+    int width() const { return _levels[0].width; }
+    int height() const { return _levels[0].height; }
+    int numLevels() const { return _levels.size(); }
+    size_t memoryBytes() const;
+
+    /**
+     * @param{footprint} width of the filter region in uv units, only used by
+     * TRILINEAR to pick the two mip levels to blend, 0 samples level 0
+     */
+    Color sample(float u, float v, float footprint,
+                 const TextureSampler& s) const;
+};
+
+/**
+ * Owns every texture of the process, keyed by file path so models sharing
+ * an image share one copy. Textures are loaded while the scene is parsed,
+ * lookups during rendering are read only and need no locking.
+ */
+class TextureCache {
+   private:
+    friend class SceneFile;
+    std::mutex _mutex;
+    std::unordered_map<std::string, TextureHandle> _by_path;
+    std::vector<std::unique_ptr<Texture>> _textures;
+
+   public:
+    // throws std::runtime_error if the image can not be read
+    TextureHandle load(const std::string& path);
+    // Registers a texture decoded elsewhere under key, returns the handle
+    // of the texture already loaded from key if there is one
+    TextureHandle add(const std::string& key, std::unique_ptr<Texture> texture);
+    const Texture& get(TextureHandle h) const { return *_textures[h]; }
+    int size() const { return _textures.size(); }
+    size_t memoryBytes() const;
+    void clear();
+};
+
+TextureCache& texture_cache();
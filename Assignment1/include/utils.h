@@ -5,7 +5,6 @@
 #include "Models.h"
 #include "defs.h"
 #include "json.hpp"
-#include "CImg.h"
 #include "OGLModels.h"
 
 Vector4f augment(const Vector3f &vec, float val);
@@ -20,13 +19,41 @@ std::optional<std::pair<float, float>> solve_quadratic(float a, float b,float c)
 using json = nlohmann::json;
 using namespace std;
 
+// j[key], throws std::runtime_error if j is not an object or has no key
+const json &get_key(const json &j, const string &key);
+// [x, y, z]
 Vector3f get_vector3f(const json &j);
-std::pair<Model*,ogl::BaseModel*> parse_model(const json &j, unordered_map<string, Material *> &materials);
-void get_models(const json &j, vector<Model *> &models,vector<ogl::BaseModel *> &oglModels,
-                unordered_map<string, Material *> &materials);
-pair<string, Material *> parse_material(const json &j);
-void get_materials(const json &j, unordered_map<string, Material *> &materials);
-Light *parse_light(const json &j);
-void get_lights(const json &j, vector<Light *> &lights);
-Camera *get_camera(const json &j);
-State get_state(string filename);
+/**
+ * Parsers of one element of a scene. They validate the keys they need and
+ * throw std::runtime_error (or a json exception on a value of the wrong
+ * type), load_scene adds the location in the file. The objects they return
+ * are made in arena and live as long as it does.
+ */
+// with_preview=false skips the OpenGL preview models, their constructors
+// load meshes and need a current GL context. The model is NULL for an
+// unknown type, scenes disable a model by renaming its type ("Xbox").
+// scene_dir: directory of the scene file, see resolve_path
+std::pair<Model*,ogl::BaseModel*> parse_model(const json &j, unordered_map<string, MaterialId> &materials, SceneArena &arena, bool with_preview = true, const string &scene_dir = "");
+// path of a mesh or texture a scene refers to: a relative path is taken
+// from scene_dir, or from the working directory if there is no such file
+// there (scenes written before files were looked up next to them)
+string resolve_path(const string &path, const string &scene_dir);
+// {"type": "instance", "geometry": name, "transformation": ...} placing an
+// entry of geometry, throws std::runtime_error if there is none by that name
+Model *parse_instance(const json &j, const unordered_map<string, shared_ptr<const Model>> &geometry, SceneArena &arena);
+// Wavefront OBJ positions, texture coordinates, normals and faces, other
+// statements are ignored. Throws std::runtime_error on malformed input
+MeshData load_obj(const string &path);
+// optional "filter" and "wrap" keys next to a texture "img"
+TextureSampler get_texture_sampler(const json &j);
+pair<string, MaterialId> parse_material(const json &j);
+Light *parse_light(const json &j, SceneArena &arena);
+Camera *parse_camera(const json &j, SceneArena &arena);
+// scene_dir: directory of the scene file, see resolve_path
+Background *parse_background(const json &j, SceneArena &arena, const string &scene_dir = "");
+pair<int,int> parse_trace_point(const json &j);
+SamplingConfig parse_sampling(const json &j);
+// {"max_depth", "min_contribution", "roulette_depth"}, all optional
+TraceConfig parse_tracing(const json &j);
+// a JSON scene or one compiled by SceneFile::write, detected by its magic
+State get_state(string filename, bool with_preview = true);
@@ -0,0 +1,64 @@
+#include "Arena.h"
+#include <cxxabi.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <string>
+
+namespace {
+std::string type_name(const std::type_index& t) {
+    int status = 0;
+    char* name = abi::__cxa_demangle(t.name(), NULL, NULL, &status);
+    std::string s = (status == 0 && name) ? name : t.name();
+    std::free(name);
+    return s;
+}
+}  // namespace
+
+SceneArena::SceneArena(size_t block_size)
+    : _block_size{block_size}, _next{NULL}, _left{0}, _reserved{0} {}
+
+SceneArena::~SceneArena() {
+    // parts are made after their collection, so the newest goes first
+    for (auto it = _destructors.rbegin(); it != _destructors.rend(); ++it)
+        it->destroy(it->object);
+}
+
+void* SceneArena::allocate(size_t size, size_t align) {
+    size_t pad = (align - reinterpret_cast<uintptr_t>(_next) % align) % align;
+    if (!_next || pad + size > _left) {
+        // objects larger than a block get a block of their own
+        const size_t block = std::max(_block_size, size + align);
+        _blocks.emplace_back(new char[block]);
+        _next = _blocks.back().get();
+        _left = block;
+        _reserved += block;
+        pad = (align - reinterpret_cast<uintptr_t>(_next) % align) % align;
+    }
+    void* p = _next + pad;
+    _next += pad + size;
+    _left -= pad + size;
+    return p;
+}
+
+size_t SceneArena::bytesUsed() const {
+    size_t used = 0;
+    for (const auto& s : _stats) used += s.second.bytes;
+    return used;
+}
+
+void SceneArena::printStats(std::ostream& os) const {
+    std::vector<std::pair<std::string, TypeStats>> rows;
+    for (const auto& s : _stats) rows.push_back({type_name(s.first), s.second});
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    os << "scene arena: " << bytesUsed() << " bytes in " << _blocks.size()
+       << " blocks of " << _reserved << " bytes" << std::endl;
+    for (const auto& r : rows)
+        os << "  " << std::left << std::setw(14) << r.first << std::right
+           << std::setw(8) << r.second.count << " x " << std::setw(4)
+           << r.second.bytes / r.second.count << " = " << std::setw(10)
+           << r.second.bytes << " bytes" << std::endl;
+}
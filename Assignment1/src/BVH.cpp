@@ -0,0 +1,163 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+namespace {
+const int NUM_BINS = 12;
+// relative cost of a ray-box test to a ray-primitive test
+const float TRAVERSAL_COST = 0.5f;
+const int MAX_LEAF_SIZE_FORCED = 16;
+
+struct Bin {
+    AABB bounds;
+    int count = 0;
+};
+}  // namespace
+
+void BVH::build(const std::vector<AABB>& bounds, int max_leaf_size) {
+    auto start = std::chrono::steady_clock::now();
+    _nodes.clear();
+    _indices.clear();
+    _unbounded.clear();
+    _build_stats = BVHBuildStats();
+
+    std::vector<Vector3f> centroids(bounds.size());
+    for (int i = 0; i < (int)bounds.size(); i++) {
+        if (!bounds[i].isFinite()) {
+            _unbounded.push_back(i);
+            continue;
+        }
+        _indices.push_back(i);
+        centroids[i] = bounds[i].centroid();
+    }
+    _build_stats.num_primitives = bounds.size();
+    _build_stats.num_unbounded = _unbounded.size();
+
+    if (!_indices.empty()) {
+        _nodes.reserve(2 * _indices.size());
+        buildRecursive(bounds, centroids, 0, _indices.size(), 1,
+                       std::max(1, max_leaf_size));
+    }
+
+    // SAH cost of the final tree, relative to the root area
+    _build_stats.num_nodes = _nodes.size();
+    if (!_nodes.empty()) {
+        const float root_area = _nodes[0].bounds.surfaceArea();
+        float cost = 0;
+        for (const auto& n : _nodes) {
+            const float p = root_area > 0 ? n.bounds.surfaceArea() / root_area : 1;
+            cost += p * (n.count > 0 ? n.count : TRAVERSAL_COST);
+        }
+        _build_stats.sah_cost = cost;
+    }
+    auto end = std::chrono::steady_clock::now();
+    _build_stats.build_ms =
+        std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int BVH::buildRecursive(const std::vector<AABB>& bounds,
+                        std::vector<Vector3f>& centroids, int begin, int end,
+                        int depth, int max_leaf_size) {
+    const int node_idx = _nodes.size();
+    _nodes.push_back(BVHNode());
+    _build_stats.max_depth = std::max(_build_stats.max_depth, depth);
+
+    AABB node_bounds, centroid_bounds;
+    for (int i = begin; i < end; i++) {
+        node_bounds.expand(bounds[_indices[i]]);
+        centroid_bounds.expand(centroids[_indices[i]]);
+    }
+    _nodes[node_idx].bounds = node_bounds;
+
+    const int count = end - begin;
+    auto make_leaf = [&]() {
+        assert(count <= std::numeric_limits<unsigned short>::max());
+        _nodes[node_idx].offset = begin;
+        _nodes[node_idx].count = count;
+        _nodes[node_idx].axis = 0;
+        _build_stats.num_leaves++;
+        return node_idx;
+    };
+    if (count <= max_leaf_size || depth >= MAX_DEPTH) return make_leaf();
+
+    // split along the axis with the largest centroid extent
+    Vector3f extent = centroid_bounds.max - centroid_bounds.min;
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+
+    int mid = begin + count / 2;
+    bool median_split = true;
+    if (extent[axis] <= 0) {
+        // all centroids coincide, SAH can't separate them
+        if (count <= MAX_LEAF_SIZE_FORCED) return make_leaf();
+    } else {
+        // binned SAH
+        Bin bins[NUM_BINS];
+        const float k = NUM_BINS / extent[axis];
+        auto bin_of = [&](int prim) {
+            int b = (centroids[prim][axis] - centroid_bounds.min[axis]) * k;
+            return std::min(NUM_BINS - 1, std::max(0, b));
+        };
+        for (int i = begin; i < end; i++) {
+            Bin& b = bins[bin_of(_indices[i])];
+            b.count++;
+            b.bounds.expand(bounds[_indices[i]]);
+        }
+        float cost[NUM_BINS - 1];
+        AABB left;
+        int left_count = 0;
+        for (int s = 0; s < NUM_BINS - 1; s++) {
+            left.expand(bins[s].bounds);
+            left_count += bins[s].count;
+            cost[s] = left_count * left.surfaceArea();
+        }
+        AABB right;
+        int right_count = 0;
+        for (int s = NUM_BINS - 1; s > 0; s--) {
+            right.expand(bins[s].bounds);
+            right_count += bins[s].count;
+            cost[s - 1] += right_count * right.surfaceArea();
+        }
+        int best = 0;
+        for (int s = 1; s < NUM_BINS - 1; s++)
+            if (cost[s] < cost[best]) best = s;
+
+        const float area = node_bounds.surfaceArea();
+        const float split_cost =
+            TRAVERSAL_COST + (area > 0 ? cost[best] / area : 0);
+        if (split_cost >= count && count <= MAX_LEAF_SIZE_FORCED)
+            return make_leaf();
+
+        auto it = std::partition(
+            _indices.begin() + begin, _indices.begin() + end,
+            [&](int prim) { return bin_of(prim) <= best; });
+        mid = it - _indices.begin();
+        median_split = (mid == begin || mid == end);
+        if (median_split) mid = begin + count / 2;
+    }
+    if (median_split) {
+        std::nth_element(_indices.begin() + begin, _indices.begin() + mid,
+                         _indices.begin() + end, [&](int a, int b) {
+                             return centroids[a][axis] < centroids[b][axis];
+                         });
+    }
+
+    buildRecursive(bounds, centroids, begin, mid, depth + 1, max_leaf_size);
+    const int right =
+        buildRecursive(bounds, centroids, mid, end, depth + 1, max_leaf_size);
+    _nodes[node_idx].offset = right;
+    _nodes[node_idx].count = 0;
+    _nodes[node_idx].axis = axis;
+    return node_idx;
+}
+
+std::ostream& operator<<(std::ostream& os, const BVH& bvh) {
+    const BVHBuildStats& st = bvh._build_stats;
+    return os << "BVH{primitives=" << st.num_primitives
+              << ",unbounded=" << st.num_unbounded
+              << ",nodes=" << st.num_nodes << ",leaves=" << st.num_leaves
+              << ",max_depth=" << st.max_depth << ",sah_cost=" << st.sah_cost
+              << ",build_ms=" << st.build_ms << "}";
+}
@@ -4,7 +4,7 @@
 #include "Models.h"
 #include "defs.h"
 Box::Box(const Point& center, const Vector3f& x, const Vector3f& y, float l,
-         float b, float h, const Material& mat, const Transformation& t)
+         float b, float h, MaterialId mat, const Transformation& t)
     : Model{mat,t},
       _center{center},
       _l{l},
@@ -27,37 +27,39 @@ Box::Box(const Point& center, const Vector3f& x, const Vector3f& y, float l,
     Point ltl = c - _az * b2 - _ay * h2 - _ax * l2;  // lower top left
     Point ltr = c - _az * b2 - _ay * h2 + _ax * l2;  // lower top right
 
+    _faces.reserve(12);
     // top face
-    _coll.addModel(new Triangle(utl, utr, ubr, mat, t));
-    _coll.addModel(new Triangle(utl, ubl, ubr, mat, t));
+    _faces.emplace_back(utl, utr, ubr, mat, t);
+    _faces.emplace_back(utl, ubl, ubr, mat, t);
     // bottom face
-    _coll.addModel(new Triangle(ltl, ltr, lbr, mat, t));
-    _coll.addModel(new Triangle(ltl, lbl, lbr, mat, t));
+    _faces.emplace_back(ltl, ltr, lbr, mat, t);
+    _faces.emplace_back(ltl, lbl, lbr, mat, t);
     // front face
-    _coll.addModel(new Triangle(ubl, ubr, lbr, mat, t));
-    _coll.addModel(new Triangle(ubl, lbl, lbr, mat, t));
+    _faces.emplace_back(ubl, ubr, lbr, mat, t);
+    _faces.emplace_back(ubl, lbl, lbr, mat, t);
     // back face
-    _coll.addModel(new Triangle(utl, utr, ltr, mat, t));
-    _coll.addModel(new Triangle(utl, ltl, lbr, mat, t));
+    _faces.emplace_back(utl, utr, ltr, mat, t);
+    _faces.emplace_back(utl, ltl, lbr, mat, t);
     // left face
-    _coll.addModel(new Triangle(ubl, utl, ltl, mat, t));
-    _coll.addModel(new Triangle(ubl, lbl, ltl, mat, t));
+    _faces.emplace_back(ubl, utl, ltl, mat, t);
+    _faces.emplace_back(ubl, lbl, ltl, mat, t);
     // right face
-    _coll.addModel(new Triangle(ubr, utr, ltr, mat, t));
-    _coll.addModel(new Triangle(ubr, lbr, ltr, mat, t));
+    _faces.emplace_back(ubr, utr, ltr, mat, t);
+    _faces.emplace_back(ubr, lbr, ltr, mat, t);
+    for (Triangle& f : _faces) _coll.addModel(&f);
+    _coll.buildBVH();
 }
 
-std::optional<std::pair<float, const Model*>> Box::_getIntersectionLengthAndPart(
-    const Ray& r) const {
-    return _coll._getIntersectionLengthAndPart(r);
+std::optional<Hit> Box::_intersect(const Ray& r) const {
+    return _coll._intersect(r);
 }
 
-bool Box::_isOnSurface(const Point& p) const { return _coll._isOnSurface(p); }
-
-std::optional<Ray> Box::_getNormal(const Point& p) const {
-    return _coll._getNormal(p);
+bool Box::_occluded(const Ray& r, float tmax) const {
+    return _coll._occluded(r, tmax);
 }
 
+AABB Box::_getBounds() const { return _coll._getBounds(); }
+
 std::ostream& Box::print(std::ostream& os) const {
     return os << "Box{l=" << _l << ",b=" << _b << ",h=" << _h << ",ax=" << _ax
               << ",ay=" << _ay << ",az=" << _az << "}";
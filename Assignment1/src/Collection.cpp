@@ -4,42 +4,57 @@
 #include "Models.h"
 #include "defs.h"
 
-std::optional<const Model*> Collection::getWhichPart(const Point& p) const {
-    for (auto part : _parts) {
-        if (part->_isOnSurface(p)) return part;
-    }
-    return {};
+void Collection::buildBVH() {
+    std::vector<AABB> bounds;
+    for (auto part : _parts) bounds.push_back(part->_getBounds());
+    _bvh.build(bounds);
+    _bvh_dirty = false;
 }
 
-std::optional<std::pair<float, const Model*>>
-Collection::_getIntersectionLengthAndPart(const Ray& r) const {
-    const Model* closest_model_part = NULL;
+std::optional<Hit> Collection::_intersect(const Ray& r) const {
+    std::optional<Hit> closest;
     float closest_distance = std::numeric_limits<float>::infinity();
 
-    for (auto part : _parts) {
-        auto intersection_part = part->_getIntersectionLengthAndPart(r);
-        if (!intersection_part) continue;
-        auto len = intersection_part.value().first;
-        if (len < closest_distance) {
-            closest_distance = len;
-            closest_model_part = part;
-        }
+    if (!_bvh_dirty) {
+        int closest_part = _bvh.intersect(
+            r, closest_distance,
+            [&](int i, float tmax) -> std::optional<float> {
+                auto hit = _parts[i]->_intersect(r);
+                if (!hit || hit.value().t >= tmax) return {};
+                closest = hit;
+                return hit.value().t;
+            });
+        if (closest_part < 0) return {};
+        closest.value().part = _parts[closest_part];
+        return closest;
     }
 
-    if (!closest_model_part) return {};
-    return std::make_pair(closest_distance, closest_model_part);
+    for (auto part : _parts) {
+        auto hit = part->_intersect(r);
+        if (!hit || hit.value().t >= closest_distance) continue;
+        closest_distance = hit.value().t;
+        closest = hit;
+        closest.value().part = part;
+    }
+    return closest;
 }
 
-bool Collection::_isOnSurface(const Point& p) const {
-    return getWhichPart(p).has_value();
+bool Collection::_occluded(const Ray& r, float tmax) const {
+    if (!_bvh_dirty) {
+        return _bvh.occluded(r, tmax, [&](int i, float t) {
+            return _parts[i]->_occluded(r, t);
+        });
+    }
+    for (auto part : _parts) {
+        if (part->_occluded(r, tmax)) return true;
+    }
+    return false;
 }
 
-std::optional<Ray> Collection::_getNormal(
-    const Point& p) const {  // returns outward normal
-    auto part_opt = getWhichPart(p);
-    if (!part_opt) return {};
-    auto part = part_opt.value();
-    return part->_getNormal(p);
+AABB Collection::_getBounds() const {
+    AABB b;
+    for (auto part : _parts) b.expand(part->_getBounds());
+    return b;
 }
 
 std::ostream& Collection::print(std::ostream& os) const {
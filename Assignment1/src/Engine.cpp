@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <limits>
-#include <random>
 #include <vector>
 
 #include "DS.h"
@@ -11,62 +15,239 @@
 
 using namespace std;
 
-void RenderEngine::addModel(const Model* model) { _models.push_back(model); }
-std::vector<pair<Vector3f, Vector3f>> BLANK;
+// traversal counters of the tile being rendered by this thread
+static thread_local BVHTraversalStats traversal_stats;
+// light list of every recursion depth, reused between shading calls
+static thread_local std::vector<std::vector<std::pair<Color, Vector3f>>>
+    light_scratch;
+namespace {
+// running color sum and luminance moments of one pixel's samples
+struct PixelAccum {
+    Color sum;
+    double lum_sum, lum_sq;
+    int n;
+    void add(const Color& c) {
+        const double lum = 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+        sum += c;
+        lum_sum += lum;
+        lum_sq += lum * lum;
+        n++;
+    }
+    // standard error of the mean luminance
+    double standardError() const {
+        if (n < 2) return std::numeric_limits<double>::infinity();
+        const double var =
+            std::max(0.0, (lum_sq - lum_sum * lum_sum / n) / (n - 1));
+        return std::sqrt(var / n);
+    }
+};
+}  // namespace
 
-pair<Color, std::vector<pair<Vector3f, Vector3f>>> RenderEngine::trace(
-    Ray r, float refractive_index, int depth) {
-    // cout<<"trace begin: "<<r<<" refIdx: "<<refractive_index<<"depth:"<<depth<<endl;
+// per tile buffers, sized for the largest tile this thread has rendered
+static thread_local std::vector<PixelAccum> tile_pixels;
+static thread_local std::vector<Ray> tile_rays;
+static thread_local std::vector<PathSample> tile_samples;
+static thread_local std::vector<Color> tile_colors;
 
-    const Model* closest_model = NULL;
-    const Model* closest_model_part = NULL;
-    float closest_distance = std::numeric_limits<float>::infinity();
-    for (auto mod : _models) {
-        // cout<<"Checking Model: "<<(*mod)<<endl;
-        auto part = mod->getIntersectionLengthAndPart(r);
-        if (!part) continue;
-        auto len = part.value().first;
-        if (len < closest_distance) {
-            closest_distance = len;
-            closest_model = mod;
-            closest_model_part = part.value().second;
-        }
+namespace {
+// a ray waiting in the wavefront queue of its depth
+struct QueuedRay {
+    Ray ray;
+    Color throughput;  // its color is added to its sample times this
+    float refractive_index;
+    int sample;     // the camera ray it continues
+    uint32_t path;  // as in PathSample
+};
+// closest hit of a queued ray
+struct QueuedHit {
+    int ray;  // in the queue
+    SceneHit hit;
+    Point point;       // on the surface
+    Point shadow_src;  // off the surface on the side of the ray
+};
+
+// a 16-bit sort key and the index in the queue it belongs to
+using Keyed = std::pair<uint16_t, int>;
+
+// queues of the wavefront tracer, reused between tiles
+thread_local std::vector<QueuedRay> wave_rays, wave_next, wave_sorted;
+thread_local std::vector<QueuedHit> wave_hits;
+thread_local std::vector<Ray> wave_shadow_rays;
+thread_local std::vector<char> wave_visible;
+thread_local std::vector<Keyed> wave_order, wave_order_tmp;
+thread_local std::vector<std::pair<Color, Vector3f>> wave_lights;
+
+// sorts order by key, ties keep their order. Two counting passes of a
+// byte each, a queue holds about a thousand rays, where this is several
+// times faster than a comparison sort
+void radix_sort(std::vector<Keyed>& order, std::vector<Keyed>& tmp) {
+    tmp.resize(order.size());
+    for (int shift = 0; shift < 16; shift += 8) {
+        int start[257] = {0};
+        for (const Keyed& o : order) start[((o.first >> shift) & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++) start[b + 1] += start[b];
+        for (const Keyed& o : order) tmp[start[(o.first >> shift) & 0xFF]++] = o;
+        std::swap(order, tmp);
     }
+}
 
-    if (!closest_model) {
-        // cout<<"Background hit! "<<Color(0.2, 0.7, 0.8)<<endl;
-        return std::make_pair(_background.getTexture(r),
-                              BLANK);  // TODO: Change this to background
-        // return Color(0, 0, 0);  // TODO: Change this to background
+// the 4 low bits of v spread to every third bit
+uint32_t spread_bits(uint32_t v) {
+    v = (v | (v << 4)) & 0x0C3;
+    v = (v | (v << 2)) & 0x249;
+    return v;
+}
+
+// direction octant, then the Morton code of the origin in a 16^3 grid over
+// bounds: rays with close keys start close together and go the same way
+uint16_t coherence_key(const Ray& r, const AABB& bounds) {
+    const uint32_t octant =
+        (r.dir[0] < 0) | ((r.dir[1] < 0) << 1) | ((r.dir[2] < 0) << 2);
+    const Vector3f extent = bounds.max - bounds.min;
+    uint32_t code = 0;
+    for (int a = 0; a < 3; a++) {
+        const float f = extent[a] > 0 ? (r.src[a] - bounds.min[a]) / extent[a]
+                                      : 0.0f;
+        const uint32_t q = (uint32_t)std::min(15.0f, std::max(0.0f, f * 16));
+        code |= spread_bits(q) << a;
     }
-    Point intersection_point_true = r.src + (closest_distance)*r.dir;
-    auto normal_opt = closest_model_part->getNormal(intersection_point_true);
+    return (octant << 12) | code;
+}
+
+// the rays leaving the part of a hit, through the instance placing it
+Ray reflect_at(const Hit& h, const Ray& r, const Ray& normal) {
+    if (h.instance) return h.instance->getReflected(*h.part, r, normal);
+    return h.part->getReflected(r, normal);
+}
+
+Ray refract_at(const Hit& h, const Ray& r, const Ray& normal,
+                  float incident_ref_idx, float transfer_ref_idx) {
+    if (h.instance)
+        return h.instance->getRefracted(*h.part, r, normal, incident_ref_idx,
+                                        transfer_ref_idx);
+    return h.part->getRefracted(r, normal, incident_ref_idx, transfer_ref_idx);
+}
+}  // namespace
 
-    if (!normal_opt) {
-        // Don't know why normal not returned
-        // std::cerr<<"WARNING: Inconsistency Error! Intersected point doesn't
-        // have a normal! intersected_part:"<<(*closest_model_part)<<std::endl;
-        return std::make_pair(Color(0, 0, 0), BLANK);
+void RenderEngine::buildBVH() {
+    std::vector<AABB> bounds;
+    for (auto mod : _models) bounds.push_back(mod->getBounds());
+    _bvh.build(bounds);
+    _flat = FlatScene(_models, _bvh.getOrder());
+}
+
+void RenderEngine::makeSampler() {
+    // a stratified set is the samples of a pixel in one pass
+    _sampler = Sampler::make(_sampling.sampler, _seed, _sampling.min_samples);
+}
+
+void RenderEngine::addModel(const Model* model) {
+    _models.push_back(model);
+    buildBVH();
+}
+
+std::optional<SceneHit> RenderEngine::intersect(const Ray& r) const {
+    SceneHit hit{NULL, Hit()};
+    float closest = std::numeric_limits<float>::infinity();
+    _bvh.intersect(
+        r, closest,
+        [&](int idx, float tmax) -> std::optional<float> {
+            if (!_flat.intersect(idx, r, tmax, hit.hit)) return {};
+            hit.model = _models[idx];
+            return hit.hit.t;
+        },
+        &traversal_stats);
+    if (!hit.model) return {};
+    return hit;
+}
+
+void RenderEngine::intersect(const RayPacket& p, PacketHits& hits) const {
+    hits.reset(p);
+    _bvh.intersectPacket(
+        p, hits.t, [&](int idx) { _models[idx]->intersectPacket(p, hits); },
+        &traversal_stats);
+}
+
+void RenderEngine::branchProbabilities(const Material& mat, int depth,
+                                       const Color& reflected_throughput,
+                                       bool refractive,
+                                       const Color& refracted_throughput,
+                                       const PathSample& sample,
+                                       float& p_reflected,
+                                       float& p_refracted) const {
+    const bool reflect =
+        reflected_throughput.maxCoeff() > _tracing.min_contribution;
+    const bool refract =
+        refractive && refracted_throughput.maxCoeff() > _tracing.min_contribution;
+    p_reflected = reflect;
+    p_refracted = refract;
+    if (!_tracing.hasRoulette() || depth < _tracing.roulette_depth ||
+        !mat.roulette || !(reflect || refract))
+        return;
+    // one of the rays, or none when both are weak
+    const float w_reflected = reflect ? reflected_throughput.maxCoeff() : 0.0f;
+    const float w_refracted = refract ? refracted_throughput.maxCoeff() : 0.0f;
+    const float p_any = std::min(1.0f, w_reflected + w_refracted);
+    p_reflected = p_any * w_reflected / (w_reflected + w_refracted);
+    p_refracted = p_any - p_reflected;
+    const float u = _sampler->get(substream(sample.stream, sample.path),
+                                  sample.index, 2 + depth);
+    if (u < p_reflected) {
+        p_refracted = 0;
+    } else if (u < p_any) {
+        p_reflected = 0;
+    } else {
+        p_reflected = p_refracted = 0;
     }
+}
 
-    std::vector<pair<Vector3f, Vector3f>> intersection_pts_vector;
+template <typename Recorder>
+Color RenderEngine::traceRecorded(const Ray& r, float refractive_index,
+                                  int depth, const Color& throughput,
+                                  const PathSample& sample, Recorder& rec) {
+    // cout<<"trace begin: "<<r<<" refIdx: "<<refractive_index<<"depth:"<<depth<<endl;
+    return shadeRecorded(r, refractive_index, depth, throughput, intersect(r),
+                         sample, rec);
+}
 
-    Ray normal = normal_opt.value();
+template <typename Recorder>
+Color RenderEngine::shadeRecorded(const Ray& r, float refractive_index,
+                                  int depth, const Color& throughput,
+                                  const std::optional<SceneHit>& hit,
+                                  const PathSample& sample, Recorder& rec) {
+    if (!hit) {
+        // cout<<"Background hit! "<<Color(0.2, 0.7, 0.8)<<endl;
+        return _background.getTexture(r, _pixel_spread);
+        // return Color(0, 0, 0);  // TODO: Change this to background
+    }
+    const Model* closest_model = hit.value().model;
+    const Hit& surface = hit.value().hit;
+    const Model* closest_model_part = surface.part;
+    const float closest_distance = surface.t;
+    Point intersection_point_true = r.src + (closest_distance)*r.dir;
+    // the record's normal is unit length already
+    Ray normal(intersection_point_true, surface.normal, 1);
 
     // taking intersection point slightly outside of intersection in
     // opposite direction of ray
     Point intersection_point =
         intersection_point_true +
-        ((normal.dir.dot(r.dir) > 0) ? (-EPSILON) : (EPSILON)) * normal.dir;
+        (surface.inside ? (-EPSILON) : (EPSILON)) * normal.dir;
     // auto intersection_point = intersection_point_true - EPSILON*r.dir;
 
-    intersection_pts_vector.push_back({r.src, intersection_point_true});
+    rec.add(r.src, intersection_point_true);
 
     std::optional<Color> reflected;
     std::optional<Color> refracted;
-    bool has_refracted = false;
 
-    std::vector<std::pair<Color, Vector3f>> light_rays;
+    // depth never exceeds max_depth, so the outer vector is sized once
+    // and the lists of the shallower calls stay valid
+    const int max_depth = _tracing.max_depth;
+    assert(depth <= max_depth);
+    if ((int)light_scratch.size() < max_depth + 1)
+        light_scratch.resize(max_depth + 1);
+    std::vector<std::pair<Color, Vector3f>>& light_rays = light_scratch[depth];
+    light_rays.clear();
 
     // cout<<"Intersection point true: "<<intersection_point_true<<" |Intersection point: "<<intersection_point<<endl; cout<<"Normal:"<<normal<<endl;
     // cout<<"Model intersection: "<<(*closest_model)<<endl;
@@ -74,16 +255,12 @@ pair<Color, std::vector<pair<Vector3f, Vector3f>>> RenderEngine::trace(
     // shadow rays
     for (auto light : _lights) {
         auto shadow_ray = light->getRayToLight(intersection_point);
-        bool is_occluded = false;
-        for (auto mod : _models) {
-            auto intersection_part =
-                mod->getIntersectionLengthAndPart(shadow_ray);
-            if (intersection_part &&
-                intersection_part.value().first < shadow_ray.length) {
-                is_occluded = true;
-                break;
-            }
-        }
+        bool is_occluded = _bvh.occluded(
+            shadow_ray, shadow_ray.length,
+            [&](int idx, float tmax) {
+                return _flat.occluded(idx, shadow_ray, tmax);
+            },
+            &traversal_stats);
         if (is_occluded) {
             // std::cout<<"IS OCCLUDED!!!!! from "<<*light<<std::endl;
         }
@@ -91,43 +268,53 @@ pair<Color, std::vector<pair<Vector3f, Vector3f>>> RenderEngine::trace(
             light_rays.push_back(
                 std::make_pair(light->getIntensity(), shadow_ray.dir));
         }
-        intersection_pts_vector.push_back(
-            {intersection_point_true,
-             intersection_point_true + (shadow_ray.dir * shadow_ray.length)});
+        rec.add(intersection_point_true,
+                intersection_point_true + (shadow_ray.dir * shadow_ray.length));
     }
 
-    if (depth < max_trace_depth) {  // if recursion depth is not reached and
-                                    // normal is present
-        // reflected ray
-        auto reflected_ray = closest_model_part->getReflected(r, normal);
-        // cout<<"Tracing reflected!"<<"depth:"<<depth<<endl;
-        auto reflected_return_el =
-            trace(reflected_ray, refractive_index, depth + 1);
-        reflected = reflected_return_el.first;
-        intersection_pts_vector.insert(intersection_pts_vector.end(),
-                                       reflected_return_el.second.begin(),
-                                       reflected_return_el.second.end());
-
-        // refracted ray
+    if (depth < max_depth) {
+        const Material& mat = closest_model_part->getMaterial();
         auto trans_refractive_index =
-            closest_model_part->getRefractiveIndex(r.dir, normal.dir);
-        if (trans_refractive_index) {
-            auto refracted_ray = closest_model_part->getRefracted(
-                r, normal, refractive_index, trans_refractive_index.value());
-            // cout<<"Tracing refracted!"<<"depth:"<<depth<<endl;
-            auto refracted_return_el =
-                trace(refracted_ray, trans_refractive_index.value(), depth + 1);
-            refracted = refracted_return_el.first;
-
-            intersection_pts_vector.insert(intersection_pts_vector.end(),
-                                           refracted_return_el.second.begin(),
-                                           refracted_return_el.second.end());
+            closest_model_part->getRefractiveIndex(surface);
+        // weight of each ray in the pixel, rays too weak to show are
+        // not traced (an untraced ray adds nothing to the color)
+        const Color reflected_throughput = throughput.cwiseProduct(mat.Krg);
+        const Color refracted_throughput = throughput.cwiseProduct(mat.Ktg);
+        float p_reflected, p_refracted;
+        branchProbabilities(mat, depth, reflected_throughput,
+                            trans_refractive_index.has_value(),
+                            refracted_throughput, sample, p_reflected,
+                            p_refracted);
+        // the surviving rays carry the weight of the ones ended for them
+        if (p_reflected > 0) {
+            auto reflected_ray = reflect_at(surface, r, normal);
+            const PathSample branch{sample.stream, sample.index,
+                                    sample.path * 2};
+            reflected = traceRecorded(reflected_ray, refractive_index,
+                                      depth + 1,
+                                      reflected_throughput / p_reflected,
+                                      branch, rec)
+                            / p_reflected;
+        }
+        if (p_refracted > 0) {
+            auto refracted_ray = refract_at(surface, r, normal, refractive_index,
+                                            trans_refractive_index.value());
+            const PathSample branch{sample.stream, sample.index,
+                                    sample.path * 2 + 1};
+            refracted = traceRecorded(refracted_ray,
+                                      trans_refractive_index.value(),
+                                      depth + 1,
+                                      refracted_throughput / p_refracted,
+                                      branch, rec)
+                            / p_refracted;
         }
     }
 
     // getting the final texture at the intersection point
     // using closest_model since we want to get global texture
-    auto point_texture = closest_model->getTexture(intersection_point_true);
+    // the footprint ignores the spread added by earlier bounces
+    auto point_texture = closest_model->getTexture(
+        intersection_point_true, surface, closest_distance * _pixel_spread);
 
     // negating r.dir so that direction is away from point of intersection
     // using closest_model_part since we want to get the final_intensity of the model_part
@@ -137,7 +324,21 @@ pair<Color, std::vector<pair<Vector3f, Vector3f>>> RenderEngine::trace(
                                     refracted ? (&refracted.value()) : NULL, point_texture);
     
     // cout<<"final intensity: "<<final_intensity<<endl;
-    return std::make_pair(final_intensity,intersection_pts_vector);
+    return final_intensity;
+}
+
+Color RenderEngine::trace(const Ray& r, float refractive_index, int depth,
+                          const PathSample& sample, const Color& throughput) {
+    NullRecorder rec;
+    return traceRecorded(r, refractive_index, depth, throughput, sample, rec);
+}
+
+Color RenderEngine::shade(const Ray& r, float refractive_index, int depth,
+                          const std::optional<SceneHit>& hit,
+                          const PathSample& sample, const Color& throughput) {
+    NullRecorder rec;
+    return shadeRecorded(r, refractive_index, depth, throughput, hit, sample,
+                         rec);
 }
 
 pair<Color,std::vector<pair<Vector3f,Vector3f>>> RenderEngine::getTrace(int i, int j) {
@@ -149,47 +350,424 @@ pair<Color,std::vector<pair<Vector3f,Vector3f>>> RenderEngine::getTrace(int i, i
     float x = ((float)i + 0.5f) / width;
     float y = ((float)j + 0.5f) / height;
     Ray r = _cam.getRay(x, y).value();
-    return trace(r, 1, 0);
+    const PathSample sample{(SampleStream)(j * width + i), 0, 1};
+    TraceRecorder rec;
+    Color color = traceRecorded(r, 1, 0, Color::Ones(), sample, rec);
+    return std::make_pair(color, std::move(rec.segments));
+}
+
+void RenderEngine::traceWavefront(const std::vector<Ray>& primary,
+                                  const std::vector<PathSample>& samples,
+                                  std::vector<Color>& colors) {
+    colors.assign(primary.size(), Color(0, 0, 0));
+    std::vector<QueuedRay>& rays = wave_rays;
+    std::vector<QueuedRay>& next = wave_next;
+    std::vector<QueuedHit>& hits = wave_hits;
+    std::vector<Keyed>& order = wave_order;
+    rays.clear();
+    for (size_t i = 0; i < primary.size(); i++)
+        rays.push_back({primary[i], Color::Ones(), 1, (int)i, 1});
+    const int num_lights = _lights.size();
+    RayPacket packet;
+    PacketHits packet_hits;
+
+    for (int depth = 0; !rays.empty(); depth++) {
+        // camera rays come in pixel order, which is coherent already
+        if (depth > 0) {
+            AABB bounds;
+            for (const QueuedRay& q : rays) bounds.expand(q.ray.src);
+            order.clear();
+            for (size_t i = 0; i < rays.size(); i++)
+                order.push_back({coherence_key(rays[i].ray, bounds), (int)i});
+            radix_sort(order, wave_order_tmp);
+            wave_sorted.clear();
+            for (const Keyed& o : order) wave_sorted.push_back(rays[o.second]);
+            std::swap(rays, wave_sorted);
+        }
+
+        // closest hits, misses see the background
+        hits.clear();
+        auto add_hit = [&](int i, const std::optional<SceneHit>& hit) {
+            const QueuedRay& q = rays[i];
+            if (!hit) {
+                colors[q.sample] += q.throughput.cwiseProduct(
+                    _background.getTexture(q.ray, _pixel_spread));
+                return;
+            }
+            const Hit& surface = hit.value().hit;
+            const Point point = q.ray.src + surface.t * q.ray.dir;
+            hits.push_back(
+                {i, hit.value(), point,
+                 point + (surface.inside ? -EPSILON : EPSILON) * surface.normal});
+        };
+        const int n = rays.size();
+        for (int first = 0; first < n; first += _packet_size) {
+            const int size = std::min(_packet_size, n - first);
+            if (size == 1) {
+                add_hit(first, intersect(rays[first].ray));
+                continue;
+            }
+            packet.size = 0;
+            for (int i = first; i < first + size; i++)
+                packet.push(rays[i].ray);
+            packet.pad();
+            intersect(packet, packet_hits);
+            for (int lane = 0; lane < size; lane++) {
+                std::optional<SceneHit> hit;
+                if (packet_hits.model[lane])
+                    hit = SceneHit{packet_hits.model[lane],
+                                   packet_hits.hit[lane]};
+                add_hit(first + lane, hit);
+            }
+        }
+
+        // shadow rays of hit h are h * num_lights onwards. The hits are in
+        // the order of their rays, so the rays to one light are tested in
+        // coherence order
+        std::vector<Ray>& shadow_rays = wave_shadow_rays;
+        shadow_rays.clear();
+        for (const QueuedHit& h : hits)
+            for (const Light* light : _lights)
+                shadow_rays.push_back(light->getRayToLight(h.shadow_src));
+        wave_visible.resize(shadow_rays.size());
+        for (int l = 0; l < num_lights; l++)
+            for (size_t s = l; s < shadow_rays.size(); s += num_lights) {
+                const Ray& shadow_ray = shadow_rays[s];
+                wave_visible[s] = !_bvh.occluded(
+                    shadow_ray, shadow_ray.length,
+                    [&](int idx, float tmax) {
+                        return _flat.occluded(idx, shadow_ray, tmax);
+                    },
+                    &traversal_stats);
+            }
+
+        // shading grouped by material, queueing the next depth
+        order.clear();
+        for (size_t h = 0; h < hits.size(); h++)
+            order.push_back({hits[h].hit.hit.part->mat_id, (int)h});
+        radix_sort(order, wave_order_tmp);
+        next.clear();
+        for (const auto& o : order) {
+            const QueuedHit& h = hits[o.second];
+            const QueuedRay& q = rays[h.ray];
+            const Hit& surface = h.hit.hit;
+            const Model* part = surface.part;
+            std::vector<std::pair<Color, Vector3f>>& lights = wave_lights;
+            lights.clear();
+            for (int l = 0; l < num_lights; l++) {
+                const int s = o.second * num_lights + l;
+                if (wave_visible[s])
+                    lights.push_back(
+                        {_lights[l]->getIntensity(), shadow_rays[s].dir});
+            }
+            auto texture = h.hit.model->getTexture(h.point, surface,
+                                                   surface.t * _pixel_spread);
+            colors[q.sample] += q.throughput.cwiseProduct(
+                part->getIntensity(surface.normal, -q.ray.dir, lights,
+                                   &_ambient, NULL, NULL, texture));
+            if (depth == _tracing.max_depth) continue;
+
+            const Material& mat = part->getMaterial();
+            auto trans_refractive_index = part->getRefractiveIndex(surface);
+            const Color reflected_throughput = q.throughput.cwiseProduct(mat.Krg);
+            const Color refracted_throughput = q.throughput.cwiseProduct(mat.Ktg);
+            const PathSample sample{samples[q.sample].stream,
+                                    samples[q.sample].index, q.path};
+            float p_reflected, p_refracted;
+            branchProbabilities(mat, depth, reflected_throughput,
+                                trans_refractive_index.has_value(),
+                                refracted_throughput, sample, p_reflected,
+                                p_refracted);
+            const Ray normal(h.point, surface.normal, 1);
+            if (p_reflected > 0)
+                next.push_back({reflect_at(surface, q.ray, normal),
+                                reflected_throughput / p_reflected,
+                                q.refractive_index, q.sample, q.path * 2});
+            if (p_refracted > 0)
+                next.push_back({refract_at(surface, q.ray, normal,
+                                           q.refractive_index,
+                                           trans_refractive_index.value()),
+                                refracted_throughput / p_refracted,
+                                trans_refractive_index.value(), q.sample,
+                                q.path * 2 + 1});
+        }
+        std::swap(rays, next);
+    }
+}
+
+void RenderEngine::beginRender() {
+    TileScheduler scheduler(_img.width, _img.height, _tile_size);
+    _tiles = scheduler.tiles();
+    _tiles_x = scheduler.tilesX();
+    _tile_stats.assign(_tiles.size(), TileStat{0, 0, 0});
+    _tile_traversal_stats.assign(_tiles.size(), BVHTraversalStats());
+    _passes = 0;
+    if (!_pool || _pool->size() != _num_threads)
+        _pool = std::make_unique<ThreadPool>(_num_threads);
+}
+
+void RenderEngine::resolve() {
+    for (int i = 0; i < _img.width; i++)
+        for (int j = 0; j < _img.height; j++) _img.set(i, j, _accum.mean(i, j));
 }
 
 void RenderEngine::render() {
-    std::random_device
-        rd;  // Will be used to obtain a seed for the random number engine
-    std::mt19937 gen(
-        rd());  // Standard mersenne_twister_engine seeded with rd()
-    std::uniform_real_distribution<> dis(0.0, 1.0);
+    beginRender();
+    _accum.reset(_img.width, _img.height);
+    renderPass(0);
+    _passes = 1;
+    resolve();
+}
+
+int RenderEngine::renderProgressive(const ProgressiveConfig& cfg) {
+    beginRender();
+    int first_pass = 0;
+    if (cfg.resume && !cfg.checkpoint_path.empty()) {
+        auto info = _accum.load(cfg.checkpoint_path);
+        if (info) {
+            if (info.value().width != _img.width ||
+                info.value().height != _img.height ||
+                info.value().seed != _seed)
+                throw std::runtime_error(
+                    "checkpoint " + cfg.checkpoint_path +
+                    " was rendered with a different size or seed");
+            first_pass = info.value().passes;
+        }
+    }
+    if (first_pass == 0) _accum.reset(_img.width, _img.height);
+    _passes = first_pass;
+
+    auto checkpoint = [&]() {
+        resolve();
+        if (!cfg.image_path.empty()) writeImage(cfg.image_path);
+        if (!cfg.checkpoint_path.empty() &&
+            !_accum.save(cfg.checkpoint_path,
+                         CheckpointInfo{_img.width, _img.height, _seed, _passes}))
+            std::cerr << "WARNING: couldn't write checkpoint "
+                      << cfg.checkpoint_path << std::endl;
+    };
+    auto last_checkpoint = chrono::steady_clock::now();
+    for (int pass = first_pass; pass < cfg.passes; pass++) {
+        renderPass(pass);
+        _passes = pass + 1;
+        const double since =
+            chrono::duration<double>(chrono::steady_clock::now() - last_checkpoint)
+                .count();
+        if ((cfg.checkpoint_passes > 0 && _passes % cfg.checkpoint_passes == 0) ||
+            (cfg.checkpoint_seconds > 0 && since >= cfg.checkpoint_seconds)) {
+            checkpoint();
+            last_checkpoint = chrono::steady_clock::now();
+        }
+    }
+    checkpoint();
+    return _passes - first_pass;
+}
 
+void RenderEngine::renderPass(int pass) {
     const int width = _img.width;
     const int height = _img.height;
-    for (int i = 0; i < width; i++) {
-        for (int j = 0; j < height; j++) {
-            Color c(0, 0, 0);
-            for (int k = 0; k < this->num_sample; k++) {
-                float x = ((float)i + dis(gen)) / width;
-                float y = ((float)j + dis(gen)) / height;
-                // int i=350;
-                // int j=300;
-                // float x = ((float)i + 0.5f) / width;
-                // float y = ((float)j + 0.5f) / height;
-                Ray r = _cam.getRay(x, y).value();
-                // Ray r = _cam.getRay(0.5, 0.5).value();
-                // cout<<" ray:"<<r<<endl;
-                auto ret_el = trace(r, 1, 0);
-                c += ret_el.first;
-                // if(ret_el.second.size()>0){
-                //     cout<<i<<"  and  "<<j<<endl;
-                //     for(auto el: ret_el.second)
-                //         cout<<el.first<<" --> "<<el.second<<endl;
-                // }
-                // cout<<"final color: "<<c<<endl;
+    const std::vector<Tile>& tiles = _tiles;
+    const int num_sample = _sampling.min_samples;
+
+    _pool->parallelFor(tiles.size(), [&](int task, int worker) {
+        const Tile& tile = tiles[task];
+        auto start = chrono::steady_clock::now();
+        traversal_stats = BVHTraversalStats();
+
+        // sample k of pass p of a pixel is index p * min_samples + k of its
+        // stream, the passes continue the sequence of the sampler. Extra
+        // adaptive samples have a stream of their own
+        auto pixel_stream = [&](int i, int j) {
+            return (SampleStream)(j * width + i);
+        };
+        auto pixel_sample = [&](int i, int j, int k) -> PathSample {
+            return {pixel_stream(i, j), (uint32_t)(pass * num_sample + k), 1};
+        };
+        auto sampled_ray = [&](int i, int j, const PathSample& sample) {
+            float x = ((float)i + _sampler->get(sample.stream, sample.index, 0)) / width;
+            float y = ((float)j + _sampler->get(sample.stream, sample.index, 1)) / height;
+            return _cam.getRay(x, y).value();
+        };
+        auto camera_ray = [&](int i, int j, int k) {
+            return sampled_ray(i, j, pixel_sample(i, j, k));
+        };
+        const int tile_w = tile.x1 - tile.x0;
+        const int tile_h = tile.y1 - tile.y0;
+        std::vector<PixelAccum>& pixels = tile_pixels;
+        pixels.assign(tile_w * tile_h, PixelAccum{Color(0, 0, 0), 0, 0, 0});
+        auto pixel_at = [&](int i, int j) -> PixelAccum& {
+            return pixels[(i - tile.x0) * tile_h + (j - tile.y0)];
+        };
+
+        if (_wavefront) {
+            std::vector<Ray>& primary = tile_rays;
+            std::vector<PathSample>& samples = tile_samples;
+            primary.clear();
+            samples.clear();
+            for (int i = tile.x0; i < tile.x1; i++)
+                for (int j = tile.y0; j < tile.y1; j++)
+                    for (int k = 0; k < num_sample; k++) {
+                        samples.push_back(pixel_sample(i, j, k));
+                        primary.push_back(sampled_ray(i, j, samples.back()));
+                    }
+            traceWavefront(primary, samples, tile_colors);
+            int n = 0;
+            for (int i = tile.x0; i < tile.x1; i++)
+                for (int j = tile.y0; j < tile.y1; j++)
+                    for (int k = 0; k < num_sample; k++)
+                        pixel_at(i, j).add(tile_colors[n++]);
+        } else if (_packet_size > 1) {
+            // square-ish blocks of pixels: 2x2, 4x2 or 4x4
+            const int block_w = (_packet_size >= 8) ? 4 : 2;
+            const int block_h = _packet_size / block_w;
+            RayPacket packet;
+            PacketHits hits;
+            std::optional<Ray> rays[RayPacket::MAX_SIZE];
+            for (int k = 0; k < num_sample; k++) {
+                for (int bi = tile.x0; bi < tile.x1; bi += block_w) {
+                    for (int bj = tile.y0; bj < tile.y1; bj += block_h) {
+                        packet.size = 0;
+                        for (int i = bi; i < std::min(bi + block_w, tile.x1); i++) {
+                            for (int j = bj; j < std::min(bj + block_h, tile.y1); j++) {
+                                rays[packet.size].emplace(camera_ray(i, j, k));
+                                packet.push(rays[packet.size].value());
+                            }
+                        }
+                        packet.pad();
+                        intersect(packet, hits);
+                        int lane = 0;
+                        for (int i = bi; i < std::min(bi + block_w, tile.x1); i++) {
+                            for (int j = bj; j < std::min(bj + block_h, tile.y1); j++) {
+                                std::optional<SceneHit> hit;
+                                if (hits.model[lane])
+                                    hit = SceneHit{hits.model[lane],
+                                                   hits.hit[lane]};
+                                pixel_at(i, j).add(
+                                    shade(rays[lane].value(), 1, 0, hit,
+                                          pixel_sample(i, j, k)));
+                                lane++;
+                            }
+                        }
+                    }
+                }
+            }
+        } else {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    for (int k = 0; k < num_sample; k++) {
+                        const PathSample sample = pixel_sample(i, j, k);
+                        pixel_at(i, j).add(
+                            trace(sampled_ray(i, j, sample), 1, 0, sample));
+                    }
+                }
+            }
+        }
+
+        // extra samples where the estimate is still noisy, from the stream
+        // of branch 0 of the pixel, which no path uses
+        if (_sampling.isAdaptive()) {
+            const int num_extra = _sampling.max_samples - num_sample;
+            for (int i = tile.x0; i < tile.x1; i++) {
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    PixelAccum& px = pixel_at(i, j);
+                    while (px.n < _sampling.max_samples &&
+                           px.standardError() > _sampling.threshold) {
+                        const PathSample sample{
+                            substream(pixel_stream(i, j), 0),
+                            (uint32_t)(pass * num_extra + px.n - num_sample),
+                            1};
+                        px.add(trace(sampled_ray(i, j, sample), 1, 0, sample));
+                    }
+                }
+            }
+        }
+
+        // tiles don't overlap, so workers never add to the same pixel
+        for (int i = tile.x0; i < tile.x1; i++) {
+            for (int j = tile.y0; j < tile.y1; j++) {
+                const PixelAccum& px = pixel_at(i, j);
+                _accum.add(i, j, px.sum, px.n);
             }
-            c = c / this->num_sample;
-            _img.set(i, j, c);
         }
+
+        // summed over the passes of a progressive render
+        auto end = chrono::steady_clock::now();
+        _tile_stats[task].tile_id = tile.id;
+        _tile_stats[task].worker = worker;
+        _tile_stats[task].ms +=
+            chrono::duration<double, std::milli>(end - start).count();
+        _tile_traversal_stats[task].add(traversal_stats);
+    });
+}
+
+void RenderEngine::printTileStats(std::ostream& os) const {
+    if (_tile_stats.empty()) return;
+    double total = 0, min_ms = std::numeric_limits<double>::infinity(),
+           max_ms = 0;
+    std::vector<double> worker_ms(_num_threads, 0);
+    for (const auto& st : _tile_stats) {
+        total += st.ms;
+        min_ms = std::min(min_ms, st.ms);
+        max_ms = std::max(max_ms, st.ms);
+        worker_ms[st.worker] += st.ms;
+    }
+    const double mean = total / _tile_stats.size();
+    os << "Tiles: " << _tile_stats.size() << " (" << _tile_size << "px)"
+       << " threads: " << _num_threads << " min/mean/max ms: " << min_ms
+       << "/" << mean << "/" << max_ms << " imbalance(max/mean): "
+       << (mean > 0 ? max_ms / mean : 0) << endl;
+    os << "Per worker busy ms:";
+    for (auto ms : worker_ms) os << " " << ms;
+    os << endl;
+    // tile timings laid out like the image so expensive regions stand out
+    os << "Per tile ms:" << endl;
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    for (size_t t = 0; t < _tile_stats.size(); t++) {
+        os << std::setw(7) << std::fixed << std::setprecision(1)
+           << _tile_stats[t].ms;
+        if ((t + 1) % _tiles_x == 0) os << endl;
     }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void RenderEngine::printBVHStats(std::ostream& os) const {
+    os << _bvh << endl;
+    BVHTraversalStats total;
+    for (const auto& st : _tile_traversal_stats) total.add(st);
+    if (total.rays == 0) return;
+    os << "BVH traversal: rays: " << total.rays
+       << " nodes/ray: " << (double)total.nodes_visited / total.rays
+       << " primitives/ray: " << (double)total.primitives_tested / total.rays
+       << " (linear scan: " << _models.size() << ")" << endl;
+}
+
+long RenderEngine::getTotalSamples() const { return _accum.totalSamples(); }
+
+void RenderEngine::printSamplingStats(std::ostream& os) const {
+    if (_passes == 0) return;
+    const long total = getTotalSamples();
+    const long pixels = (long)_img.width * _img.height;
+    os << "Samples: " << total << " (" << (double)total / pixels
+       << " per pixel";
+    if (_passes > 1) os << " in " << _passes << " passes";
+    os << ", min " << _sampling.min_samples << " max "
+       << _sampling.max_samples;
+    if (_sampling.isAdaptive())
+        os << " threshold " << _sampling.threshold << ", "
+           << 100.0 * total / (pixels * _sampling.max_samples * _passes)
+           << "% of max for every pixel";
+    os << ")" << endl;
 }
 
 void RenderEngine::writeImage(const std::string& path) {
     std::ofstream ofs(path, std::ios::out | std::ios::binary);
-    _img.write(ofs);
+    if (!ofs) throw std::runtime_error("cannot write image " + path);
+    const std::string ext = std::filesystem::path(path).extension().string();
+    if (ext == ".pfm")
+        _img.writePFM(ofs);
+    else
+        _img.write(ofs, _tone_mapping);
+    if (!ofs) throw std::runtime_error("error writing image " + path);
 }
\ No newline at end of file
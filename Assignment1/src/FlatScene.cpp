@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cmath>
+#include "FlatScene.h"
+#include "utils.h"
+
+namespace {
+Point to_world(const Point& p, const Transformation& t) {
+    return apply_transformation(p, t, false, false, false);
+}
+Vector3f dir_to_world(const Vector3f& d, const Transformation& t) {
+    return apply_transformation(d, t, false, true, false);
+}
+Vector3f normal_to_world(const Vector3f& n, const Transformation& t) {
+    return apply_transformation(n, t, false, true, true).normalized();
+}
+
+// scale of a rotation and uniform scale, 0 for any other matrix
+float uniform_scale(const Matrix3f& m) {
+    const float s_sq = m.row(0).squaredNorm();
+    if (!(m * m.transpose()).isApprox(s_sq * Matrix3f::Identity(), 1e-5f))
+        return 0;
+    return std::sqrt(s_sq);
+}
+}  // namespace
+
+FlatScene::FlatScene(const std::vector<const Model*>& models,
+                     const std::vector<int>& order)
+    : _refs(models.size()) {
+    for (int id : order) _refs[id] = add(models[id]);
+}
+
+FlatScene::Ref FlatScene::add(const Model* m) {
+    const Transformation& t = m->trans;
+    if (auto s = dynamic_cast<const Sphere*>(m)) {
+        const float scale = t.is_identity ? 1 : uniform_scale(t.T_M_W);
+        if (scale > 0) {
+            const float radius = s->_radius * scale;
+            _spheres.push_back({to_world(s->_center, t), radius * radius,
+                                1 / radius, m});
+            return {SPHERE, (uint32_t)_spheres.size() - 1};
+        }
+    } else if (auto tri = dynamic_cast<const Triangle*>(m)) {
+        const Vector3f e1 = dir_to_world(tri->_e1, t),
+                       e2 = dir_to_world(tri->_e2, t);
+        _triangles.push_back({to_world(tri->_p1, t), e1, e2,
+                              normal_to_world(tri->_normal, t),
+                              (float)EPSILON * e1.cross(e2).norm(), m});
+        return {TRIANGLE, (uint32_t)_triangles.size() - 1};
+    } else if (auto p = dynamic_cast<const Plane*>(m)) {
+        _planes.push_back({to_world(p->_normal.src, t),
+                           normal_to_world(p->_normal.dir, t), m});
+        return {PLANE, (uint32_t)_planes.size() - 1};
+    } else if (auto q = dynamic_cast<const Quadric*>(m)) {
+        // the clip box is axis aligned in model space only
+        if (t.is_identity || !q->_clip.isFinite()) {
+            // p_model = p_world T_W_M + R_W_M, so the world matrix is
+            // H Q H^T for the homogeneous H of that map
+            const Matrix4f Q = q->matrix();
+            Matrix4f H = Matrix4f::Identity();
+            H.topLeftCorner<3, 3>() = t.T_W_M;
+            H.block<1, 3>(3, 0) = t.R_W_M;
+            const Matrix4f W = H * Q * H.transpose();
+            _quadrics.push_back({{W(0, 0), W(0, 1), W(0, 2), W(0, 3), W(1, 1),
+                                  W(1, 2), W(1, 3), W(2, 2), W(2, 3), W(3, 3)},
+                                 q->_clip,
+                                 m});
+            return {QUADRIC, (uint32_t)_quadrics.size() - 1};
+        }
+    }
+    _models.push_back(m);
+    return {MODEL, (uint32_t)_models.size() - 1};
+}
+
+int FlatScene::count(Type type) const {
+    switch (type) {
+        case SPHERE:
+            return _spheres.size();
+        case TRIANGLE:
+            return _triangles.size();
+        case PLANE:
+            return _planes.size();
+        case QUADRIC:
+            return _quadrics.size();
+        default:
+            return _models.size();
+    }
+}
@@ -1,4 +1,7 @@
 #include "Image.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <optional>
 #include <vector>
@@ -21,12 +24,74 @@ std::ostream& operator<<(std::ostream& os, const Image& img) {
     return os << "Image{width=" << img.width << ",height=" << img.height << "}";
 }
 
-std::ostream& Image::write(std::ostream& os) const {
+void Image::toneMap(const ToneMapping& tm, std::vector<unsigned char>& rgb) const {
+    static_assert(sizeof(Color) == 3 * sizeof(float), "Color must be packed");
+    const int n = 3 * width * height;
+    rgb.resize(n);
+    const float* in = _image.data()->data();
+    unsigned char* out = rgb.data();
+
+    // compressed values in [0,1], in chunks so the loops vectorize and the
+    // scratch stays in cache. std::min/max return their first argument when
+    // a comparison with NaN fails, so the bound goes first: NaN and inf/inf
+    // from an infinite channel become 0 or 1 and never index the table
+    // out of range
+    const int CHUNK = 4096;
+    float v[CHUNK];
+    const float exposure = tm.exposure;
+
+    // gamma encoding through a table instead of a pow per channel
+    const int LUT_SIZE = 4096;
+    unsigned char lut[LUT_SIZE];
+    const bool use_lut = (tm.gamma != 1.0f);
+    if (use_lut)
+        for (int k = 0; k < LUT_SIZE; k++)
+            lut[k] = (unsigned char)(std::pow(k / (float)(LUT_SIZE - 1), 1.0f / tm.gamma) * 255 + 0.5f);
+
+    for (int begin = 0; begin < n; begin += CHUNK) {
+        const int m = std::min(CHUNK, n - begin);
+        if (tm.op == ToneMap::REINHARD) {
+            for (int k = 0; k < m; k++) {
+                const float x = std::max(0.0f, in[begin + k] * exposure);
+                v[k] = std::min(1.0f, x / (1.0f + x));
+            }
+        } else {
+            for (int k = 0; k < m; k++)
+                v[k] = std::min(1.0f, std::max(0.0f, in[begin + k] * exposure));
+        }
+        if (use_lut) {
+            for (int k = 0; k < m; k++)
+                out[begin + k] = lut[(int)(v[k] * (LUT_SIZE - 1) + 0.5f)];
+        } else {
+            // truncating like the original writer, so default output is
+            // unchanged
+            for (int k = 0; k < m; k++) out[begin + k] = (unsigned char)(int)(v[k] * 255);
+        }
+    }
+}
+
+std::ostream& Image::write(std::ostream& os, const ToneMapping& tm) const {
+    std::vector<unsigned char> rgb;
+    toneMap(tm, rgb);
     os << "P6\n" << width << " " << height << "\n255\n";
-    for (int i = 0; i < width * height; ++i) {
-        os << (unsigned char)(std::min(float(1), _image[i][0]) * 255)
-           << (unsigned char)(std::min(float(1), _image[i][1]) * 255)
-           << (unsigned char)(std::min(float(1), _image[i][2]) * 255);
+    return os.write((const char*)rgb.data(), rgb.size());
+}
+
+std::ostream& Image::writePFM(std::ostream& os) const {
+    // the sign of the scale gives the byte order, rows go from the bottom up
+    const uint16_t probe = 1;
+    const bool little_endian = *(const unsigned char*)&probe == 1;
+    os << "PF\n" << width << " " << height << "\n"
+       << (little_endian ? "-1.0" : "1.0") << "\n";
+    std::vector<float> row(3 * width);
+    for (int j = height - 1; j >= 0; j--) {
+        const Color* src = &_image[j * width];
+        for (int i = 0; i < width; i++) {
+            row[3 * i] = src[i][0];
+            row[3 * i + 1] = src[i][1];
+            row[3 * i + 2] = src[i][2];
+        }
+        os.write((const char*)row.data(), row.size() * sizeof(float));
     }
     return os;
-}
\ No newline at end of file
+}
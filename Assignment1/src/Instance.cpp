@@ -0,0 +1,69 @@
+#include <iostream>
+#include <optional>
+#include "DS.h"
+#include "Models.h"
+#include "defs.h"
+#include "utils.h"
+
+// The space of the instance is the world of the geometry, every query goes
+// through the world space functions of the geometry which apply its own
+// transformation.
+
+Instance::Instance(std::shared_ptr<const Model> geometry,
+                   const Transformation& t)
+    : Model{geometry->mat_id, t}, _geometry{std::move(geometry)} {}
+
+std::optional<Hit> Instance::_intersect(const Ray& r) const {
+    auto hit = _geometry->intersect(r);
+    if (!hit) return {};
+    // the part shades the hit, the instance places it
+    hit.value().instance = this;
+    return hit;
+}
+
+bool Instance::_occluded(const Ray& r, float tmax) const {
+    return _geometry->occluded(r, tmax);
+}
+
+void Instance::_intersectPacket(const RayPacket& p, float* t,
+                                Hit* hits) const {
+    PacketHits geometry_hits;
+    geometry_hits.reset(p);
+    std::copy(t, t + p.size, geometry_hits.t);
+    _geometry->intersectPacket(p, geometry_hits);
+    for (int lane = 0; lane < p.size; lane++) {
+        if (!geometry_hits.model[lane]) continue;
+        t[lane] = geometry_hits.t[lane];
+        hits[lane] = geometry_hits.hit[lane];
+        hits[lane].instance = this;
+    }
+}
+
+AABB Instance::_getBounds() const { return _geometry->getBounds(); }
+
+std::optional<Color> Instance::_getTexture(const Point& p, const Hit& hit,
+                                           float footprint) const {
+    return _geometry->getTexture(p, hit, footprint);
+}
+
+Ray Instance::getReflected(const Model& part, const Ray& incident,
+                           const Ray& normal) const {
+    Ray reflected = part.getReflected(
+        apply_transformation(incident, this->trans, true, false),
+        apply_transformation(normal, this->trans, true, true));
+    return apply_transformation(reflected, this->trans, false, false);
+}
+
+Ray Instance::getRefracted(const Model& part, const Ray& incident,
+                           const Ray& normal, const float incident_ref_idx,
+                           const float transfer_ref_idx) const {
+    Ray refracted = part.getRefracted(
+        apply_transformation(incident, this->trans, true, false),
+        apply_transformation(normal, this->trans, true, true),
+        incident_ref_idx, transfer_ref_idx);
+    return apply_transformation(refracted, this->trans, false, false);
+}
+
+std::ostream& Instance::print(std::ostream& os) const {
+    return os << "Instance{geometry=" << *_geometry << "}";
+}
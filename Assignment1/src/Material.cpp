@@ -0,0 +1,79 @@
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include "Material.h"
+
+namespace {
+
+void hash_combine(size_t& seed, size_t v) {
+    seed ^= v + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+void hash_float(size_t& seed, float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    hash_combine(seed, bits);
+}
+
+size_t hash_material(const Material& m) {
+    size_t seed = 0;
+    for (const Vector3f* v : {&m.Ka, &m.Kd, &m.Ks, &m.Krg, &m.Ktg})
+        for (int k = 0; k < 3; k++) hash_float(seed, (*v)[k]);
+    hash_float(seed, m.refractive_index);
+    hash_float(seed, m.specular_coeff);
+    hash_combine(seed, m.texture);
+    hash_combine(seed, (size_t)m.sampler.filter);
+    hash_combine(seed, (size_t)m.sampler.wrap_u);
+    hash_combine(seed, (size_t)m.sampler.wrap_v);
+    hash_combine(seed, m.roulette);
+    return seed;
+}
+
+}  // namespace
+
+bool Material::operator==(const Material& o) const {
+    return Ka == o.Ka && Kd == o.Kd && Ks == o.Ks && Krg == o.Krg &&
+           Ktg == o.Ktg && refractive_index == o.refractive_index &&
+           specular_coeff == o.specular_coeff && texture == o.texture &&
+           sampler.filter == o.sampler.filter &&
+           sampler.wrap_u == o.sampler.wrap_u &&
+           sampler.wrap_v == o.sampler.wrap_v && roulette == o.roulette;
+}
+
+MaterialId MaterialTable::intern(const Material& m) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<MaterialId>& bucket = _by_hash[hash_material(m)];
+    for (MaterialId id : bucket)
+        if (_materials[id] == m) return id;
+    if ((int)_materials.size() == MAX_MATERIALS)
+        throw std::runtime_error("more than 65536 distinct materials");
+    _materials.push_back(m);
+    bucket.push_back(_materials.size() - 1);
+    return bucket.back();
+}
+
+void MaterialTable::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _materials.clear();
+    _by_hash.clear();
+}
+
+MaterialTable& material_table() {
+    static MaterialTable table;
+    return table;
+}
+
+std::shared_ptr<void> hold_scene_tables() {
+    static std::mutex mutex;
+    static std::weak_ptr<void> current;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<void> hold = current.lock();
+    if (!hold) {
+        hold = std::shared_ptr<void>(&material_table(), [](void*) {
+            texture_cache().clear();
+            material_table().clear();
+        });
+        current = hold;
+    }
+    return hold;
+}
@@ -9,13 +9,15 @@
 #include "defs.h"
 #include "utils.h"
 
-std::optional<float> Model::_getRefractiveIndex(Vector3f incident,
-                                                Vector3f normal) const {
-    if ((this->mat).refractive_index < 0) return {};
-    // if hit from inside the return refractive index as 1 for the outside
-    // world
-    return ((incident.dot(normal) < 0) ? ((this->mat).refractive_index) : 1.0);
+namespace {
+// normal of a model space hit in world space and the side the ray came from
+void finish_hit(Hit& h, const Transformation& trans, const Vector3f& dir) {
+    if (!trans.is_identity)
+        h.normal =
+            apply_transformation(h.normal, trans, false, true, true).normalized();
+    h.inside = h.normal.dot(dir) > 0;
 }
+}  // namespace
 
 Ray Model::_getReflected(const Ray& incident, const Ray& normal) const {
     const float angle = (normal.dir).dot(incident.dir);
@@ -68,14 +70,15 @@ Color Model::_getIntensity(const Vector3f& normal, const Vector3f& view,
 
     Color final_color(0, 0, 0);
 
-    Vector3f surface_property = (this->mat).Kd;
+    const Material& mat = getMaterial();
+    Vector3f surface_property = mat.Kd;
     if(texture) {
         surface_property = (surface_property)*0.5 + 0.5*texture.value();
     }
 
     // assert(lights.size()==1);
 
-    for (const auto pr : lights) {
+    for (const auto& pr : lights) {
         Color intensity = pr.first;
         Vector3f incident = pr.second;
         float cos_theta = incident.dot(normal_corr);
@@ -88,70 +91,126 @@ Color Model::_getIntensity(const Vector3f& normal, const Vector3f& view,
         final_color += (surface_property).cwiseProduct(intensity) * cos_theta;
         float cos_alpha = reflected.dot(view_corr);
         if (cos_alpha > 0) {
-            final_color += ((this->mat).Ks).cwiseProduct(intensity) *
-                           pow(cos_alpha, (this->mat).specular_coeff);
+            final_color += (mat.Ks).cwiseProduct(intensity) *
+                           pow(cos_alpha, mat.specular_coeff);
         }
     }
 
     if (ambient) {
-        final_color += ((this->mat).Ka).cwiseProduct(*ambient);
+        final_color += (mat.Ka).cwiseProduct(*ambient);
     }
 
     if (reflected) {
-        final_color += ((this->mat).Krg).cwiseProduct(*reflected);
+        final_color += (mat.Krg).cwiseProduct(*reflected);
     }
 
     if (refracted) {
-        final_color += ((this->mat).Ktg).cwiseProduct(*refracted);
+        final_color += (mat.Ktg).cwiseProduct(*refracted);
     }
 
     return final_color;
 }
 
-std::optional<Color> Model::_getTexture(const Point& p) const {
+std::optional<Color> Model::_getTexture(const Point& /*p*/,
+                                        const Hit& /*hit*/,
+                                        float /*footprint*/) const {
     return {};
 }
 
-std::optional<float> Model::getRefractiveIndex(Vector3f incident,
-                                               Vector3f normal) const {
-    Vector3f transformed_incident =
-        apply_transformation(incident, this->trans, true, true, false);
-    Vector3f transformed_normal =
-        apply_transformation(normal, this->trans, true, true, true);
-    return this->_getRefractiveIndex(transformed_incident, transformed_normal);
+std::optional<float> Model::getRefractiveIndex(const Hit& hit) const {
+    const Material& mat = getMaterial();
+    if (mat.refractive_index < 0) return {};
+    // leaving the model into the outside world
+    return hit.inside ? 1.0f : mat.refractive_index;
 }
 
-std::optional<std::pair<float, const Model*>>
-Model::getIntersectionLengthAndPart(const Ray& r) const {
+std::optional<Hit> Model::intersect(const Ray& r) const {
     Ray transformed_ray = apply_transformation(r, this->trans, true, false);
-    // std::cout<<r<<"  and transformed ray is "<<transformed_ray<<std::endl;
-    auto el = this->_getIntersectionLengthAndPart(transformed_ray);
-    if (!el) return {};
-
-    Vector3f original_pt =
-        transformed_ray.src + el.value().first * transformed_ray.dir;
-    Vector3f world_point =
-        apply_transformation(original_pt, this->trans, false, false, false);
-    float dist = (r.src - world_point).norm();
+    auto hit = this->_intersect(transformed_ray);
+    if (!hit) return {};
+    Hit& h = hit.value();
+    // distances are the same in both spaces
+    if (!this->trans.is_identity && !this->trans.is_rigid) {
+        Vector3f original_pt = transformed_ray.src + h.t * transformed_ray.dir;
+        Vector3f world_point =
+            apply_transformation(original_pt, this->trans, false, false, false);
+        h.t = (r.src - world_point).norm();
+    }
+    finish_hit(h, this->trans, r.dir);
+    return hit;
+}
 
-    return std::make_pair(dist, el.value().second);
+bool Model::_occluded(const Ray& r, float tmax) const {
+    auto hit = this->_intersect(r);
+    return hit && hit.value().t < tmax;
 }
 
-std::optional<Ray> Model::getNormal(const Point& p) const {
-    Vector3f transformed_point =
-        apply_transformation(p, this->trans, true, false, false);
+bool Model::occluded(const Ray& r, float tmax) const {
+    Ray transformed_ray = apply_transformation(r, this->trans, true, false);
+    // distances along the ray scale by the stretch of its direction, so tmax
+    // is converted once instead of transforming the hit point back
+    if (this->trans.is_identity || this->trans.is_rigid)
+        return this->_occluded(transformed_ray, tmax);
+    float scale = (r.length > 0)
+                      ? transformed_ray.length / r.length
+                      : apply_transformation(r.dir, this->trans, true, true,
+                                             false).norm();
+    return this->_occluded(transformed_ray, tmax * scale);
+}
 
-    auto returned_ray = this->_getNormal(transformed_point);
-    if (!returned_ray) return {};
+void Model::_intersectPacket(const RayPacket& p, float* t, Hit* hits) const {
+    for (int lane = 0; lane < p.size; lane++) {
+        auto hit = this->_intersect(p.ray(lane));
+        if (!hit || hit.value().t >= t[lane]) continue;
+        t[lane] = hit.value().t;
+        hits[lane] = hit.value();
+    }
+}
 
-    Ray r = returned_ray.value();
-    return apply_transformation(r, this->trans, false, true);
-};
-bool Model::isOnSurface(const Point& p) const {
-    Vector3f transformed_point =
-        apply_transformation(p, this->trans, true, false, false);
-    return this->_isOnSurface(transformed_point);
-};
+void Model::intersectPacket(const RayPacket& p, PacketHits& hits) const {
+    // bounds in model space, the closer hits are written straight into hits
+    alignas(64) float tmax[RayPacket::MAX_SIZE];
+    alignas(64) float t[RayPacket::MAX_SIZE];
+    float scale[RayPacket::MAX_SIZE];
+    if (this->trans.is_identity) {
+        for (int lane = 0; lane < p.size; lane++) tmax[lane] = hits.t[lane];
+        std::copy(tmax, tmax + p.size, t);
+        this->_intersectPacket(p, t, hits.hit);
+    } else {
+        RayPacket transformed;
+        transformPacket(p, this->trans, transformed, scale);
+        for (int lane = 0; lane < p.size; lane++)
+            tmax[lane] = hits.t[lane] * scale[lane];
+        std::copy(tmax, tmax + p.size, t);
+        this->_intersectPacket(transformed, t, hits.hit);
+    }
+    for (int lane = 0; lane < p.size; lane++) {
+        if (!(t[lane] < tmax[lane])) continue;
+        Hit& h = hits.hit[lane];
+        h.t = this->trans.is_identity ? t[lane] : t[lane] / scale[lane];
+        finish_hit(h, this->trans,
+                   Vector3f(p.dx[lane], p.dy[lane], p.dz[lane]));
+        hits.t[lane] = h.t;
+        hits.model[lane] = this;
+    }
+}
+AABB Model::getBounds() const {
+    AABB b = this->_getBounds();
+    if (!b.isFinite() || b.isEmpty()) return b;
+    AABB world;
+    for (int c = 0; c < 8; c++) {
+        Vector3f corner((c & 1) ? b.max[0] : b.min[0],
+                        (c & 2) ? b.max[1] : b.min[1],
+                        (c & 4) ? b.max[2] : b.min[2]);
+        world.expand(
+            apply_transformation(corner, this->trans, false, false, false));
+    }
+    // padding so that flat models (triangles, polygons) are not missed due to
+    // rounding in the slab test
+    world.min -= Vector3f::Constant(EPSILON);
+    world.max += Vector3f::Constant(EPSILON);
+    return world;
+}
 
 Ray Model::getReflected(const Ray& incident, const Ray& normal) const {
     Ray transformed_incident =
@@ -180,22 +239,18 @@ Color Model::getIntensity(const Vector3f& normal, const Vector3f& view,
                           const std::vector<std::pair<Color, Vector3f>>& lights,
                           const Color* ambient, const Color* reflected,
                           const Color* refracted, std::optional<Color> texture) const {
-    Vector3f transformed_normal =
-        apply_transformation(normal, this->trans, true, true, true);
-    Vector3f transformed_view =
-        apply_transformation(view, this->trans, true, true, false);
-
-    std::vector<std::pair<Color, Vector3f>> transformed_lights;
-    for (auto el : lights) {
-        Vector3f transformed_light_dir =
-            apply_transformation(el.second, this->trans, true, true, true);
-        transformed_lights.push_back({el.first, transformed_light_dir});
-    }
-
-    return this->_getIntensity(transformed_normal, transformed_view,
-                               transformed_lights, ambient, reflected,
-                               refracted,texture);
+    // shaded in world space: a rigid transform keeps every angle, and after
+    // a scale the model space vectors are no longer unit length
+    return this->_getIntensity(normal, view, lights, ambient, reflected,
+                               refracted, texture);
 }
-std::optional<Color> Model::getTexture(const Point& p) const {
-    return this->_getTexture(apply_transformation(p,this->trans,true, false,false));
+std::optional<Color> Model::getTexture(const Point& p, const Hit& hit,
+                                       float footprint) const {
+    if (!getMaterial().hasTexture()) return {};
+    if (!trans.is_rigid) {
+        // average scale of the world to model mapping
+        footprint *= std::cbrt(std::abs(trans.T_W_M.determinant()));
+    }
+    return this->_getTexture(apply_transformation(p,this->trans,true, false,false),
+                             hit, footprint);
 }
\ No newline at end of file
@@ -25,7 +25,7 @@ namespace ogl {
         
     void Lights::configureLights(Shader shader) const {
         shader.setInt("num_point_lights", positions.size());
-        for(int idx=0;idx<positions.size();idx++) {
+        for(size_t idx=0;idx<positions.size();idx++) {
             shader.setVec3("pointLights["+std::to_string(idx)+"].position", positions[idx]);
             shader.setVec3("pointLights["+std::to_string(idx)+"].ambient", intensities[idx]*(0.1f));
             shader.setVec3("pointLights["+std::to_string(idx)+"].intensity",  intensities[idx]);
@@ -33,7 +33,7 @@ namespace ogl {
     }
 
     void Lights::DrawLights(Shader shader) const {
-        for(int idx=0;idx<positions.size();idx++) {
+        for(size_t idx=0;idx<positions.size();idx++) {
             shader.setMat4("model",transformationMatrices[idx]);
             shader.setVec3("intensity",intensities[idx]);
             lightModel.Draw(shader);
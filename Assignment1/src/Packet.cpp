@@ -0,0 +1,201 @@
+#include "Packet.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "PacketKernels.h"
+
+namespace {
+const float INF = std::numeric_limits<float>::infinity();
+
+simd::Isa detect_isa() {
+#if defined(RAY_TRACER_AVX2_KERNELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return simd::Isa::AVX2;
+#endif
+#if defined(__SSE2__)
+    return simd::Isa::SSE;
+#else
+    return simd::Isa::SCALAR;
+#endif
+}
+}  // namespace
+
+namespace simd {
+
+Isa isa() {
+    static const Isa detected = detect_isa();
+    return detected;
+}
+
+const char* isaName() {
+    switch (isa()) {
+        case Isa::AVX2:
+            return "AVX2";
+        case Isa::SSE:
+            return "SSE";
+        default:
+            return "scalar";
+    }
+}
+
+}  // namespace simd
+
+void RayPacket::pad() {
+    if (size == 0) return;
+    for (int lane = size; lane < MAX_SIZE; lane++) {
+        ox[lane] = ox[size - 1];
+        oy[lane] = oy[size - 1];
+        oz[lane] = oz[size - 1];
+        dx[lane] = dx[size - 1];
+        dy[lane] = dy[size - 1];
+        dz[lane] = dz[size - 1];
+    }
+}
+
+void PacketHits::reset(const RayPacket& p) {
+    for (int lane = 0; lane < RayPacket::MAX_SIZE; lane++) {
+        t[lane] = (lane < p.size) ? INF : -1;
+        model[lane] = NULL;
+        hit[lane].instance = NULL;
+    }
+}
+
+void transformPacket(const RayPacket& p, const Transformation& trans,
+                     RayPacket& out, float* scale) {
+    const Matrix3f& M = trans.T_W_M;
+    const Vector3f& R = trans.R_W_M;
+    out.size = p.size;
+    for (int lane = 0; lane < RayPacket::MAX_SIZE; lane++) {
+        // row vector convention: p' = p * M + R
+        out.ox[lane] = p.ox[lane] * M(0, 0) + p.oy[lane] * M(1, 0) +
+                       p.oz[lane] * M(2, 0) + R[0];
+        out.oy[lane] = p.ox[lane] * M(0, 1) + p.oy[lane] * M(1, 1) +
+                       p.oz[lane] * M(2, 1) + R[1];
+        out.oz[lane] = p.ox[lane] * M(0, 2) + p.oy[lane] * M(1, 2) +
+                       p.oz[lane] * M(2, 2) + R[2];
+        float dx = p.dx[lane] * M(0, 0) + p.dy[lane] * M(1, 0) +
+                   p.dz[lane] * M(2, 0);
+        float dy = p.dx[lane] * M(0, 1) + p.dy[lane] * M(1, 1) +
+                   p.dz[lane] * M(2, 1);
+        float dz = p.dx[lane] * M(0, 2) + p.dy[lane] * M(1, 2) +
+                   p.dz[lane] * M(2, 2);
+        float len = std::sqrt(dx * dx + dy * dy + dz * dz);
+        scale[lane] = len;
+        out.dx[lane] = dx / len;
+        out.dy[lane] = dy / len;
+        out.dz[lane] = dz / len;
+    }
+}
+
+bool packetIntersectsBox(const AABB& b, const RayPacket& p,
+                         const float* inv_dx, const float* inv_dy,
+                         const float* inv_dz, const float* tmax) {
+    switch (simd::isa()) {
+#if defined(RAY_TRACER_AVX2_KERNELS)
+        case simd::Isa::AVX2:
+            return kernels::boxAvx2(b.min.data(), b.max.data(), p, inv_dx,
+                                    inv_dy, inv_dz, tmax);
+#endif
+#if defined(__SSE2__)
+        case simd::Isa::SSE:
+            return kernels::box<simd::vfloat4>(b.min.data(), b.max.data(), p,
+                                               inv_dx, inv_dy, inv_dz, tmax);
+#endif
+        default:
+            return kernels::box<simd::vfloat1>(b.min.data(), b.max.data(), p,
+                                               inv_dx, inv_dy, inv_dz, tmax);
+    }
+}
+
+void sphereKernel(const RayPacket& p, const Point& center, float radius_sq,
+                  float* t) {
+    switch (simd::isa()) {
+#if defined(RAY_TRACER_AVX2_KERNELS)
+        case simd::Isa::AVX2:
+            return kernels::sphereAvx2(p, center.data(), radius_sq, t);
+#endif
+#if defined(__SSE2__)
+        case simd::Isa::SSE:
+            return kernels::sphere<simd::vfloat4>(p, center.data(), radius_sq,
+                                                  t);
+#endif
+        default:
+            return kernels::sphere<simd::vfloat1>(p, center.data(), radius_sq,
+                                                  t);
+    }
+}
+
+void triangleKernel(const RayPacket& p, const Point& p1, const Vector3f& e1,
+                    const Vector3f& e2, float det_eps, float* t, float* u,
+                    float* v) {
+    switch (simd::isa()) {
+#if defined(RAY_TRACER_AVX2_KERNELS)
+        case simd::Isa::AVX2:
+            return kernels::triangleAvx2(p, p1.data(), e1.data(), e2.data(),
+                                         det_eps, t, u, v);
+#endif
+#if defined(__SSE2__)
+        case simd::Isa::SSE:
+            return kernels::triangle<simd::vfloat4>(
+                p, p1.data(), e1.data(), e2.data(), det_eps, t, u, v);
+#endif
+        default:
+            return kernels::triangle<simd::vfloat1>(
+                p, p1.data(), e1.data(), e2.data(), det_eps, t, u, v);
+    }
+}
+
+void quadricKernel(const RayPacket& p, const float* q, const AABB& clip,
+                   float* t) {
+    switch (simd::isa()) {
+#if defined(RAY_TRACER_AVX2_KERNELS)
+        case simd::Isa::AVX2:
+            return kernels::quadricAvx2(p, q, clip.min.data(), clip.max.data(),
+                                        t);
+#endif
+#if defined(__SSE2__)
+        case simd::Isa::SSE:
+            return kernels::quadric<simd::vfloat4>(p, q, clip.min.data(),
+                                                   clip.max.data(), t);
+#endif
+        default:
+            return kernels::quadric<simd::vfloat1>(p, q, clip.min.data(),
+                                                   clip.max.data(), t);
+    }
+}
+
+std::optional<float> quadricDistance(const Ray& r, const float* q,
+                                     const AABB& clip) {
+    const float A = q[0], B = q[1], C = q[2], D = q[3], E = q[4], F = q[5],
+                G = q[6], H = q[7], I = q[8], J = q[9];
+    const float ox = r.src[0], oy = r.src[1], oz = r.src[2];
+    const float dx = r.dir[0], dy = r.dir[1], dz = r.dir[2];
+    const float mo0 = A * ox + B * oy + C * oz + D;
+    const float mo1 = B * ox + E * oy + F * oz + G;
+    const float mo2 = C * ox + F * oy + H * oz + I;
+    const float mo3 = D * ox + G * oy + I * oz + J;
+    const float md0 = A * dx + B * dy + C * dz;
+    const float md1 = B * dx + E * dy + F * dz;
+    const float md2 = C * dx + F * dy + H * dz;
+    const float a = dx * md0 + dy * md1 + dz * md2;
+    const float b = 2 * (dx * mo0 + dy * mo1 + dz * mo2);
+    const float c = ox * mo0 + oy * mo1 + oz * mo2 + mo3;
+
+    float lo, hi;
+    if (fabs(a) < 1e-12f) {
+        if (b == 0) return {};
+        lo = hi = -c / b;
+    } else {
+        const float disc = b * b - 4 * a * c;
+        if (disc < 0) return {};
+        const float sq = std::sqrt(disc);
+        const float x1 = (-b - sq) * 0.5f / a, x2 = (-b + sq) * 0.5f / a;
+        lo = std::min(x1, x2);
+        hi = std::max(x1, x2);
+    }
+    // the near root may be behind the ray or clipped away
+    for (float d : {lo, hi})
+        if (d >= 0 && clip.contains(r.src + d * r.dir, 0)) return d;
+    return {};
+}
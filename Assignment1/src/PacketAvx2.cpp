@@ -0,0 +1,33 @@
+// Compiled with -mavx2 -mfma (see CMakeLists.txt), nothing in here may run
+// before simd::isa() has confirmed the CPU supports both
+#include "PacketKernels.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+namespace kernels {
+
+bool boxAvx2(const float* bmin, const float* bmax, const RayPacket& p,
+             const float* inv_dx, const float* inv_dy, const float* inv_dz,
+             const float* tmax) {
+    return box<simd::vfloat8>(bmin, bmax, p, inv_dx, inv_dy, inv_dz, tmax);
+}
+
+void sphereAvx2(const RayPacket& p, const float* center, float radius_sq,
+                float* t) {
+    sphere<simd::vfloat8>(p, center, radius_sq, t);
+}
+
+void triangleAvx2(const RayPacket& p, const float* p1, const float* e1,
+                  const float* e2, float det_eps, float* t, float* u,
+                  float* v) {
+    triangle<simd::vfloat8>(p, p1, e1, e2, det_eps, t, u, v);
+}
+
+void quadricAvx2(const RayPacket& p, const float* q, const float* clip_min,
+                 const float* clip_max, float* t) {
+    quadric<simd::vfloat8>(p, q, clip_min, clip_max, t);
+}
+
+}  // namespace kernels
+
+#endif
@@ -4,22 +4,30 @@
 #include "Models.h"
 #include "defs.h"
 
-std::optional<std::pair<float, const Model*>> Plane::_getIntersectionLengthAndPart(const Ray& r) const {
+std::optional<Hit> Plane::_intersect(const Ray& r) const {
     float cos_theta = r.dir.dot(_normal.dir);
     if (fabs(cos_theta) <= EPSILON) return {};  // not intersecting case
     float t = ((_normal.src - r.src).dot(_normal.dir)) / cos_theta;
     if (t < 0) return {};
-    return std::make_pair(t, this);
+    Hit h;
+    h.t = t;
+    h.part = this;
+    h.normal = _normal.dir;
+    return h;
 }
 
-bool Plane::_isOnSurface(const Point& p) const {
+bool Plane::_occluded(const Ray& r, float tmax) const {
+    float cos_theta = r.dir.dot(_normal.dir);
+    if (fabs(cos_theta) <= EPSILON) return false;
+    float t = ((_normal.src - r.src).dot(_normal.dir)) / cos_theta;
+    return t >= 0 && t < tmax;
+}
+
+bool Plane::contains(const Point& p) const {
     return (fabs((_normal.src - p).dot(_normal.dir)) <= EPSILON);
 }
 
-std::optional<Ray> Plane::_getNormal(const Point& p) const {
-    if (!_isOnSurface(p)) return {};
-    return Ray(p, _normal.dir);
-};
+AABB Plane::_getBounds() const { return AABB::infinite(); }
 
 std::ostream& Plane::print(std::ostream& os) const {
     return os << "Plane{normal=" << _normal << "}";
@@ -1,22 +1,22 @@
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <optional>
 #include "DS.h"
 #include "Models.h"
 #include "defs.h"
 
-Polygon::Polygon(const std::vector<Point>& points, const Material& mat, const Transformation& t)
-    : Model{mat,t}, _plane{NULL} {
+Polygon::Polygon(const std::vector<Point>& points, MaterialId mat, const Transformation& t)
+    : Model{mat,t} {
     assert(points.size() > 2);
+    _normal = (points[1] - points[0]).cross(points[2] - points[0]).normalized();
+    _offset = _normal.dot(points[0]);
     _points.push_back(points[0]);
     _points.push_back(points[1]);
     _points.push_back(points[2]);
-    _plane =
-        new Plane(Ray(_points[0],
-                      (_points[0] - _points[1]).cross(_points[0] - _points[2])),
-                  mat,t);  // src as centroid
     std::vector<Point> rejected_points;
-    for (int i = 3; i < points.size(); i++) {
-        if (!(_plane->_isOnSurface(points[i])))
+    for (size_t i = 3; i < points.size(); i++) {
+        if (fabs(_normal.dot(points[i]) - _offset) > EPSILON)
             rejected_points.push_back(points[i]);
         else
             _points.push_back(points[i]);
@@ -27,81 +27,74 @@ Polygon::Polygon(const std::vector<Point>& points, const Material& mat, const Tr
                   << rejected_points.size() << " rejected for not in plane!"
                   << std::endl;
     }
-}
-
-bool Polygon::_isOnSurface(const Point& p) const {
-    // std::cout<<"Checking for Point: "<<p<<std::endl;
-
-    if (!_plane || !(_plane->_isOnSurface(p))) return false;
-    // std::cout<<"Point is in plane "<<(*_plane)<<std::endl;
 
-    Point other_p = (_points[0] + _points[1]) / 2;
-    if ((other_p - p).norm() <= EPSILON) {
-        // choose some other point, this one is too close
-        other_p = (_points[1] + _points[2]) / 2;
+    // drop the axis the normal is closest to, the projection to the other
+    // two keeps the polygon as large as possible
+    int axis;
+    _normal.cwiseAbs().maxCoeff(&axis);
+    _u = (axis + 1) % 3;
+    _v = (axis + 2) % 3;
+    _min_u = _min_v = std::numeric_limits<float>::infinity();
+    _max_u = _max_v = -std::numeric_limits<float>::infinity();
+    for (size_t i = 0; i + 1 < _points.size(); i++) {
+        const Point& a = _points[i];
+        const Point& b = _points[i + 1];
+        const float dv = b[_v] - a[_v];
+        // an edge along u is never crossed, its slope is not used
+        _edge_u.push_back(a[_u]);
+        _edge_v.push_back(a[_v]);
+        _edge_v_next.push_back(b[_v]);
+        _edge_slope.push_back(dv != 0 ? (b[_u] - a[_u]) / dv : 0.0f);
+        _min_u = std::min(_min_u, a[_u]);
+        _max_u = std::max(_max_u, a[_u]);
+        _min_v = std::min(_min_v, a[_v]);
+        _max_v = std::max(_max_v, a[_v]);
     }
+}
 
-    Vector3f d = (p - other_p).normalized();
-    Vector3f n = (d.cross((_plane->_getNormal(p)).value().dir)).normalized();
-
-    // std::cout<<"Other_p "<<(other_p)<<std::endl;
-    // std::cout<<"d "<<(d)<<std::endl;
-    // std::cout<<"n "<<(n)<<std::endl;
-
-    int num_intersections = 0;
-    for (int i = 0; i < _points.size() - 1; i++) {
-        Point x = _points[i];
-        Point y = _points[i + 1];
-
-        // std::cout<<"--------------------------"<<std::endl;
-        // std::cout<<"x "<<(x)<<std::endl;
-        // std::cout<<"y "<<(y)<<std::endl;
-
-        float num = (p - y).dot(n);
-        float denom = (x - y).dot(n);
-        // if(fabs(denom)<=EPSILON) continue; // ray is almost parallel // TODO:
-        // CHECK THIS OKAY?
-        float t = num / denom;
-
-        if (t <= 0 || t >= 1) continue;
-
-        // std::cout<<"num "<<(num)<<std::endl;
-        // std::cout<<"denom "<<(denom)<<std::endl;
-        // std::cout<<"t "<<(t)<<std::endl;
-
-        Point intersect_point = x * t + (1 - t) * y;
-        float cos_theta = (intersect_point - p).dot(d);
-        // std::cout<<"intersect_point "<<(intersect_point)<<std::endl;
-        // std::cout<<"cos_theta "<<(cos_theta)<<std::endl;
-
-        if (cos_theta < 0) continue;  // opposite to ray direction
-
-        num_intersections++;
-    }
-    // std::cout<<"num_intersections "<<(num_intersections)<<std::endl;
+bool Polygon::contains(float u, float v) const {
+    if (u < _min_u || u > _max_u || v < _min_v || v > _max_v) return false;
+    // even-odd rule on a ray from (u, v) towards +u, an edge counts if it
+    // straddles v and crosses it right of u. Corners on the line count for
+    // the edge above it only, so they are never counted twice.
+    const int n = _edge_u.size();
+    int crossings = 0;
+    for (int i = 0; i < n; i++)
+        crossings += ((_edge_v[i] > v) != (_edge_v_next[i] > v)) &
+                     (u < _edge_u[i] + (v - _edge_v[i]) * _edge_slope[i]);
+    return crossings & 1;
+}
 
-    return ((num_intersections % 2) == 1);
+std::optional<Hit> Polygon::_intersect(const Ray& r) const {
+    float cos_theta = r.dir.dot(_normal);
+    if (fabs(cos_theta) <= EPSILON) return {};  // parallel to the plane
+    float t = (_offset - r.src.dot(_normal)) / cos_theta;
+    if (t < 0) return {};
+    Point p = r.src + t * r.dir;
+    if (!contains(p[_u], p[_v])) return {};
+    Hit h;
+    h.t = t;
+    h.part = this;
+    h.normal = _normal;
+    return h;
 }
 
-std::optional<std::pair<float, const Model*>>
-Polygon::_getIntersectionLengthAndPart(const Ray& r) const {
-    if (!_plane) return {};
-    auto intersection_part = _plane->_getIntersectionLengthAndPart(r);
-    if (!intersection_part) return {};
-    Point interp = r.src + intersection_part.value().first * r.dir;
-    if (_isOnSurface(interp)) return intersection_part;
-    return {};
+bool Polygon::_occluded(const Ray& r, float tmax) const {
+    float cos_theta = r.dir.dot(_normal);
+    if (fabs(cos_theta) <= EPSILON) return false;
+    float t = (_offset - r.src.dot(_normal)) / cos_theta;
+    if (t < 0 || t >= tmax) return false;
+    Point p = r.src + t * r.dir;
+    return contains(p[_u], p[_v]);
 }
 
-std::optional<Ray> Polygon::_getNormal(const Point& p) const {
-    if (!_isOnSurface(p)) return {};
-    return _plane->_getNormal(p);
+AABB Polygon::_getBounds() const {
+    AABB b;
+    for (const auto& p : _points) b.expand(p);
+    return b;
 }
 
 std::ostream& Polygon::print(std::ostream& os) const {
-    os << "Polygon{NumPoints=" << _points.size() << ",plane:";
-    if (!_plane) {
-        return os << "NULL}";
-    }
-    return os << (*_plane) << "}";
-}
\ No newline at end of file
+    return os << "Polygon{NumPoints=" << _points.size()
+              << ",normal=" << _normal << "}";
+}
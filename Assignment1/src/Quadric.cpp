@@ -1,39 +1,55 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <optional>
 #include "DS.h"
 #include "Models.h"
 #include "defs.h"
-#include "utils.h"
 
-std::optional<std::pair<float, const Model*>>
-Quadric::_getIntersectionLengthAndPart(const Ray& r) const {
-    auto Ro = augment(r.src, 1.0);
-    auto Rd = augment(r.dir, 0.0);
-    float Aq = Rd * M * (Rd.transpose());
-    float Bq = Rd * M * (Ro.transpose());
-    Bq += Ro * M * (Rd.transpose());
-    float Cq = Ro * M * (Ro.transpose());
-    auto inters = solve_quadratic(Aq, Bq, Cq);
-    if (!inters) return {};
-    auto min_pos_dist = (inters.value().first < 0) ? (inters.value().second)
-                                                   : (inters.value().first);
-    if (min_pos_dist < 0) return {};
-    return std::make_pair(min_pos_dist, this);
+Hit Quadric::hitAt(const Point& p, float t) const {
+    float nx = 2.0 * (_q[0] * p[0] + _q[1] * p[1] + _q[2] * p[2] + _q[3]);
+    float ny = 2.0 * (_q[1] * p[0] + _q[4] * p[1] + _q[5] * p[2] + _q[6]);
+    float nz = 2.0 * (_q[2] * p[0] + _q[5] * p[1] + _q[7] * p[2] + _q[8]);
+    Hit h;
+    h.t = t;
+    h.part = this;
+    h.normal = Vector3f(nx, ny, nz).normalized();
+    return h;
 }
 
-bool Quadric::_isOnSurface(const Point& p) const {
-    float val = augment(p, 1.0) * M * (augment(p, 1.0).transpose());
-    return (abs(val) <= 10 * EPSILON);
+std::optional<Hit> Quadric::_intersect(const Ray& r) const {
+    auto d = quadricDistance(r, _q, _clip);
+    if (!d) return {};
+    return hitAt(r.src + d.value() * r.dir, d.value());
 }
 
-std::optional<Ray> Quadric::_getNormal(const Point& p) const {
-    if (!_isOnSurface(p)) return {};
-    float nx = 2.0 * (_qp.A * p[0] + _qp.B * p[1] + _qp.C * p[2] + _qp.D);
-    float ny = 2.0 * (_qp.B * p[0] + _qp.E * p[1] + _qp.F * p[2] + _qp.G);
-    float nz = 2.0 * (_qp.C * p[0] + _qp.F * p[1] + _qp.H * p[2] + _qp.I);
-    return Ray(p, Vector3f(nx, ny, nz));
+bool Quadric::_occluded(const Ray& r, float tmax) const {
+    auto d = quadricDistance(r, _q, _clip);
+    return d && d.value() < tmax;
+}
+
+void Quadric::_intersectPacket(const RayPacket& p, float* t,
+                               Hit* hits) const {
+    alignas(64) float dist[RayPacket::MAX_SIZE];
+    quadricKernel(p, _q, _clip, dist);
+    for (int lane = 0; lane < p.size; lane++) {
+        if (dist[lane] >= t[lane]) continue;
+        t[lane] = dist[lane];
+        hits[lane] = hitAt(packetPoint(p, lane, dist[lane]), dist[lane]);
+    }
+}
+
+AABB Quadric::_getBounds() const { return _clip; }
+
+Matrix4f Quadric::matrix() const {
+    Matrix4f M;
+    M << _q[0], _q[1], _q[2], _q[3], _q[1], _q[4], _q[5], _q[6], _q[2], _q[5],
+        _q[7], _q[8], _q[3], _q[6], _q[8], _q[9];
+    return M;
 }
 
 std::ostream& Quadric::print(std::ostream& os) const {
-    return os << "Quadric{Matrix=" << std::endl << M << std::endl << "}";
+    os << "Quadric{Matrix=" << std::endl << matrix();
+    if (_clip.isFinite()) os << ",clip=" << _clip;
+    return os << std::endl << "}";
 }
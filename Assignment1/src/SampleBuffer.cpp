@@ -0,0 +1,99 @@
+#include "SampleBuffer.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+const char MAGIC[4] = {'R', 'T', 'C', 'K'};
+const uint32_t VERSION = 1;
+
+// fixed size header, the pixels follow as width*height records of three
+// floats (color sum) and one int32 (sample count)
+struct Header {
+    char magic[4];
+    uint32_t version;
+    int32_t width, height;
+    uint32_t seed;
+    int32_t passes;
+};
+}  // namespace
+
+void SampleBuffer::reset(int width, int height) {
+    _width = width;
+    _height = height;
+    _sum.assign(width * height, Color(0, 0, 0));
+    _count.assign(width * height, 0);
+}
+
+Color SampleBuffer::mean(int i, int j) const {
+    const int index = j * _width + i;
+    if (_count[index] == 0) return Color(0, 0, 0);
+    return _sum[index] / _count[index];
+}
+
+long SampleBuffer::totalSamples() const {
+    long total = 0;
+    for (int n : _count) total += n;
+    return total;
+}
+
+bool SampleBuffer::save(const std::string& path,
+                        const CheckpointInfo& info) const {
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::out | std::ios::binary);
+        if (!ofs) return false;
+        Header h;
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.width = _width;
+        h.height = _height;
+        h.seed = info.seed;
+        h.passes = info.passes;
+        ofs.write((const char*)&h, sizeof(h));
+        for (size_t p = 0; p < _sum.size(); p++) {
+            const float rgb[3] = {_sum[p][0], _sum[p][1], _sum[p][2]};
+            const int32_t n = _count[p];
+            ofs.write((const char*)rgb, sizeof(rgb));
+            ofs.write((const char*)&n, sizeof(n));
+        }
+        ofs.flush();
+        if (!ofs) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+namespace {
+bool read_header(std::istream& is, Header& h) {
+    if (!is.read((char*)&h, sizeof(h))) return false;
+    return std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+           h.version == VERSION && h.width > 0 && h.height > 0;
+}
+}  // namespace
+
+std::optional<CheckpointInfo> SampleBuffer::peek(const std::string& path) {
+    std::ifstream ifs(path, std::ios::in | std::ios::binary);
+    Header h;
+    if (!ifs || !read_header(ifs, h)) return {};
+    return CheckpointInfo{h.width, h.height, h.seed, h.passes};
+}
+
+std::optional<CheckpointInfo> SampleBuffer::load(const std::string& path) {
+    std::ifstream ifs(path, std::ios::in | std::ios::binary);
+    Header h;
+    if (!ifs || !read_header(ifs, h)) return {};
+    SampleBuffer buf;
+    buf.reset(h.width, h.height);
+    for (size_t p = 0; p < buf._sum.size(); p++) {
+        float rgb[3];
+        int32_t n;
+        ifs.read((char*)rgb, sizeof(rgb));
+        ifs.read((char*)&n, sizeof(n));
+        buf._sum[p] = Color(rgb[0], rgb[1], rgb[2]);
+        buf._count[p] = n;
+    }
+    if (!ifs) return {};  // truncated
+    *this = std::move(buf);
+    return CheckpointInfo{h.width, h.height, h.seed, h.passes};
+}
@@ -0,0 +1,203 @@
+#include "Sampler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// lowbias32 of Chris Wellons
+uint32_t mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t hash(uint32_t a, uint32_t b) {
+    return mix(a ^ (mix(b) + 0x9e3779b9 + (a << 6) + (a >> 2)));
+}
+
+// the high 24 bits as a float in [0, 1)
+float to_unit(uint32_t x) { return (x >> 8) * (1.0f / (1 << 24)); }
+
+// largest float below 1
+constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+// permutation of [0, l) chosen by p, applied to i (Kensler 2013)
+uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    // cycle walking: a permutation of [0, w] until the value is below l
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// base 2 Owen scramble of the bits of x, highest bit first (Burley 2020)
+uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return reverse_bits(x);
+}
+
+// direction numbers of the Sobol dimensions
+constexpr int SOBOL_DIMS = 8;
+struct SobolMatrices {
+    uint32_t v[SOBOL_DIMS][32];
+    SobolMatrices() {
+        // the first dimension is the van der Corput sequence, the primitive
+        // polynomials (degree s, coefficients a) and initial numbers m of
+        // the others are from the table of Joe and Kuo
+        struct Row {
+            int s, a;
+            uint32_t m[5];
+        };
+        const Row rows[SOBOL_DIMS - 1] = {
+            {1, 0, {1}},          {2, 1, {1, 3}},       {3, 1, {1, 3, 1}},
+            {3, 2, {1, 1, 1}},    {4, 1, {1, 1, 3, 3}}, {4, 4, {1, 3, 5, 13}},
+            {5, 2, {1, 1, 5, 5, 17}},
+        };
+        for (int i = 0; i < 32; i++) v[0][i] = 1u << (31 - i);
+        for (int d = 1; d < SOBOL_DIMS; d++) {
+            const Row& r = rows[d - 1];
+            for (int i = 0; i < 32; i++) {
+                if (i < r.s) {
+                    v[d][i] = r.m[i] << (31 - i);
+                    continue;
+                }
+                v[d][i] = v[d][i - r.s] ^ (v[d][i - r.s] >> r.s);
+                for (int k = 1; k < r.s; k++)
+                    if ((r.a >> (r.s - 1 - k)) & 1) v[d][i] ^= v[d][i - k];
+            }
+        }
+    }
+};
+const SobolMatrices sobol_matrices;
+
+uint32_t sobol(uint32_t index, int dim) {
+    uint32_t x = 0;
+    for (; index; index &= index - 1)
+        x ^= sobol_matrices.v[dim][__builtin_ctz(index)];
+    return x;
+}
+
+constexpr int HALTON_DIMS = 16;
+const uint32_t HALTON_BASES[HALTON_DIMS] = {2,  3,  5,  7,  11, 13, 17, 19,
+                                            23, 29, 31, 37, 41, 43, 47, 53};
+}  // namespace
+
+SampleStream substream(SampleStream stream, uint32_t branch) {
+    return hash(stream, branch);
+}
+
+std::unique_ptr<Sampler> Sampler::make(SamplerType type, uint32_t seed,
+                                       int samples_per_stream) {
+    switch (type) {
+        case SamplerType::RANDOM:
+            return std::make_unique<RandomSampler>(seed);
+        case SamplerType::STRATIFIED:
+            return std::make_unique<StratifiedSampler>(seed, samples_per_stream);
+        case SamplerType::HALTON:
+            return std::make_unique<HaltonSampler>(seed);
+        default:
+            return std::make_unique<SobolSampler>(seed);
+    }
+}
+
+float RandomSampler::get(SampleStream stream, uint32_t index,
+                         uint32_t dim) const {
+    return to_unit(hash(hash(hash(_seed, stream), index), dim));
+}
+
+StratifiedSampler::StratifiedSampler(uint32_t seed, int count)
+    : Sampler{seed}, _count{(uint32_t)std::max(1, count)} {}
+
+float StratifiedSampler::get(SampleStream stream, uint32_t index,
+                             uint32_t dim) const {
+    const uint32_t n = _count;
+    const uint32_t p = hash(hash(_seed, stream), index / n);
+    uint32_t s = index % n;
+    float x;
+    if (dim < 2) {
+        // an m x rows grid, every column and every row of it holds one
+        // sample in each of its sub-strata
+        const uint32_t m = std::max(1u, (uint32_t)std::sqrt((float)n));
+        const uint32_t rows = (n + m - 1) / m;
+        s = permute(s, n, p * 0x51633e2d);
+        if (dim == 0) {
+            const uint32_t sy = permute(s / m, rows, p * 0x63d83595);
+            x = (s % m + (sy + to_unit(hash(s, p * 0xa399d265))) / rows) / m;
+        } else {
+            const uint32_t sx = permute(s % m, m, p * 0xa511e9b3);
+            x = (s / m + (sx + to_unit(hash(s, p * 0x711ad6a5))) / m) / rows;
+        }
+    } else {
+        const uint32_t q = hash(p, dim);
+        x = (permute(s, n, q) + to_unit(hash(s, q))) / n;
+    }
+    return std::min(x, ONE_MINUS_EPSILON);
+}
+
+float SobolSampler::get(SampleStream stream, uint32_t index,
+                        uint32_t dim) const {
+    const uint32_t seed = hash(hash(_seed, stream), dim / SOBOL_DIMS);
+    const uint32_t shuffled = owen_scramble(index, seed);
+    const int d = dim % SOBOL_DIMS;
+    return to_unit(owen_scramble(sobol(shuffled, d), hash(seed, d)));
+}
+
+float HaltonSampler::get(SampleStream stream, uint32_t index,
+                         uint32_t dim) const {
+    const uint32_t base = HALTON_BASES[dim % HALTON_DIMS];
+    uint32_t seed = hash(hash(hash(_seed, stream), dim / HALTON_DIMS), base);
+    // the digits of the index from the lowest are the digits of the value
+    // from the highest, each permuted depending on the ones before it
+    const double inv_base = 1.0 / base;
+    double x = 0, factor = inv_base;
+    // The zeros after them are permuted as well, down to intervals of
+    // 2^-16, so that up to 2^16 samples are stratified
+    for (; index || factor >= 1.0 / (1 << 16); index /= base) {
+        const uint32_t d = index % base;
+        x += permute(d, base, seed) * factor;
+        seed = hash(seed, d);
+        factor *= inv_base;
+    }
+    // below that the permuted digits are a uniform value in the interval
+    x += to_unit(mix(seed)) * factor * base;
+    return std::min((float)x, ONE_MINUS_EPSILON);
+}
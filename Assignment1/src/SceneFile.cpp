@@ -0,0 +1,617 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "Material.h"
+#include "SceneFile.h"
+#include "Texture.h"
+
+namespace {
+
+const char MAGIC[4] = {'R', 'T', 'S', 'C'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const size_t ALIGNMENT = 16;
+
+enum ModelType : uint8_t {
+    SPHERE,
+    PLANE,
+    TRIANGLE,
+    QUADRIC,
+    BOX,
+    POLYGON,
+    COLLECTION,
+    MESH,
+    INSTANCE
+};
+
+// read only mapping of a whole file
+class MappedFile {
+   private:
+    int _fd;
+    void* _data;
+    size_t _size;
+
+   public:
+    explicit MappedFile(const std::string& path)
+        : _fd{-1}, _data{MAP_FAILED}, _size{0} {
+        _fd = ::open(path.c_str(), O_RDONLY);
+        if (_fd < 0) throw std::runtime_error("cannot open scene file " + path);
+        struct stat st;
+        if (::fstat(_fd, &st) != 0 || st.st_size == 0) {
+            ::close(_fd);
+            throw std::runtime_error(path + " is not a compiled scene");
+        }
+        _size = st.st_size;
+        _data = ::mmap(NULL, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if (_data == MAP_FAILED) {
+            ::close(_fd);
+            throw std::runtime_error("cannot map scene file " + path);
+        }
+        // every byte is read once, front to back
+        ::madvise(_data, _size, MADV_SEQUENTIAL);
+    }
+    ~MappedFile() {
+        ::munmap(_data, _size);
+        ::close(_fd);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    const char* data() const { return static_cast<const char*>(_data); }
+    size_t size() const { return _size; }
+};
+
+}  // namespace
+
+struct SceneFile::Writer {
+    std::ofstream out;
+    size_t offset = 0;
+    // texture cache handle to index in the file
+    std::unordered_map<TextureHandle, int32_t> textures;
+    // shared geometry to index in the file
+    std::unordered_map<const Model*, uint32_t> geometry;
+
+    explicit Writer(const std::string& path)
+        : out(path, std::ios::binary | std::ios::trunc) {
+        if (!out) throw std::runtime_error("cannot write scene file " + path);
+    }
+    void bytes(const void* p, size_t n) {
+        out.write(static_cast<const char*>(p), n);
+        offset += n;
+    }
+    template <typename T>
+    void value(const T& v) {
+        bytes(&v, sizeof(T));
+    }
+    void pad() {
+        static const char zeros[ALIGNMENT] = {};
+        bytes(zeros, (ALIGNMENT - offset % ALIGNMENT) % ALIGNMENT);
+    }
+    // the elements are copied as they are laid out in memory
+    template <typename T>
+    void array(const std::vector<T>& a) {
+        value<uint64_t>(a.size());
+        pad();
+        bytes(a.data(), a.size() * sizeof(T));
+    }
+    void string(const std::string& s) {
+        value<uint32_t>(s.size());
+        bytes(s.data(), s.size());
+    }
+    void vector3(const Vector3f& v) {
+        for (int k = 0; k < 3; k++) value<float>(v[k]);
+    }
+};
+
+struct SceneFile::Reader {
+    const std::string& path;
+    const char* data;
+    size_t size;
+    size_t pos = 0;
+    // material index in the file to id in material_table()
+    std::vector<MaterialId> materials;
+    // geometry placed by instances, by index in the file
+    std::vector<std::shared_ptr<const Model>> geometry;
+    // of the State being read
+    SceneArena& arena;
+
+    Reader(const std::string& path, const MappedFile& f, SceneArena& arena)
+        : path{path}, data{f.data()}, size{f.size()}, arena{arena} {}
+    void need(size_t n) const {
+        if (n > size - pos)
+            throw std::runtime_error("compiled scene " + path +
+                                     " is truncated");
+    }
+    void bytes(void* p, size_t n) {
+        need(n);
+        std::memcpy(p, data + pos, n);
+        pos += n;
+    }
+    template <typename T>
+    T value() {
+        T v;
+        bytes(&v, sizeof(T));
+        return v;
+    }
+    void pad() { pos += std::min((ALIGNMENT - pos % ALIGNMENT) % ALIGNMENT, size - pos); }
+    // arrays start aligned in the file and the mapping is page aligned, so
+    // the elements are copied straight out of the mapping
+    template <typename T>
+    std::vector<T> array() {
+        const uint64_t n = value<uint64_t>();
+        pad();
+        if (n > (size - pos) / sizeof(T)) need(size - pos + 1);
+        const T* first = reinterpret_cast<const T*>(data + pos);
+        pos += n * sizeof(T);
+        return std::vector<T>(first, first + n);
+    }
+    // length of a list whose elements take at least min_bytes each in the
+    // file, checked against the bytes left before anything is allocated
+    uint32_t count(size_t min_bytes) {
+        const uint32_t n = value<uint32_t>();
+        need((size_t)n * min_bytes);
+        return n;
+    }
+    std::string string() {
+        const uint32_t n = value<uint32_t>();
+        need(n);
+        std::string s(data + pos, n);
+        pos += n;
+        return s;
+    }
+    Vector3f vector3() {
+        Vector3f v;
+        for (int k = 0; k < 3; k++) v[k] = value<float>();
+        return v;
+    }
+    // offsets and indices are checked once after reading, traversal trusts
+    // them
+    void check(bool ok, const std::string& what) const {
+        if (!ok)
+            throw std::runtime_error("compiled scene " + path + " has " +
+                                     what);
+    }
+    // every index in [0, n)
+    void checkIndices(const std::vector<int>& indices, size_t n,
+                      const std::string& what) const {
+        for (int i : indices)
+            check(i >= 0 && (size_t)i < n, what + " out of range");
+    }
+    MaterialId material() {
+        const uint16_t i = value<uint16_t>();
+        if (i >= materials.size())
+            throw std::runtime_error("compiled scene " + path +
+                                     " refers to a missing material");
+        return materials[i];
+    }
+};
+
+void SceneFile::writeBVH(Writer& w, const BVH& bvh) {
+    w.array(bvh._nodes);
+    w.array(bvh._indices);
+    w.array(bvh._unbounded);
+    w.value(bvh._build_stats);
+}
+
+BVH SceneFile::readBVH(Reader& r, size_t num_primitives) {
+    BVH bvh;
+    bvh._nodes = r.array<BVHNode>();
+    bvh._indices = r.array<int>();
+    bvh._unbounded = r.array<int>();
+    bvh._build_stats = r.value<BVHBuildStats>();
+    bvh._build_stats.build_ms = 0;  // nothing was built
+
+    // a tree in the layout of BVHNode: every node but the root is the
+    // child of one interior node, children come after their parent, and the
+    // traversal stack holds the deepest path
+    const std::vector<BVHNode>& nodes = bvh._nodes;
+    std::vector<int> depth(nodes.size(), -1);
+    if (!nodes.empty()) depth[0] = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const BVHNode& n = nodes[i];
+        r.check(depth[i] >= 0, "a BVH node that is not in the tree");
+        if (n.count > 0) {
+            r.check(n.offset >= 0 &&
+                        (size_t)n.offset + n.count <= bvh._indices.size(),
+                    "a BVH leaf out of range");
+            continue;
+        }
+        r.check(n.axis < 3, "a BVH node with an unknown split axis");
+        r.check(depth[i] < BVH::MAX_DEPTH,
+                "a BVH deeper than " + std::to_string(BVH::MAX_DEPTH));
+        r.check(n.offset > (int)i + 1 && (size_t)n.offset < nodes.size(),
+                "a BVH child out of range");
+        for (size_t child : {i + 1, (size_t)n.offset}) {
+            r.check(depth[child] < 0, "a BVH node with two parents");
+            depth[child] = depth[i] + 1;
+        }
+    }
+    r.checkIndices(bvh._indices, num_primitives, "a BVH primitive");
+    r.checkIndices(bvh._unbounded, num_primitives, "a BVH primitive");
+    return bvh;
+}
+
+void SceneFile::writeModel(Writer& w, const Model& m) {
+    auto header = [&](ModelType type) {
+        w.value<uint8_t>(type);
+        w.value<uint16_t>(m.mat_id);
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++) w.value<float>(m.trans.T_M_W(i, j));
+        w.vector3(m.trans.R_M_W);
+    };
+
+    if (auto s = dynamic_cast<const Sphere*>(&m)) {
+        header(SPHERE);
+        w.vector3(s->_center);
+        w.value<float>(s->_radius);
+    } else if (auto p = dynamic_cast<const Plane*>(&m)) {
+        header(PLANE);
+        w.vector3(p->_normal.src);
+        w.vector3(p->_normal.dir);
+        w.value<float>(p->_normal.length);
+    } else if (auto t = dynamic_cast<const Triangle*>(&m)) {
+        header(TRIANGLE);
+        w.vector3(t->_p1);
+        w.vector3(t->_p2);
+        w.vector3(t->_p3);
+    } else if (auto q = dynamic_cast<const Quadric*>(&m)) {
+        header(QUADRIC);
+        for (float c : q->_q) w.value<float>(c);
+        w.vector3(q->_clip.min);
+        w.vector3(q->_clip.max);
+    } else if (auto b = dynamic_cast<const Box*>(&m)) {
+        header(BOX);
+        w.vector3(b->_center);
+        w.vector3(b->_ax);
+        w.vector3(b->_ay);
+        w.value<float>(b->_l);
+        w.value<float>(b->_b);
+        w.value<float>(b->_h);
+    } else if (auto p = dynamic_cast<const Polygon*>(&m)) {
+        header(POLYGON);
+        // the last point repeats the first one
+        w.value<uint32_t>(p->_points.size() - 1);
+        for (size_t i = 0; i + 1 < p->_points.size(); i++)
+            w.vector3(p->_points[i]);
+    } else if (auto c = dynamic_cast<const Collection*>(&m)) {
+        header(COLLECTION);
+        w.value<uint32_t>(c->_parts.size());
+        for (const Model* part : c->_parts) writeModel(w, *part);
+        w.value<uint8_t>(c->_bvh_dirty);
+        writeBVH(w, c->_bvh);
+    } else if (auto mesh = dynamic_cast<const TriangleMesh*>(&m)) {
+        header(MESH);
+        const MeshData& d = mesh->_data;
+        for (const std::vector<float>* a :
+             {&d.px, &d.py, &d.pz, &d.nx, &d.ny, &d.nz, &d.u, &d.v})
+            w.array(*a);
+        w.array(d.indices);
+        writeBVH(w, mesh->_bvh);
+    } else if (auto inst = dynamic_cast<const Instance*>(&m)) {
+        header(INSTANCE);
+        w.value<uint32_t>(w.geometry.at(inst->_geometry.get()));
+    } else {
+        std::ostringstream name;
+        name << m;
+        throw std::runtime_error("compiled scenes do not support model " +
+                                 name.str());
+    }
+}
+
+Model* SceneFile::readModel(Reader& r) {
+    const uint8_t type = r.value<uint8_t>();
+    const MaterialId mat = r.material();
+    Matrix3f m;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) m(i, j) = r.value<float>();
+    const Transformation t(m, r.vector3());
+
+    switch (type) {
+        case SPHERE: {
+            const Point center = r.vector3();
+            return r.arena.make<Sphere>(center, r.value<float>(), mat, t);
+        }
+        case PLANE: {
+            const Point src = r.vector3();
+            const Vector3f dir = r.vector3();
+            return r.arena.make<Plane>(Ray(src, dir, r.value<float>()), mat,
+                                       t);
+        }
+        case TRIANGLE: {
+            const Point p1 = r.vector3();
+            const Point p2 = r.vector3();
+            return r.arena.make<Triangle>(p1, p2, r.vector3(), mat, t);
+        }
+        case QUADRIC: {
+            std::vector<float> qp(10);
+            for (float& c : qp) c = r.value<float>();
+            const Vector3f clip_min = r.vector3();
+            const AABB clip(clip_min, r.vector3());
+            return r.arena.make<Quadric>(QuadricParams(qp), mat, t, clip);
+        }
+        case BOX: {
+            const Point center = r.vector3();
+            const Vector3f x = r.vector3();
+            const Vector3f y = r.vector3();
+            const float l = r.value<float>();
+            const float b = r.value<float>();
+            return r.arena.make<Box>(center, x, y, l, b, r.value<float>(),
+                                     mat, t);
+        }
+        case POLYGON: {
+            std::vector<Point> points(r.count(3 * sizeof(float)));
+            r.check(points.size() > 2, "a polygon with less than 3 points");
+            for (Point& p : points) p = r.vector3();
+            return r.arena.make<Polygon>(points, mat, t);
+        }
+        case COLLECTION: {
+            Collection* c = r.arena.make<Collection>(mat, t);
+            const uint32_t n = r.value<uint32_t>();
+            for (uint32_t i = 0; i < n; i++) c->addModel(readModel(r));
+            c->_bvh_dirty = r.value<uint8_t>();
+            c->_bvh = readBVH(r, n);
+            return c;
+        }
+        case MESH: {
+            MeshData d;
+            for (std::vector<float>* a :
+                 {&d.px, &d.py, &d.pz, &d.nx, &d.ny, &d.nz, &d.u, &d.v})
+                *a = r.array<float>();
+            d.indices = r.array<int>();
+            const size_t n = d.px.size();
+            r.check(d.py.size() == n && d.pz.size() == n,
+                    "mesh positions of different lengths");
+            for (const std::vector<float>* a : {&d.nx, &d.ny, &d.nz, &d.u, &d.v})
+                r.check(a->empty() || a->size() == n,
+                        "mesh normals or uvs not matching the positions");
+            r.check(d.nx.size() == d.ny.size() && d.nx.size() == d.nz.size() &&
+                        d.u.size() == d.v.size(),
+                    "mesh normals or uvs of different lengths");
+            r.check(d.indices.size() % 3 == 0, "a mesh with a partial triangle");
+            r.checkIndices(d.indices, n, "a mesh vertex");
+            BVH bvh = readBVH(r, d.numTriangles());
+            // the constructor is private to SceneFile, the arena moves it
+            return r.arena.make<TriangleMesh>(
+                TriangleMesh(std::move(d), std::move(bvh), mat, t));
+        }
+        case INSTANCE: {
+            const uint32_t i = r.value<uint32_t>();
+            if (i >= r.geometry.size())
+                throw std::runtime_error("compiled scene " + r.path +
+                                         " refers to a missing geometry");
+            return r.arena.make<Instance>(r.geometry[i], t);
+        }
+        default:
+            throw std::runtime_error("compiled scene " + r.path +
+                                     " has an unknown model type");
+    }
+}
+
+void SceneFile::write(const State& s, const std::string& path) {
+    Writer w(path);
+    w.bytes(MAGIC, sizeof(MAGIC));
+    w.value<uint32_t>(VERSION);
+    w.value<uint32_t>(BYTE_ORDER_MARK);
+    w.value<uint32_t>(sizeof(BVHNode));
+
+    // the whole material table and the textures it uses, ids stay the same
+    const MaterialTable& table = material_table();
+    std::vector<TextureHandle> handles;
+    for (int id = 0; id < table.size(); id++) {
+        const TextureHandle h = table[id].texture;
+        if (h != NO_TEXTURE && w.textures.emplace(h, handles.size()).second)
+            handles.push_back(h);
+    }
+    const TextureCache& cache = texture_cache();
+    w.value<uint32_t>(handles.size());
+    for (TextureHandle h : handles) {
+        // keyed like the cache, a scene loaded later shares the image
+        std::string key;
+        for (const auto& entry : cache._by_path)
+            if (entry.second == h) key = entry.first;
+        w.string(key);
+        const Texture& tex = cache.get(h);
+        w.value<uint32_t>(tex._levels.size());
+        for (const Texture::Level& l : tex._levels) {
+            w.value<int32_t>(l.width);
+            w.value<int32_t>(l.height);
+            w.array(l.texels);
+        }
+    }
+
+    w.value<uint32_t>(table.size());
+    for (int id = 0; id < table.size(); id++) {
+        const Material& m = table[id];
+        for (const Vector3f* v : {&m.Ka, &m.Kd, &m.Ks, &m.Krg, &m.Ktg})
+            w.vector3(*v);
+        w.value<float>(m.refractive_index);
+        w.value<float>(m.specular_coeff);
+        w.value<int32_t>(m.hasTexture() ? w.textures.at(m.texture) : -1);
+        w.value<uint8_t>((uint8_t)m.sampler.filter);
+        w.value<uint8_t>((uint8_t)m.sampler.wrap_u);
+        w.value<uint8_t>((uint8_t)m.sampler.wrap_v);
+        w.value<uint8_t>(m.roulette);
+    }
+    w.value<uint32_t>(s.materials.size());
+    for (const auto& entry : s.materials) {
+        w.string(entry.first);
+        w.value<uint16_t>(entry.second);
+    }
+
+    const Camera& cam = *s.cam;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++) w.value<float>(cam._transformation(i, j));
+    w.value<float>(cam._ar);
+    w.value<float>(cam._fov_degree);
+
+    const Background& bg = *s.bg;
+    w.value<uint8_t>(bg.has_background);
+    w.vector3(bg.background);
+    if (bg.has_background) w.value<uint16_t>(bg.world->mat_id);
+
+    w.value<uint32_t>(s.lights.size());
+    for (const Light* light : s.lights) {
+        w.vector3(light->getCenter());
+        w.vector3(light->getIntensity());
+    }
+    w.value<int32_t>(s.sampling.min_samples);
+    w.value<int32_t>(s.sampling.max_samples);
+    w.value<float>(s.sampling.threshold);
+    w.value<uint8_t>((uint8_t)s.sampling.sampler);
+    w.value<int32_t>(s.tracing.max_depth);
+    w.value<float>(s.tracing.min_contribution);
+    w.value<int32_t>(s.tracing.roulette_depth);
+    w.value<int32_t>(s.tracePoint.first);
+    w.value<int32_t>(s.tracePoint.second);
+
+    // every geometry is written once, then instances refer to it by index
+    std::vector<std::pair<std::string, const Model*>> geometry;
+    for (const auto& entry : s.geometry)
+        if (w.geometry.emplace(entry.second.get(), geometry.size()).second)
+            geometry.emplace_back(entry.first, entry.second.get());
+    for (const Model* m : s.models)
+        if (auto inst = dynamic_cast<const Instance*>(m))
+            if (w.geometry.emplace(inst->_geometry.get(), geometry.size())
+                    .second)
+                geometry.emplace_back("", inst->_geometry.get());
+    w.value<uint32_t>(geometry.size());
+    for (const auto& entry : geometry) {
+        w.string(entry.first);
+        writeModel(w, *entry.second);
+    }
+
+    w.value<uint32_t>(s.models.size());
+    for (const Model* m : s.models) writeModel(w, *m);
+    if (s.bvh) {
+        writeBVH(w, *s.bvh);
+    } else {
+        // the hierarchy RenderEngine would build
+        BVH bvh;
+        std::vector<AABB> bounds;
+        for (const Model* m : s.models) bounds.push_back(m->getBounds());
+        bvh.build(bounds);
+        writeBVH(w, bvh);
+    }
+
+    w.out.close();
+    if (!w.out) throw std::runtime_error("cannot write scene file " + path);
+}
+
+State SceneFile::read(const std::string& path) {
+    MappedFile file(path);
+    State s;
+    Reader r(path, file, *s.arena);
+
+    char magic[sizeof(MAGIC)];
+    r.bytes(magic, sizeof(magic));
+    if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw std::runtime_error(path + " is not a compiled scene");
+    const uint32_t version = r.value<uint32_t>();
+    if (version != VERSION)
+        throw std::runtime_error(path + " is a version " +
+                                 std::to_string(version) +
+                                 " compiled scene, expected version " +
+                                 std::to_string(VERSION));
+    if (r.value<uint32_t>() != BYTE_ORDER_MARK ||
+        r.value<uint32_t>() != sizeof(BVHNode))
+        throw std::runtime_error(path +
+                                 " was compiled on an incompatible machine");
+
+    // a key length and a level count
+    std::vector<TextureHandle> textures(r.count(2 * sizeof(uint32_t)));
+    for (TextureHandle& h : textures) {
+        const std::string key = r.string();
+        // the size and an empty texel array
+        std::vector<Texture::Level> levels(
+            r.count(2 * sizeof(int32_t) + sizeof(uint64_t)));
+        r.check(!levels.empty(), "a texture without an image");
+        for (Texture::Level& l : levels) {
+            l.width = r.value<int32_t>();
+            l.height = r.value<int32_t>();
+            l.texels = r.array<uint32_t>();
+            r.check(l.width > 0 && l.height > 0 &&
+                        l.texels.size() == (size_t)l.width * l.height,
+                    "a texture not matching its size");
+        }
+        h = texture_cache().add(
+            key, std::unique_ptr<Texture>(new Texture(std::move(levels))));
+    }
+
+    // 5 colors, 2 floats, the texture and 4 bytes
+    r.materials.resize(r.count(17 * sizeof(float) + sizeof(int32_t) + 4));
+    for (MaterialId& id : r.materials) {
+        Material m;
+        for (Vector3f* v : {&m.Ka, &m.Kd, &m.Ks, &m.Krg, &m.Ktg})
+            *v = r.vector3();
+        m.refractive_index = r.value<float>();
+        m.specular_coeff = r.value<float>();
+        const int32_t tex = r.value<int32_t>();
+        if (tex >= (int32_t)textures.size())
+            throw std::runtime_error("compiled scene " + path +
+                                     " refers to a missing texture");
+        if (tex >= 0) m.texture = textures[tex];
+        m.sampler.filter = (TextureFilter)r.value<uint8_t>();
+        m.sampler.wrap_u = (WrapMode)r.value<uint8_t>();
+        m.sampler.wrap_v = (WrapMode)r.value<uint8_t>();
+        m.roulette = r.value<uint8_t>();
+        id = material_table().intern(m);
+    }
+
+    const uint32_t num_names = r.value<uint32_t>();
+    for (uint32_t i = 0; i < num_names; i++) {
+        std::string name = r.string();
+        s.materials[name] = r.material();
+    }
+
+    Matrix4f cam_trans;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++) cam_trans(i, j) = r.value<float>();
+    const float ar = r.value<float>();
+    s.cam = s.arena->make<Camera>(cam_trans, ar, r.value<float>());
+
+    const bool textured = r.value<uint8_t>();
+    const Color background = r.vector3();
+    if (textured)
+        s.bg = s.arena->make<Background>(s.arena->make<Sphere>(
+            Vector3f::Zero(), 1, r.material(), IDENTITY_TRANS));
+    else
+        s.bg = s.arena->make<Background>(background);
+
+    const uint32_t num_lights = r.value<uint32_t>();
+    for (uint32_t i = 0; i < num_lights; i++) {
+        const Point center = r.vector3();
+        s.lights.push_back(s.arena->make<Light>(center, r.vector3()));
+    }
+    s.sampling.min_samples = r.value<int32_t>();
+    s.sampling.max_samples = r.value<int32_t>();
+    s.sampling.threshold = r.value<float>();
+    s.sampling.sampler = (SamplerType)r.value<uint8_t>();
+    s.tracing.max_depth = r.value<int32_t>();
+    s.tracing.min_contribution = r.value<float>();
+    s.tracing.roulette_depth = r.value<int32_t>();
+    s.tracePoint.first = r.value<int32_t>();
+    s.tracePoint.second = r.value<int32_t>();
+
+    const uint32_t num_geometry = r.value<uint32_t>();
+    for (uint32_t i = 0; i < num_geometry; i++) {
+        std::string name = r.string();
+        r.geometry.push_back(borrowed<const Model>(readModel(r)));
+        if (!name.empty()) s.geometry[name] = r.geometry.back();
+    }
+
+    const uint32_t num_models = r.value<uint32_t>();
+    for (uint32_t i = 0; i < num_models; i++) s.models.push_back(readModel(r));
+    s.bvh = std::make_shared<const BVH>(readBVH(r, s.models.size()));
+    return s;
+}
+
+bool SceneFile::isCompiled(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return in.read(magic, sizeof(magic)) &&
+           std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "SceneLoader.h"
+#include "utils.h"
+
+namespace {
+
+struct Location {
+    long line, column;
+};
+
+/**
+ * Reads a file in large chunks and knows the line and column of the last
+ * character taken from it. Newlines are counted lazily up to the read
+ * position, so asking once per element costs nothing extra.
+ */
+class CountingBuf : public std::streambuf {
+   private:
+    std::ifstream _file;
+    std::vector<char> _buf;
+    long _offset;      // of eback() in the file
+    long _line;        // line of *_scan
+    long _line_start;  // offset of the first character of _line
+    const char* _scan; // newlines before it are counted
+
+    long offset(const char* p) const { return _offset + (p - eback()); }
+    void count(const char* end) {
+        while (_scan < end) {
+            const char* nl =
+                static_cast<const char*>(std::memchr(_scan, '\n', end - _scan));
+            if (!nl) break;
+            _line++;
+            _line_start = offset(nl) + 1;
+            _scan = nl + 1;
+        }
+        _scan = std::max(_scan, end);
+    }
+
+   protected:
+    int_type underflow() override {
+        count(egptr());
+        _offset += egptr() - eback();
+        _file.read(_buf.data(), _buf.size());
+        char* begin = _buf.data();
+        setg(begin, begin, begin + _file.gcount());
+        _scan = begin;
+        if (gptr() == egptr()) return traits_type::eof();
+        return traits_type::to_int_type(*gptr());
+    }
+
+   public:
+    explicit CountingBuf(const std::string& path)
+        : _file(path, std::ios::binary),
+          _buf(1 << 16),
+          _offset{0},
+          _line{1},
+          _line_start{0} {
+        setg(_buf.data(), _buf.data(), _buf.data());
+        _scan = _buf.data();
+    }
+    bool isOpen() const { return _file.is_open(); }
+    Location location() {
+        const char* last = gptr() > eback() ? gptr() - 1 : gptr();
+        count(last);
+        return {_line, offset(last) - _line_start + 1};
+    }
+};
+
+// nlohmann messages start with "[json.exception.type_error.302] "
+std::string message(const std::exception& e) {
+    std::string m = e.what();
+    if (m.rfind("[json.exception.", 0) == 0) {
+        size_t end = m.find("] ");
+        if (end != std::string::npos) m = m.substr(end + 2);
+    }
+    return m;
+}
+
+bool is_instance(const json& el) {
+    auto t = el.find("type");
+    return t != el.end() && *t == "instance";
+}
+
+// true if every material el and the elements of a collection use is known
+bool materials_defined(const json& el,
+                       const std::unordered_map<std::string, MaterialId>& materials) {
+    if (!el.is_object()) return true;
+    auto m = el.find("material");
+    if (m != el.end() && m->is_string() &&
+        materials.find(m->get<std::string>()) == materials.end())
+        return false;
+    auto e = el.find("elements");
+    if (e != el.end() && e->is_array())
+        for (const json& part : *e)
+            if (!materials_defined(part, materials)) return false;
+    return true;
+}
+
+/**
+ * Builds the State from the SAX events of the document. The root object is
+ * depth 1. Its keys are sections, "materials", "geometry", "models" and
+ * "lights" are lists read one element at a time (depth 2), the other
+ * sections are read whole. Each element is collected into a json value and handed to its
+ * parse_* function when it is complete.
+ */
+class SceneHandler : public nlohmann::json_sax<json> {
+   private:
+    struct Pending {
+        std::string section;
+        json element;
+        Location location;
+        int index;
+    };
+
+    const std::string& _path;
+    // of the scene file, relative mesh paths start here
+    const std::string _dir;
+    CountingBuf& _in;
+    const bool _with_preview;
+    State& _state;
+
+    int _depth;
+    std::string _section;
+    int _index;  // of the element in its list
+    int _skip;   // depth inside a value that is skipped, 0 if none
+    // element being collected, _stack holds its open containers
+    json _element;
+    std::vector<json*> _stack;
+    std::string _key;
+    Location _start;
+    // geometry and models waiting for their material or geometry
+    std::vector<Pending> _pending;
+
+    static bool isList(const std::string& section) {
+        return section == "materials" || section == "geometry" ||
+               section == "models" || section == "lights";
+    }
+    static bool isKnown(const std::string& section) {
+        return isList(section) || section == "camera" ||
+               section == "background" || section == "tracePoint" ||
+               section == "sampling" || section == "tracing";
+    }
+    std::runtime_error error(const Location& l, const std::string& what) const {
+        return std::runtime_error(_path + ":" + std::to_string(l.line) + ":" +
+                                  std::to_string(l.column) + ": " + what);
+    }
+    void warn(const Location& l, const std::string& what) const {
+        std::cerr << "WARNING: " << error(l, what).what() << std::endl;
+    }
+    std::string where(int index) const {
+        return _section + "[" + std::to_string(index) + "]";
+    }
+
+    // everything el refers to is defined
+    bool ready(const json& el) const {
+        if (is_instance(el)) {
+            auto g = el.find("geometry");
+            return g == el.end() || !g->is_string() ||
+                   _state.geometry.count(g->get<std::string>());
+        }
+        return materials_defined(el, _state.materials);
+    }
+
+    void addGeometry(const json& el, const Location& l, int index) {
+        std::string name = get_key(el, "name");
+        // placed by instances only, there is no preview of it
+        auto m = parse_model(el, _state.materials, *_state.arena, false,
+                             _dir);
+        if (m.first == NULL) {
+            warn(l, where(index) + ": unknown model type " +
+                        get_key(el, "type").dump() + " skipped");
+            return;
+        }
+        // the arena owns it, an owning pointer would keep the arena alive
+        // from the instances inside it
+        _state.geometry[name] = borrowed<const Model>(m.first);
+    }
+
+    void addModel(const json& el, const Location& l, int index) {
+        if (is_instance(el)) {
+            _state.models.push_back(
+                parse_instance(el, _state.geometry, *_state.arena));
+            return;
+        }
+        auto m = parse_model(el, _state.materials, *_state.arena,
+                             _with_preview, _dir);
+        if (m.first == NULL) {
+            warn(l, where(index) + ": unknown model type " +
+                        get_key(el, "type").dump() + " skipped");
+            return;
+        }
+        _state.models.push_back(m.first);
+        if (m.second != NULL) _state.oglModels.push_back(m.second);
+    }
+
+    // an element or a whole section was read
+    void complete() {
+        const bool in_list = _depth == 2;
+        try {
+            if (!in_list && isList(_section))
+                throw std::runtime_error("expected an array");
+            if (_section == "materials") {
+                auto m = parse_material(_element);
+                _state.materials[m.first] = m.second;
+            } else if (_section == "geometry" || _section == "models") {
+                if (!ready(_element))
+                    _pending.push_back(
+                        {_section, std::move(_element), _start, _index});
+                else if (_section == "geometry")
+                    addGeometry(_element, _start, _index);
+                else
+                    addModel(_element, _start, _index);
+            } else if (_section == "lights") {
+                _state.lights.push_back(parse_light(_element, *_state.arena));
+            } else if (_section == "camera") {
+                _state.cam = parse_camera(_element, *_state.arena);
+            } else if (_section == "background") {
+                _state.bg =
+                    parse_background(_element, *_state.arena, _dir);
+            } else if (_section == "tracePoint") {
+                _state.tracePoint = parse_trace_point(_element);
+            } else if (_section == "sampling") {
+                _state.sampling = parse_sampling(_element);
+            } else if (_section == "tracing") {
+                _state.tracing = parse_tracing(_element);
+            }
+        } catch (const std::exception& e) {
+            throw error(_start, (in_list ? where(_index) : _section) + ": " +
+                                    message(e));
+        }
+        if (in_list) _index++;
+        _element = json();
+    }
+
+    // decides if a value starting here is collected, remembers where
+    bool begin() {
+        if (_depth == 1 && !isKnown(_section)) return false;
+        _start = _in.location();
+        return true;
+    }
+
+    json* add(json&& v) {
+        if (_stack.empty()) {
+            _element = std::move(v);
+            return &_element;
+        }
+        json& top = *_stack.back();
+        if (top.is_array()) {
+            top.push_back(std::move(v));
+            return &top.back();
+        }
+        json& slot = top[_key];
+        slot = std::move(v);
+        return &slot;
+    }
+
+    bool value(json&& v) {
+        if (_skip) return true;
+        if (_stack.empty()) {
+            if (_depth == 0)
+                throw error(_in.location(), "a scene is a JSON object");
+            if (!begin()) return true;
+            add(std::move(v));
+            complete();
+            return true;
+        }
+        add(std::move(v));
+        return true;
+    }
+
+    bool open(json&& container) {
+        if (_skip) {
+            _skip++;
+            return true;
+        }
+        if (_stack.empty()) {
+            if (_depth == 0) {
+                if (!container.is_object())
+                    throw error(_in.location(), "a scene is a JSON object");
+                _depth = 1;
+                return true;
+            }
+            if (_depth == 1 && isList(_section) && container.is_array()) {
+                _depth = 2;
+                _index = 0;
+                return true;
+            }
+            if (!begin()) {
+                _skip = 1;
+                return true;
+            }
+        }
+        _stack.push_back(add(std::move(container)));
+        return true;
+    }
+
+    bool close() {
+        if (_skip) {
+            _skip--;
+            return true;
+        }
+        if (_stack.empty()) {
+            _depth--;  // end of a list or of the root
+            return true;
+        }
+        _stack.pop_back();
+        if (_stack.empty()) complete();
+        return true;
+    }
+
+   public:
+    SceneHandler(const std::string& path, CountingBuf& in, bool with_preview,
+                 State& state)
+        : _path{path},
+          _dir{std::filesystem::path(path).parent_path().string()},
+          _in{in},
+          _with_preview{with_preview},
+          _state{state},
+          _depth{0},
+          _index{0},
+          _skip{0} {}
+
+    bool null() override { return value(json()); }
+    bool boolean(bool val) override { return value(json(val)); }
+    bool number_integer(number_integer_t val) override {
+        return value(json(val));
+    }
+    bool number_unsigned(number_unsigned_t val) override {
+        return value(json(val));
+    }
+    bool number_float(number_float_t val, const string_t&) override {
+        return value(json(val));
+    }
+    bool string(string_t& val) override { return value(json(std::move(val))); }
+    bool start_object(std::size_t) override { return open(json::object()); }
+    bool start_array(std::size_t) override { return open(json::array()); }
+    bool end_object() override { return close(); }
+    bool end_array() override { return close(); }
+    bool key(string_t& val) override {
+        if (_skip) return true;
+        if (!_stack.empty()) {
+            _key = std::move(val);
+        } else if (_depth == 1) {
+            _section = std::move(val);
+            if (!isKnown(_section))
+                warn(_in.location(), "unknown key \"" + _section + "\" ignored");
+        }
+        return true;
+    }
+    bool parse_error(std::size_t, const std::string&,
+                     const nlohmann::detail::exception& ex) override {
+        // the location is ours, drop the one in the message
+        std::string m = message(ex);
+        if (m.rfind("parse error", 0) == 0 && m.find(": ") != std::string::npos)
+            m = m.substr(m.find(": ") + 2);
+        throw error(_in.location(), m);
+    }
+
+    // geometry and models whose material or geometry came after them,
+    // the geometry first as models may place it
+    void finish() {
+        std::stable_partition(
+            _pending.begin(), _pending.end(),
+            [](const Pending& p) { return p.section == "geometry"; });
+        for (Pending& p : _pending) {
+            _section = p.section;
+            try {
+                if (_section == "geometry")
+                    addGeometry(p.element, p.location, p.index);
+                else
+                    addModel(p.element, p.location, p.index);
+            } catch (const std::exception& e) {
+                throw error(p.location, where(p.index) + ": " + message(e));
+            }
+        }
+        _pending.clear();
+    }
+};
+
+}  // namespace
+
+State load_scene(const std::string& path, bool with_preview) {
+    CountingBuf buf(path);
+    if (!buf.isOpen()) throw std::runtime_error("cannot open scene file " + path);
+    std::istream in(&buf);
+
+    State s{};
+    SceneHandler handler(path, buf, with_preview, s);
+    json::sax_parse(in, &handler);
+    handler.finish();
+
+    if (!s.cam) throw std::runtime_error(path + ": missing key \"camera\"");
+    if (!s.bg) s.bg = s.arena->make<Background>(Color::Zero());
+    return s;
+}
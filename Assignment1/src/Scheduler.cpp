@@ -0,0 +1,101 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <cassert>
+
+TileScheduler::TileScheduler(int width, int height, int tile_size) {
+    assert(tile_size > 0);
+    _tiles_x = (width + tile_size - 1) / tile_size;
+    _tiles_y = (height + tile_size - 1) / tile_size;
+    for (int ty = 0; ty < _tiles_y; ty++) {
+        for (int tx = 0; tx < _tiles_x; tx++) {
+            Tile t;
+            t.id = _tiles.size();
+            t.x0 = tx * tile_size;
+            t.y0 = ty * tile_size;
+            t.x1 = std::min(width, t.x0 + tile_size);
+            t.y1 = std::min(height, t.y0 + tile_size);
+            _tiles.push_back(t);
+        }
+    }
+}
+
+ThreadPool::ThreadPool(int num_threads)
+    : _job{NULL}, _generation{0}, _busy{0}, _stop{false} {
+    num_threads = std::max(1, num_threads);
+    for (int i = 0; i < num_threads; i++)
+        _queues.push_back(std::make_unique<WorkQueue>());
+    for (int i = 0; i < num_threads; i++)
+        _workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lk(_m);
+        _stop = true;
+    }
+    _start_cv.notify_all();
+    for (auto& w : _workers) w.join();
+}
+
+std::optional<int> ThreadPool::popTask(int worker) {
+    {
+        WorkQueue& own = *_queues[worker];
+        std::lock_guard<std::mutex> lk(own.m);
+        if (!own.tasks.empty()) {
+            int task = own.tasks.front();
+            own.tasks.pop_front();
+            return task;
+        }
+    }
+    // own queue is empty, steal from the back of someone else's queue
+    const int n = _queues.size();
+    for (int k = 1; k < n; k++) {
+        WorkQueue& victim = *_queues[(worker + k) % n];
+        std::lock_guard<std::mutex> lk(victim.m);
+        if (!victim.tasks.empty()) {
+            int task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return task;
+        }
+    }
+    return {};
+}
+
+void ThreadPool::workerLoop(int worker) {
+    long seen_generation = 0;
+    while (true) {
+        const std::function<void(int, int)>* job;
+        {
+            std::unique_lock<std::mutex> lk(_m);
+            _start_cv.wait(lk, [&] {
+                return _stop || _generation != seen_generation;
+            });
+            if (_stop) return;
+            seen_generation = _generation;
+            job = _job;
+        }
+        while (auto task = popTask(worker)) (*job)(task.value(), worker);
+        {
+            std::lock_guard<std::mutex> lk(_m);
+            if (--_busy == 0) _done_cv.notify_all();
+        }
+    }
+}
+
+void ThreadPool::parallelFor(int num_tasks,
+                             const std::function<void(int, int)>& f) {
+    const int n = _queues.size();
+    for (int w = 0; w < n; w++) {
+        const int begin = (long)num_tasks * w / n;
+        const int end = (long)num_tasks * (w + 1) / n;
+        std::lock_guard<std::mutex> lk(_queues[w]->m);
+        for (int t = begin; t < end; t++) _queues[w]->tasks.push_back(t);
+    }
+    std::unique_lock<std::mutex> lk(_m);
+    _job = &f;
+    _busy = n;
+    _generation++;
+    _start_cv.notify_all();
+    _done_cv.wait(lk, [&] { return _busy == 0; });
+    _job = NULL;
+}
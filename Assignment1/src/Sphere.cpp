@@ -5,8 +5,15 @@
 #include "Models.h"
 #include "defs.h"
 
-std::optional<std::pair<float, const Model*>>
-Sphere::_getIntersectionLengthAndPart(const Ray& r) const {
+Hit Sphere::hitAt(const Point& p, float t) const {
+    Hit h;
+    h.t = t;
+    h.part = this;
+    h.normal = (p - _center).normalized();
+    return h;
+}
+
+std::optional<Hit> Sphere::_intersect(const Ray& r) const {
     // TODO: check intersection inside Sphere
     Ray src_center(r.src, _center - r.src);
     const float cos_theta = src_center.dir.dot(r.dir);
@@ -27,40 +34,54 @@ Sphere::_getIntersectionLengthAndPart(const Ray& r) const {
     float min_dist = std::min(t0, t1);
     float max_dist = std::max(t0, t1);
     float dist = (min_dist < 0) ? max_dist : min_dist;  // use correct distance
-    return std::make_pair(dist, this);
+    return hitAt(r.src + dist * r.dir, dist);
+}
+
+bool Sphere::_occluded(const Ray& r, float tmax) const {
+    const Vector3f src_center = _center - r.src;
+    const float src_center_sq = src_center.squaredNorm();
+    const float src_center_proj = src_center.dot(r.dir);
+    const bool is_outside = src_center_sq > _radius_sq;
+    if (is_outside && src_center_proj <= 0) return false;
+
+    const float center_ray_sq =
+        src_center_sq - src_center_proj * src_center_proj;
+    if (center_ray_sq > _radius_sq) return false;
+    const float d = sqrt(_radius_sq - center_ray_sq);
+    const float t_near = src_center_proj - d;
+    // same root as _intersect: the far one from inside
+    const float dist = (t_near < 0) ? (src_center_proj + d) : t_near;
+    return dist < tmax;
 }
 
-bool Sphere::_isOnSurface(const Point& p) const {
-    return (fabs((p - _center).norm() - _radius) <= EPSILON);
+void Sphere::_intersectPacket(const RayPacket& p, float* t,
+                              Hit* hits) const {
+    alignas(64) float dist[RayPacket::MAX_SIZE];
+    sphereKernel(p, _center, _radius_sq, dist);
+    for (int lane = 0; lane < p.size; lane++) {
+        if (dist[lane] >= t[lane]) continue;
+        t[lane] = dist[lane];
+        hits[lane] = hitAt(packetPoint(p, lane, dist[lane]), dist[lane]);
+    }
 }
 
-// returns outward normal
-std::optional<Ray> Sphere::_getNormal(const Point& p) const {
-    if (!_isOnSurface(p)) return {};
-    auto normal = Ray(p, p - _center);
-    return normal;
-};
+AABB Sphere::_getBounds() const {
+    return AABB(_center - Vector3f::Constant(_radius),
+                _center + Vector3f::Constant(_radius));
+}
 
 std::ostream& Sphere::print(std::ostream& os) const {
     return os << "Sphere{center=" << _center << ",radius=" << _radius << "}";
 }
 
-std::optional<Color> Sphere::_getTexture(const Point& p) const {
-    if((this->mat).img == NULL) return {};
+std::optional<Color> Sphere::_getTexture(const Point& p, const Hit& /*hit*/,
+                                         float footprint) const {
+    if(!getMaterial().hasTexture()) return {};
 
     auto direction = (p-_center).normalized();
     float u = 0.5 + atan2(direction[2],direction[0])/(2*PI);
     float v = 0.5 - asin(direction[1])/PI;
 
-    auto& img = *((this->mat).img);
-
-    int w = u*img.width();
-    int h = v*img.height();
-
-    float r = (float)(*img.data(w,h,0,0))/255.0;
-    float g = (float)(*img.data(w,h,0,1))/255.0;
-    float b = (float)(*img.data(w,h,0,2))/255.0;
-    Vector3f color{r,g,b};
-
-    return color;
-}
\ No newline at end of file
+    // u runs once around the equator
+    return getMaterial().sampleTexture(u, v, footprint / (2 * PI * _radius));
+}
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <stdexcept>
+#include "Texture.h"
+#include "stb_image.h"
+
+namespace {
+
+int wrap(int i, int n, WrapMode mode) {
+    if ((unsigned)i < (unsigned)n) return i;
+    switch (mode) {
+        case WrapMode::REPEAT:
+            i %= n;
+            return i < 0 ? i + n : i;
+        case WrapMode::MIRROR: {
+            int m = i % (2 * n);
+            if (m < 0) m += 2 * n;
+            return m < n ? m : 2 * n - 1 - m;
+        }
+        case WrapMode::CLAMP:
+        default:
+            return std::min(std::max(i, 0), n - 1);
+    }
+}
+
+// keeps floor() of a stray nan or huge coordinate inside int range
+float sanitize(float x) {
+    if (!std::isfinite(x)) return 0;
+    return std::min(std::max(x, -1e6f), 1e6f);
+}
+
+uint32_t pack(int r, int g, int b, int a) {
+    return (uint32_t)r | (uint32_t)g << 8 | (uint32_t)b << 16 |
+           (uint32_t)a << 24;
+}
+
+int channel(uint32_t t, int k) { return (t >> (8 * k)) & 0xff; }
+
+}  // namespace
+
+Texture::Texture(int width, int height, int channels,
+                 const unsigned char* data) {
+    Level base{width, height, std::vector<uint32_t>(width * height)};
+    for (int i = 0; i < width * height; i++) {
+        const unsigned char* src = data + i * channels;
+        int alpha = (channels == 2 || channels == 4) ? src[channels - 1] : 255;
+        base.texels[i] = channels < 3 ? pack(src[0], src[0], src[0], alpha)
+                                      : pack(src[0], src[1], src[2], alpha);
+    }
+    _levels.push_back(std::move(base));
+
+    // box filtered mip chain, odd sides clamp the second row/column
+    while (_levels.back().width > 1 || _levels.back().height > 1) {
+        const Level& prev = _levels.back();
+        Level next{std::max(1, prev.width / 2), std::max(1, prev.height / 2),
+                   {}};
+        next.texels.resize(next.width * next.height);
+        for (int y = 0; y < next.height; y++) {
+            int y0 = std::min(2 * y, prev.height - 1);
+            int y1 = std::min(2 * y + 1, prev.height - 1);
+            for (int x = 0; x < next.width; x++) {
+                int x0 = std::min(2 * x, prev.width - 1);
+                int x1 = std::min(2 * x + 1, prev.width - 1);
+                uint32_t a = texel(prev, x0, y0), b = texel(prev, x1, y0);
+                uint32_t c = texel(prev, x0, y1), d = texel(prev, x1, y1);
+                int avg[4];
+                for (int k = 0; k < 4; k++)
+                    avg[k] = (channel(a, k) + channel(b, k) + channel(c, k) +
+                              channel(d, k) + 2) / 4;
+                next.texels[y * next.width + x] =
+                    pack(avg[0], avg[1], avg[2], avg[3]);
+            }
+        }
+        _levels.push_back(std::move(next));
+    }
+}
+
+size_t Texture::memoryBytes() const {
+    size_t bytes = 0;
+    for (const Level& l : _levels) bytes += l.texels.size() * sizeof(uint32_t);
+    return bytes;
+}
+
+// the fetch functions return channels in [0, 255]
+void Texture::fetchNearest(const Level& l, float u, float v,
+                           const TextureSampler& s, float* out) const {
+    int x = wrap((int)std::floor(u * l.width), l.width, s.wrap_u);
+    int y = wrap((int)std::floor(v * l.height), l.height, s.wrap_v);
+    uint32_t t = texel(l, x, y);
+    for (int k = 0; k < 4; k++) out[k] = channel(t, k);
+}
+
+void Texture::fetchBilinear(const Level& l, float u, float v,
+                            const TextureSampler& s, float* out) const {
+    // texel centers are at half integer coordinates
+    float fx = u * l.width - 0.5f;
+    float fy = v * l.height - 0.5f;
+    float x0f = std::floor(fx), y0f = std::floor(fy);
+    float tx = fx - x0f, ty = fy - y0f;
+    int x0 = wrap((int)x0f, l.width, s.wrap_u);
+    int x1 = wrap((int)x0f + 1, l.width, s.wrap_u);
+    int y0 = wrap((int)y0f, l.height, s.wrap_v);
+    int y1 = wrap((int)y0f + 1, l.height, s.wrap_v);
+    uint32_t a = texel(l, x0, y0), b = texel(l, x1, y0);
+    uint32_t c = texel(l, x0, y1), d = texel(l, x1, y1);
+    for (int k = 0; k < 4; k++) {
+        float top = channel(a, k) + tx * (channel(b, k) - channel(a, k));
+        float bottom = channel(c, k) + tx * (channel(d, k) - channel(c, k));
+        out[k] = top + ty * (bottom - top);
+    }
+}
+
+Color Texture::sample(float u, float v, float footprint,
+                      const TextureSampler& s) const {
+    u = sanitize(u);
+    v = sanitize(v);
+    float rgba[4];
+    switch (s.filter) {
+        case TextureFilter::NEAREST:
+            fetchNearest(_levels[0], u, v, s, rgba);
+            break;
+        case TextureFilter::TRILINEAR: {
+            int size = std::max(width(), height());
+            float lod = footprint > 0 ? std::log2(footprint * size) : 0;
+            lod = std::min(std::max(lod, 0.0f), (float)(numLevels() - 1));
+            int l0 = (int)lod;
+            float t = lod - l0;
+            fetchBilinear(_levels[l0], u, v, s, rgba);
+            if (t > 0 && l0 + 1 < numLevels()) {
+                float coarse[4];
+                fetchBilinear(_levels[l0 + 1], u, v, s, coarse);
+                for (int k = 0; k < 4; k++)
+                    rgba[k] += t * (coarse[k] - rgba[k]);
+            }
+            break;
+        }
+        case TextureFilter::BILINEAR:
+        default:
+            fetchBilinear(_levels[0], u, v, s, rgba);
+            break;
+    }
+    return Color(rgba[0], rgba[1], rgba[2]) / 255.0f;
+}
+
+TextureHandle TextureCache::load(const std::string& path) {
+    // the same file reached through different relative paths is one texture
+    std::error_code ec;
+    std::string key = std::filesystem::weakly_canonical(path, ec).string();
+    if (ec) key = path;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _by_path.find(key);
+    if (it != _by_path.end()) return it->second;
+
+    int w, h, channels;
+    unsigned char* data = stbi_load(path.c_str(), &w, &h, &channels, 0);
+    if (!data) {
+        throw std::runtime_error("cannot load texture " + path + ": " +
+                                 stbi_failure_reason());
+    }
+    _textures.push_back(std::make_unique<Texture>(w, h, channels, data));
+    stbi_image_free(data);
+
+    TextureHandle handle = _textures.size() - 1;
+    _by_path[key] = handle;
+    return handle;
+}
+
+TextureHandle TextureCache::add(const std::string& key,
+                                std::unique_ptr<Texture> texture) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _by_path.find(key);
+    if (it != _by_path.end()) return it->second;
+    _textures.push_back(std::move(texture));
+    TextureHandle handle = _textures.size() - 1;
+    _by_path[key] = handle;
+    return handle;
+}
+
+size_t TextureCache::memoryBytes() const {
+    size_t bytes = 0;
+    for (const auto& t : _textures) bytes += t->memoryBytes();
+    return bytes;
+}
+
+void TextureCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _by_path.clear();
+    _textures.clear();
+}
+
+TextureCache& texture_cache() {
+    static TextureCache cache;
+    return cache;
+}
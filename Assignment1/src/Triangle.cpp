@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <optional>
 #include "DS.h"
@@ -6,53 +7,89 @@
 #include "utils.h"
 
 
-bool Triangle::_isOnSurface(const Point& p) const {
-    float a1 = getArea(_p1, _p2, p);
-    float a2 = getArea(_p1, _p3, p);
-    float a3 = getArea(_p2, _p3, p);
-    return (fabs(a1 + a2 + a3 - _area) <= EPSILON);
-}
+Triangle::Triangle(const Point& p1, const Point& p2, const Point& p3,
+                   MaterialId mat, const Transformation& t)
+    : Model{mat, t},
+      _p1{p1},
+      _p2{p2},
+      _p3{p3},
+      _e1{p2 - p1},
+      _e2{p3 - p1},
+      _normal{_e1.cross(_e2).normalized()},
+      // same grazing angle cut off as the plane test
+      _det_eps{(float)EPSILON * _e1.cross(_e2).norm()} {}
 
-std::optional<std::pair<float, const Model*>>
-Triangle::_getIntersectionLengthAndPart(const Ray& r) const {
-    auto intersection_part = _plane._getIntersectionLengthAndPart(r);
-    if (!intersection_part) return {};
-    Point interp = r.src + intersection_part.value().first * r.dir;
-    if (_isOnSurface(interp)) return std::make_pair(intersection_part.value().first,this);
-    return {};
+std::optional<TriangleHit> Triangle::intersectTriangle(const Ray& r) const {
+    const Vector3f pvec = r.dir.cross(_e2);
+    const float det = _e1.dot(pvec);
+    if (fabs(det) <= _det_eps) return {};  // parallel to the triangle
+    const float inv_det = 1.0f / det;
+    const Vector3f tvec = r.src - _p1;
+    const float u = tvec.dot(pvec) * inv_det;
+    if (u < 0 || u > 1) return {};
+    const Vector3f qvec = tvec.cross(_e1);
+    const float v = r.dir.dot(qvec) * inv_det;
+    if (v < 0 || u + v > 1) return {};
+    const float t = _e2.dot(qvec) * inv_det;
+    if (t < 0) return {};
+    return TriangleHit{t, u, v};
 }
 
-std::optional<Ray> Triangle::_getNormal(const Point& p) const {
-    if (!_isOnSurface(p)) return {};
-    return _plane._getNormal(p);
-};
-
-std::ostream& Triangle::print(std::ostream& os) const {
-    return os << "Triangle{p1=" << _p1 << ",p2=" << _p2 << ",p3=" << _p3 << "}";
+std::optional<Hit> Triangle::_intersect(const Ray& r) const {
+    auto tri = intersectTriangle(r);
+    if (!tri) return {};
+    Hit h;
+    h.t = tri.value().t;
+    h.part = this;
+    h.normal = _normal;
+    h.u = tri.value().u;
+    h.v = tri.value().v;
+    return h;
 }
 
-std::optional<Color> Triangle::_getTexture(const Point& p) const {
-    if((this->mat).img == NULL) return {};
+bool Triangle::_occluded(const Ray& r, float tmax) const {
+    auto hit = intersectTriangle(r);
+    return hit && hit.value().t < tmax;
+}
 
-    float a3 = getArea(_p1, _p2, p)/_area;
-    float a2 = getArea(_p1, _p3, p)/_area;
-    float a1 = getArea(_p2, _p3, p)/_area;
-    float sum = a1+a2+a3;
-    a2 /= sum;
-    a3 /= sum;
+void Triangle::_intersectPacket(const RayPacket& p, float* t,
+                                Hit* hits) const {
+    alignas(64) float dist[RayPacket::MAX_SIZE];
+    alignas(64) float u[RayPacket::MAX_SIZE];
+    alignas(64) float v[RayPacket::MAX_SIZE];
+    triangleKernel(p, _p1, _e1, _e2, _det_eps, dist, u, v);
+    for (int lane = 0; lane < p.size; lane++) {
+        if (dist[lane] >= t[lane]) continue;
+        t[lane] = dist[lane];
+        Hit& h = hits[lane];
+        h = Hit();
+        h.part = this;
+        h.normal = _normal;
+        h.u = u[lane];
+        h.v = v[lane];
+    }
+}
 
-    float u = a2;
-    float v = a3;
+AABB Triangle::_getBounds() const {
+    AABB b;
+    b.expand(_p1);
+    b.expand(_p2);
+    b.expand(_p3);
+    return b;
+}
 
-    auto& img = *((this->mat).img);
+std::ostream& Triangle::print(std::ostream& os) const {
+    return os << "Triangle{p1=" << _p1 << ",p2=" << _p2 << ",p3=" << _p3 << "}";
+}
 
-    int w = u*img.width();
-    int h = v*img.height();
+std::optional<Color> Triangle::_getTexture(const Point& /*p*/, const Hit& hit,
+                                           float footprint) const {
+    if(getMaterial().hasTexture() == false) return {};
 
-    float r = (float)(*img.data(w,h,0,0))/255.0;
-    float g = (float)(*img.data(w,h,0,1))/255.0;
-    float b = (float)(*img.data(w,h,0,2))/255.0;
-    Vector3f color{r,g,b};
+    const float u = std::min(1.0f, std::max(0.0f, hit.u));
+    const float v = std::min(1.0f, std::max(0.0f, hit.v));
 
-    return color;
-}
\ No newline at end of file
+    // u and v span the two edges from p1
+    float edge = std::min(_e1.norm(), _e2.norm());
+    return getMaterial().sampleTexture(u, v, footprint / edge);
+}
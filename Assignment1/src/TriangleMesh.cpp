@@ -0,0 +1,181 @@
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <unordered_map>
+#include "DS.h"
+#include "Models.h"
+#include "defs.h"
+
+namespace {
+
+struct PositionHash {
+    size_t operator()(const std::array<uint32_t, 3>& k) const {
+        return (size_t)k[0] * 73856093u ^ (size_t)k[1] * 19349663u ^
+               (size_t)k[2] * 83492791u;
+    }
+};
+
+// area weighted face normals summed per position, vertices that only differ
+// in their uv get the same normal
+void compute_vertex_normals(MeshData& d) {
+    std::unordered_map<std::array<uint32_t, 3>, int, PositionHash> position_ids;
+    std::vector<int> position_of(d.numVertices());
+    for (int i = 0; i < d.numVertices(); i++) {
+        std::array<uint32_t, 3> key;
+        std::memcpy(&key[0], &d.px[i], 4);
+        std::memcpy(&key[1], &d.py[i], 4);
+        std::memcpy(&key[2], &d.pz[i], 4);
+        position_of[i] =
+            position_ids.emplace(key, position_ids.size()).first->second;
+    }
+
+    std::vector<Vector3f> sums(position_ids.size(), Vector3f::Zero());
+    for (int tri = 0; tri < d.numTriangles(); tri++) {
+        const int* idx = &d.indices[3 * tri];
+        Vector3f p[3];
+        for (int k = 0; k < 3; k++)
+            p[k] = Vector3f(d.px[idx[k]], d.py[idx[k]], d.pz[idx[k]]);
+        // the cross product is twice the area, long faces weigh more
+        Vector3f n = (p[1] - p[0]).cross(p[2] - p[0]);
+        for (int k = 0; k < 3; k++) sums[position_of[idx[k]]] += n;
+    }
+
+    d.nx.resize(d.numVertices());
+    d.ny.resize(d.numVertices());
+    d.nz.resize(d.numVertices());
+    for (int i = 0; i < d.numVertices(); i++) {
+        Vector3f n = sums[position_of[i]];
+        float len = n.norm();
+        if (len > 0) n /= len;
+        d.nx[i] = n[0];
+        d.ny[i] = n[1];
+        d.nz[i] = n[2];
+    }
+}
+
+}  // namespace
+
+TriangleMesh::TriangleMesh(MeshData data, bool smooth, MaterialId mat,
+                           const Transformation& t)
+    : Model{mat, t}, _data{std::move(data)} {
+    if (!smooth) {
+        _data.nx.clear();
+        _data.ny.clear();
+        _data.nz.clear();
+    } else if (_data.nx.empty()) {
+        compute_vertex_normals(_data);
+    }
+
+    std::vector<AABB> bounds(_data.numTriangles());
+    for (int tri = 0; tri < _data.numTriangles(); tri++) {
+        for (int k = 0; k < 3; k++)
+            bounds[tri].expand(position(_data.indices[3 * tri + k]));
+        _bounds.expand(bounds[tri]);
+    }
+    _bvh.build(bounds);
+}
+
+TriangleMesh::TriangleMesh(MeshData data, BVH bvh, MaterialId mat,
+                           const Transformation& t)
+    : Model{mat, t}, _data{std::move(data)}, _bvh{std::move(bvh)} {
+    // the root holds every triangle
+    if (!_bvh.getNodes().empty()) _bounds = _bvh.getNodes()[0].bounds;
+}
+
+std::optional<TriangleHit> TriangleMesh::intersectTriangle(
+    int tri, const Ray& r) const {
+    const int* idx = &_data.indices[3 * tri];
+    const Vector3f p0 = position(idx[0]);
+    const Vector3f e1 = position(idx[1]) - p0;
+    const Vector3f e2 = position(idx[2]) - p0;
+    const Vector3f pvec = r.dir.cross(e2);
+    const float det = e1.dot(pvec);
+    // |det| <= EPSILON * |e1 x e2|, compared squared to skip the root
+    if (det * det <= (float)(EPSILON * EPSILON) * e1.cross(e2).squaredNorm())
+        return {};
+    const float inv_det = 1.0f / det;
+    const Vector3f tvec = r.src - p0;
+    const float u = tvec.dot(pvec) * inv_det;
+    if (u < 0 || u > 1) return {};
+    const Vector3f qvec = tvec.cross(e1);
+    const float v = r.dir.dot(qvec) * inv_det;
+    if (v < 0 || u + v > 1) return {};
+    const float t = e2.dot(qvec) * inv_det;
+    if (t < 0) return {};
+    return TriangleHit{t, u, v};
+}
+
+std::optional<Hit> TriangleMesh::_intersect(const Ray& r) const {
+    float tmax = std::numeric_limits<float>::infinity();
+    TriangleHit closest_hit;
+    int closest = _bvh.intersect(
+        r, tmax, [&](int tri, float t) -> std::optional<float> {
+            auto hit = intersectTriangle(tri, r);
+            if (!hit || hit.value().t >= t) return {};
+            closest_hit = hit.value();
+            return hit.value().t;
+        });
+    if (closest < 0) return {};
+
+    Hit h;
+    h.t = closest_hit.t;
+    h.part = this;
+    h.u = closest_hit.u;
+    h.v = closest_hit.v;
+    h.prim = closest;
+    const int* idx = &_data.indices[3 * closest];
+    if (_data.nx.empty()) {
+        const Vector3f p0 = position(idx[0]);
+        h.normal = (position(idx[1]) - p0).cross(position(idx[2]) - p0);
+    } else {
+        const float w[3] = {1 - h.u - h.v, h.u, h.v};
+        h.normal = Vector3f::Zero();
+        for (int k = 0; k < 3; k++)
+            h.normal += w[k] * Vector3f(_data.nx[idx[k]], _data.ny[idx[k]],
+                                        _data.nz[idx[k]]);
+    }
+    h.normal.normalize();
+    return h;
+}
+
+bool TriangleMesh::_occluded(const Ray& r, float tmax) const {
+    return _bvh.occluded(r, tmax, [&](int tri, float t) {
+        auto hit = intersectTriangle(tri, r);
+        return hit && hit.value().t < t;
+    });
+}
+
+std::optional<Color> TriangleMesh::_getTexture(const Point& /*p*/, const Hit& hit,
+                                               float footprint) const {
+    if (!getMaterial().hasTexture() || _data.u.empty() || hit.prim < 0)
+        return {};
+    const int* idx = &_data.indices[3 * hit.prim];
+    const float w[3] = {1 - hit.u - hit.v, hit.u, hit.v};
+    float tu = 0, tv = 0;
+    for (int k = 0; k < 3; k++) {
+        tu += w[k] * _data.u[idx[k]];
+        tv += w[k] * _data.v[idx[k]];
+    }
+
+    // uv units per model space unit, from the areas of the triangle
+    const Vector3f p0 = position(idx[0]);
+    const float area = (position(idx[1]) - p0).cross(position(idx[2]) - p0).norm();
+    const float du1 = _data.u[idx[1]] - _data.u[idx[0]];
+    const float dv1 = _data.v[idx[1]] - _data.v[idx[0]];
+    const float du2 = _data.u[idx[2]] - _data.u[idx[0]];
+    const float dv2 = _data.v[idx[2]] - _data.v[idx[0]];
+    const float uv_area = std::fabs(du1 * dv2 - du2 * dv1);
+    const float scale = area > 0 ? std::sqrt(uv_area / area) : 0;
+
+    // obj texture coordinates start at the bottom of the image
+    return getMaterial().sampleTexture(tu, 1 - tv, footprint * scale);
+}
+
+AABB TriangleMesh::_getBounds() const { return _bounds; }
+
+std::ostream& TriangleMesh::print(std::ostream& os) const {
+    return os << "TriangleMesh{vertices=" << _data.numVertices()
+              << ",triangles=" << _data.numTriangles() << "}";
+}
@@ -15,16 +15,55 @@
 #include "Engine.h"
 #include "Image.h"
 #include "Models.h"
+#include "SceneFile.h"
 #include "defs.h"
 #include "utils.h"
 
 
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <optional>
+#include <thread>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
+void print_usage(const char* prog);
+
+struct RenderOptions {
+    int num_threads = std::thread::hardware_concurrency();
+    int tile_size = 16;
+    int packet_size = 16;
+    bool wavefront = false;
+    std::optional<unsigned int> seed;
+    ToneMapping tone_mapping;
+    // progressive rendering, used when passes or a checkpoint is given
+    std::optional<int> passes;
+    ProgressiveConfig progressive;
+    bool isProgressive() const {
+        return passes || !progressive.checkpoint_path.empty();
+    }
+    void apply(RenderEngine& engine) const {
+        engine.setNumThreads(num_threads);
+        engine.setTileSize(tile_size);
+        engine.setPacketSize(packet_size);
+        engine.setWavefront(wavefront);
+        if (seed) engine.setSeed(seed.value());
+        engine.setToneMapping(tone_mapping);
+    }
+};
+// render() or renderProgressive() depending on the options
+void render_image(RenderEngine& engine, const RenderOptions& opts,
+                  const string& output);
+int compile_scene(const string& scene, const string& output);
+int render_headless(const string& scene, const string& output, int width,
+                    int height, const RenderOptions& opts);
+int render_batch(const std::vector<string>& scenes,
+                 const std::optional<string>& output_dir, int width,
+                 int height, const RenderOptions& opts);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -50,10 +89,81 @@ int main(int argc, char** argv)
     const int width = 512;
     const int height = 512;
 
-    if (argc != 2) {
-        cout << "Usage: " << argv[0] << " <Input JSON file>" << endl;
+    RenderOptions opts;
+    bool headless = false;
+    bool batch = false;
+    std::optional<string> compile;
+    std::optional<string> output;
+    std::vector<string> scenes;
+    for (int a = 1; a < argc; a++) {
+        string arg = argv[a];
+        bool has_value = (a + 1 < argc);
+        if ((arg == "-t" || arg == "--threads") && has_value) {
+            opts.num_threads = std::stoi(argv[++a]);
+        } else if (arg == "--tile" && has_value) {
+            opts.tile_size = std::stoi(argv[++a]);
+        } else if (arg == "--packet" && has_value) {
+            opts.packet_size = std::stoi(argv[++a]);
+        } else if (arg == "--wavefront") {
+            opts.wavefront = true;
+        } else if (arg == "--seed" && has_value) {
+            opts.seed = std::stoul(argv[++a]);
+        } else if (arg == "--tonemap" && has_value) {
+            string op = argv[++a];
+            if (op == "clamp") {
+                opts.tone_mapping.op = ToneMap::CLAMP;
+            } else if (op == "reinhard") {
+                opts.tone_mapping.op = ToneMap::REINHARD;
+            } else {
+                print_usage(argv[0]);
+                exit(-1);
+            }
+        } else if (arg == "--exposure" && has_value) {
+            opts.tone_mapping.exposure = std::stof(argv[++a]);
+        } else if (arg == "--gamma" && has_value) {
+            opts.tone_mapping.gamma = std::stof(argv[++a]);
+        } else if (arg == "--passes" && has_value) {
+            opts.passes = std::stoi(argv[++a]);
+        } else if (arg == "--checkpoint" && has_value) {
+            opts.progressive.checkpoint_path = argv[++a];
+        } else if (arg == "--checkpoint-every" && has_value) {
+            opts.progressive.checkpoint_passes = std::stoi(argv[++a]);
+        } else if (arg == "--checkpoint-secs" && has_value) {
+            opts.progressive.checkpoint_seconds = std::stod(argv[++a]);
+        } else if (arg == "--resume") {
+            opts.progressive.resume = true;
+        } else if ((arg == "-o" || arg == "--output") && has_value) {
+            output = argv[++a];
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--compile" && has_value) {
+            compile = argv[++a];
+        } else if (arg[0] != '-') {
+            scenes.push_back(arg);
+        } else {
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+    if (scenes.empty() || ((!batch || compile) && scenes.size() != 1) ||
+        (batch && opts.isProgressive())) {
+        print_usage(argv[0]);
         exit(-1);
     }
+    if (opts.progressive.resume && !opts.seed) {
+        // a resumed render has to continue the checkpoint's sample sequences
+        auto info = SampleBuffer::peek(opts.progressive.checkpoint_path);
+        if (info) opts.seed = info.value().seed;
+    }
+
+    if (compile) return compile_scene(scenes[0], compile.value());
+    // neither mode touches GLFW or OpenGL
+    if (batch) return render_batch(scenes, output, width, height, opts);
+    if (headless)
+        return render_headless(scenes[0], output.value_or("./sphere.ppm"),
+                               width, height, opts);
 
     // glfw: initialize and configure
     // ------------------------------
@@ -105,14 +215,20 @@ int main(int argc, char** argv)
     lines[1].push_back(make_pair(Vector3f(5,0,5),Vector3f(5,2,5)));
 
 
-    string in_filename = string(argv[1]);
-    State state = get_state(in_filename);
+    State state = get_state(scenes[0]);
 
     Image img{width, height};
     RenderEngine render_man(*(state.cam), img, *(state.bg), state.models, state.lights,
-                            Color(0.2, 0.2, 0.2));
-    render_man.render();
-    render_man.writeImage("./sphere.ppm");
+                            Color(0.2, 0.2, 0.2), state.bvh.get());
+    opts.apply(render_man);
+    render_man.setSampling(state.sampling);
+    render_man.setTracing(state.tracing);
+    try {
+        render_image(render_man, opts, output.value_or("./sphere.ppm"));
+    } catch (const std::exception& e) {
+        // the preview still opens
+        std::cerr << "WARNING: " << e.what() << std::endl;
+    }
 
     std::vector<pair<Point,Color>> lightVec;
     for(auto light: state.lights) {
@@ -186,6 +302,167 @@ int main(int argc, char** argv)
     return 0;
 }
 
+void print_usage(const char* prog)
+{
+    cout << "Usage: " << prog << " <Input JSON file> [options]" << endl
+         << "       " << prog << " --batch <Input JSON file>... [options]" << endl
+         << "       " << prog << " --compile <Output file> <Input JSON file>" << endl
+         << "  A scene written by --compile can be given in place of a JSON file, it loads" << endl
+         << "  without parsing but has no OpenGL preview models" << endl
+         << "  --headless        render, write the image and exit without opening a window" << endl
+         << "  --batch           headless, render the scenes back to back and report parse," << endl
+         << "                    setup and render times" << endl
+         << "  --compile P       write the parsed scene with its textures and BVHs to P and exit" << endl
+         << "  -o, --output P    image path (default: ./sphere.ppm), a directory with --batch;" << endl
+         << "                    a .pfm path gets the linear float image" << endl
+         << "  --tonemap OP      clamp or reinhard, for 8-bit output (default: clamp)" << endl
+         << "  --exposure E      scale applied before tone mapping (default: 1)" << endl
+         << "  --gamma G         display gamma of 8-bit output (default: 1)" << endl
+         << "  --passes N        progressive rendering: N passes of the scene's samples per pixel" << endl
+         << "  --checkpoint P    save the float sample buffer to P at checkpoints and at the end" << endl
+         << "  --checkpoint-every N   checkpoint every N passes" << endl
+         << "  --checkpoint-secs S    checkpoint when S seconds have passed since the last one" << endl
+         << "  --resume          continue from the checkpoint, same scene and options" << endl
+         << "  -t, --threads N   number of render threads (default: all cores)" << endl
+         << "  --tile N          tile size in pixels (default: 16)" << endl
+         << "  --packet N        primary rays per SIMD packet: 1, 4, 8 or 16 (default: 16)" << endl
+         << "  --wavefront       trace the rays of a tile breadth first, a depth at a time" << endl
+         << "  --seed N          seed of the sampler, fixes the output image (default: 0)" << endl;
+}
+
+int compile_scene(const string& scene, const string& output)
+{
+    try {
+        State state = get_state(scene, false);
+        SceneFile::write(state, output);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    std::cout << "wrote " << output << std::endl;
+    return 0;
+}
+
+int render_headless(const string& scene, const string& output, int width,
+                    int height, const RenderOptions& opts)
+{
+    try {
+        State state = get_state(scene, false);
+        state.arena->printStats(std::cout);
+        Image img{width, height};
+        RenderEngine render_man(*(state.cam), img, *(state.bg), state.models,
+                                state.lights, Color(0.2, 0.2, 0.2),
+                                state.bvh.get());
+        opts.apply(render_man);
+        render_man.setSampling(state.sampling);
+        render_man.setTracing(state.tracing);
+        render_image(render_man, opts, output);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    std::cout << "wrote " << output << std::endl;
+    return 0;
+}
+
+void render_image(RenderEngine& engine, const RenderOptions& opts,
+                  const string& output)
+{
+    if (opts.isProgressive()) {
+        ProgressiveConfig cfg = opts.progressive;
+        cfg.passes = opts.passes.value_or(1);
+        cfg.image_path = output;
+        const int rendered = engine.renderProgressive(cfg);
+        std::cout << "rendered " << rendered << " of " << cfg.passes
+                  << " passes" << std::endl;
+    } else {
+        engine.render();
+        engine.writeImage(output);
+    }
+    engine.printTileStats(std::cout);
+    engine.printBVHStats(std::cout);
+    engine.printSamplingStats(std::cout);
+}
+
+int render_batch(const std::vector<string>& scenes,
+                 const std::optional<string>& output_dir, int width,
+                 int height, const RenderOptions& opts)
+{
+    typedef std::chrono::steady_clock Clock;
+    auto ms_since = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+    double total_parse = 0, total_setup = 0, total_render = 0, total_write = 0;
+    long total_samples = 0;
+    int failed = 0;
+    auto batch_start = Clock::now();
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "scene                                 parse ms  setup ms render ms  write ms   samples" << std::endl;
+    for (size_t s = 0; s < scenes.size(); s++) {
+        auto start = Clock::now();
+        State state;
+        try {
+            state = get_state(scenes[s], false);
+        } catch (const std::exception& e) {
+            std::cerr << scenes[s] << ": " << e.what() << std::endl;
+            failed++;
+            continue;
+        }
+        const double parse_ms = ms_since(start);
+
+        // engine construction builds the scene BVH
+        start = Clock::now();
+        Image img{width, height};
+        RenderEngine render_man(*(state.cam), img, *(state.bg), state.models,
+                                state.lights, Color(0.2, 0.2, 0.2),
+                                state.bvh.get());
+        opts.apply(render_man);
+        render_man.setSampling(state.sampling);
+        render_man.setTracing(state.tracing);
+        const double setup_ms = ms_since(start);
+
+        start = Clock::now();
+        render_man.render();
+        const double render_ms = ms_since(start);
+
+        start = Clock::now();
+        if (output_dir) {
+            std::filesystem::path stem = std::filesystem::path(scenes[s]).stem();
+            std::filesystem::path out = std::filesystem::path(output_dir.value()) /
+                (std::to_string(s) + "_" + stem.string() + ".ppm");
+            try {
+                render_man.writeImage(out.string());
+            } catch (const std::exception& e) {
+                std::cerr << scenes[s] << ": " << e.what() << std::endl;
+                failed++;
+                continue;
+            }
+        }
+        const double write_ms = ms_since(start);
+
+        std::cout << std::left << std::setw(36) << scenes[s] << std::right
+                  << std::setw(10) << parse_ms << std::setw(10) << setup_ms
+                  << std::setw(10) << render_ms << std::setw(10) << write_ms
+                  << std::setw(10) << render_man.getTotalSamples() << std::endl;
+        total_parse += parse_ms;
+        total_setup += setup_ms;
+        total_render += render_ms;
+        total_write += write_ms;
+        total_samples += render_man.getTotalSamples();
+    }
+    const double wall_ms = ms_since(batch_start);
+    const int rendered = scenes.size() - failed;
+    std::cout << std::left << std::setw(36) << "total" << std::right
+              << std::setw(10) << total_parse << std::setw(10) << total_setup
+              << std::setw(10) << total_render << std::setw(10) << total_write
+              << std::setw(10) << total_samples << std::endl;
+    std::cout << rendered << " scenes in " << wall_ms << " ms, "
+              << (wall_ms > 0 ? rendered * 1000.0 / wall_ms : 0) << " scenes/s";
+    if (failed) std::cout << ", " << failed << " failed";
+    std::cout << std::endl;
+    return failed ? -1 : 0;
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow *window)
@@ -3,6 +3,8 @@
 #include "Camera.h"
 #include "DS.h"
 #include "Models.h"
+#include "SceneFile.h"
+#include "SceneLoader.h"
 #include "defs.h"
 #include "OGLModels.h"
 
@@ -20,28 +22,31 @@ Vector4f augment(const Vector3f &vec, float val) {
 }
 
 Vector3f apply_transformation(const Vector3f &point, const Transformation &trans, bool do_world_to_model, bool isDir, bool isNormal) {
-    Vector3f R = Vector3f::Zero();
-    Matrix3f M;
-
     if(isNormal && !isDir){
         std::cerr<<"isNormal is true and isDir is false, IDK what to do"<<std::endl;
         exit(-1);
     }
+    if(trans.is_identity)
+        return point;
 
-    if(isNormal)
-        M = (do_world_to_model ? trans.T_M_W.transpose() : trans.T_W_M.transpose());
-    else
-        M = (do_world_to_model ? trans.T_W_M : trans.T_M_W);
-    
-    if(!isDir)
-        R = (do_world_to_model ? trans.R_W_M : trans.R_M_W);
-
-    Vector3f new_point = point*M + R;
-    return new_point;
+    const Matrix3f &M = isNormal
+        ? (do_world_to_model ? trans.N_W_M : trans.N_M_W)
+        : (do_world_to_model ? trans.T_W_M : trans.T_M_W);
+    if(isDir)
+        return point*M;
+    return point*M + (do_world_to_model ? trans.R_W_M : trans.R_M_W);
 }
 
 Ray apply_transformation(const Ray &r, const Transformation &trans, bool do_world_to_model, bool isNormal) {
+    if(trans.is_identity)
+        return r;
     Vector3f new_ray_src = apply_transformation(r.src,trans,do_world_to_model,false,false);
+    if(trans.is_rigid){
+        // the normal matrix of a rotation is the rotation itself and the
+        // direction stays unit length
+        Vector3f new_ray_dir = apply_transformation(r.dir,trans,do_world_to_model,true,false);
+        return Ray(new_ray_src,new_ray_dir,r.length);
+    }
     Vector3f new_ray_dir = apply_transformation(r.dir*r.length,trans,do_world_to_model,true,isNormal);
     return Ray(new_ray_src,new_ray_dir);
 }
@@ -72,9 +77,23 @@ std::optional<std::pair<float, float>> solve_quadratic(float a, float b,
     return std::make_pair(std::min(x1, x2), std::max(x1, x2));
 }
 
+const json &get_key(const json &j, const string &key) {
+    if (!j.is_object()) throw runtime_error("expected an object");
+    auto it = j.find(key);
+    if (it == j.end()) throw runtime_error("missing key \"" + key + "\"");
+    return *it;
+}
+
+// exactly n numbers
+static vector<float> get_floats(const json &j, size_t n) {
+    if (!j.is_array() || j.size() != n)
+        throw runtime_error("expected an array of " + to_string(n) + " numbers");
+    return j.get<vector<float>>();
+}
+
 Vector3f get_vector3f(const json &j) {
-    float x = j[0], y = j[1], z = j[2];
-    return Vector3f(x, y, z);
+    vector<float> v = get_floats(j, 3);
+    return Vector3f(v[0], v[1], v[2]);
 }
 
 Transformation get_transformation(const json &j){
@@ -82,168 +101,337 @@ Transformation get_transformation(const json &j){
     if(t_it == j.end())
         return IDENTITY_TRANS;
     
-    vector<float> M_vec = j["transformation"]["M"];
-    assert(M_vec.size() == 9);
+    vector<float> M_vec = get_floats(get_key(*t_it, "M"), 9);
     Matrix3f M(M_vec.data());
-    Vector3f R = get_vector3f(j["transformation"]["R"]);
+    Vector3f R = get_vector3f(get_key(*t_it, "R"));
     return Transformation(M,R);
 }
 
 pair<Model*,ogl::BaseModel*> parse_model(const json &j,
-                   unordered_map<string, Material *> &materials) {
-    string type = j["type"];
-    string mat = j["material"];
+                   unordered_map<string, MaterialId> &materials,
+                   SceneArena &arena, bool with_preview,
+                   const string &scene_dir) {
+    string type = get_key(j, "type");
+    if (type == "instance")
+        throw runtime_error("instances can only be placed in \"models\"");
+    string mat = get_key(j, "material");
     Transformation t = get_transformation(j); 
     Model *m = NULL;
     ogl::BaseModel *obm = NULL;
-    if (materials.find(mat) == materials.end()) return make_pair(m,obm);
+    if (materials.find(mat) == materials.end())
+        throw runtime_error("unknown material \"" + mat + "\"");
     bool texture_present = j.find("img")!=j.end();
 
-    Material material = *materials[mat];
+    MaterialId mat_id = materials[mat];
 
     if(texture_present) {
-        material.setTexture(j["img"]);
+        // the override is a material of its own, shared by every model
+        // using the same material and image
+        Material textured = material_table()[mat_id];
+        textured.setTexture(resolve_path(j["img"].get<string>(), scene_dir));
+        textured.sampler = get_texture_sampler(j);
+        mat_id = material_table().intern(textured);
     }
+    // copy for the preview models, interning may move the table entries
+    const Material material = material_table()[mat_id];
 
     if (type == "sphere") {
-        Point center = get_vector3f(j["center"]);
-        float radius = j["radius"];
-        m = new Sphere(center, radius, material,t);
-        obm = new ogl::Sphere(center, radius, material,t);
+        Point center = get_vector3f(get_key(j, "center"));
+        float radius = get_key(j, "radius");
+        m = arena.make<Sphere>(center, radius, mat_id,t);
+        if (with_preview) obm = arena.make<ogl::Sphere>(center, radius, material,t);
     } else if (type == "plane") {
-        Point ray_src = get_vector3f(j["ray_src"]);
-        Vector3f ray_normal = get_vector3f(j["ray_normal"]);
-        m = new Plane(Ray(ray_src, ray_normal), material,t);
+        Point ray_src = get_vector3f(get_key(j, "ray_src"));
+        Vector3f ray_normal = get_vector3f(get_key(j, "ray_normal"));
+        m = arena.make<Plane>(Ray(ray_src, ray_normal), mat_id,t);
     } else if (type == "quadric") {
-        QuadricParams qp(j["qp"]);
-        m = new Quadric(qp, material,t);
+        QuadricParams qp(get_floats(get_key(j, "qp"), 10));
+        AABB clip = AABB::infinite();
+        auto c_it = j.find("clip");
+        if (c_it != j.end()) {
+            clip = AABB(get_vector3f(get_key(*c_it, "min")),
+                        get_vector3f(get_key(*c_it, "max")));
+            if (clip.isEmpty())
+                throw runtime_error("clip: min is above max");
+        }
+        m = arena.make<Quadric>(qp, mat_id, t, clip);
     } else if (type == "triangle") {
-        Point p1 = get_vector3f(j["p1"]);
-        Point p2 = get_vector3f(j["p2"]);
-        Point p3 = get_vector3f(j["p3"]);
-        m = new Triangle(p1, p2, p3, material,t);
+        Point p1 = get_vector3f(get_key(j, "p1"));
+        Point p2 = get_vector3f(get_key(j, "p2"));
+        Point p3 = get_vector3f(get_key(j, "p3"));
+        m = arena.make<Triangle>(p1, p2, p3, mat_id,t);
     } else if (type == "collection") {
-        json cj = j["elements"];
-        Collection *coll = new Collection(material,t);
+        const json &cj = get_key(j, "elements");
+        if (!cj.is_array()) throw runtime_error("elements: expected an array");
+        Collection *coll = arena.make<Collection>(mat_id,t);
         for (auto &el : cj) {
-            auto temp = parse_model(el, materials);
-            coll->addModel(temp.first);
+            auto temp = parse_model(el, materials, arena, with_preview,
+                                    scene_dir);
+            if (temp.first != NULL) coll->addModel(temp.first);
         };
+        coll->buildBVH();
         m = &(*coll);
     } else if (type == "box") {
-        Point center = get_vector3f(j["center"]);
-        Point x_axis = get_vector3f(j["x_axis"]);
-        Point y_axis = get_vector3f(j["y_axis"]);
-        float length = j["length"];
-        float breadth = j["breadth"];
-        float height = j["height"];
-        m = new Box(center, x_axis, y_axis, length, breadth, height,
-                    material,t);
-        obm = new ogl::Box(center, x_axis, y_axis, length, breadth, height,
-                    material,t);
+        Point center = get_vector3f(get_key(j, "center"));
+        Point x_axis = get_vector3f(get_key(j, "x_axis"));
+        Point y_axis = get_vector3f(get_key(j, "y_axis"));
+        float length = get_key(j, "length");
+        float breadth = get_key(j, "breadth");
+        float height = get_key(j, "height");
+        m = arena.make<Box>(center, x_axis, y_axis, length, breadth, height,
+                    mat_id,t);
+        if (with_preview)
+            obm = arena.make<ogl::Box>(center, x_axis, y_axis, length,
+                                       breadth, height, material,t);
     } else if (type == "polygon") {
-        json pj = j["points"];
+        const json &pj = get_key(j, "points");
+        if (!pj.is_array() || pj.size() < 3)
+            throw runtime_error("points: expected at least 3 points");
         std::vector<Point> points;
         for (auto &el : pj) {
             points.push_back(get_vector3f(el));
         }
-        m = new Polygon(points, material,t);
+        m = arena.make<Polygon>(points, mat_id,t);
+    } else if (type == "mesh") {
+        bool smooth = j.value("smooth", true);
+        const string path = resolve_path(get_key(j, "path"), scene_dir);
+        m = arena.make<TriangleMesh>(load_obj(path), smooth, mat_id, t);
     }
     return std::make_pair(m,obm);
 }
 
-void get_models(const json &j, vector<Model *> &models,vector<ogl::BaseModel *> &oglModels,
-                unordered_map<string, Material *> &materials) {
-    if (j.find("models") == j.end()) return;
-    json jm = j["models"];
-    for (auto &el : jm) {
-        auto ret = parse_model(el, materials);
-        Model *m = ret.first;
-        ogl::BaseModel* obm = ret.second;
-        if (m != NULL) models.push_back(m);
-        if (obm != NULL) oglModels.push_back(obm);
+string resolve_path(const string &path, const string &scene_dir) {
+    const std::filesystem::path p(path);
+    if (p.is_absolute() || scene_dir.empty()) return path;
+    const std::filesystem::path next_to_scene = std::filesystem::path(scene_dir) / p;
+    if (std::filesystem::exists(next_to_scene)) return next_to_scene.string();
+    return path;
+}
+
+Model *parse_instance(const json &j,
+                     const unordered_map<string, shared_ptr<const Model>> &geometry,
+                     SceneArena &arena) {
+    string name = get_key(j, "geometry");
+    auto it = geometry.find(name);
+    if (it == geometry.end())
+        throw runtime_error("unknown geometry \"" + name + "\"");
+    return arena.make<Instance>(it->second, get_transformation(j));
+}
+
+namespace {
+// v, v/vt, v//vn or v/vt/vn with 1 based or negative (relative) indices,
+// missing entries are -1
+bool parse_face_vertex(const char *&c, int num_v, int num_vt, int num_vn,
+                       int idx[3]) {
+    int counts[3] = {num_v, num_vt, num_vn};
+    for (int k = 0; k < 3; k++) {
+        idx[k] = -1;
+        if (k > 0) {
+            if (*c != '/') continue;
+            c++;
+        }
+        if (*c == '/' || isspace(*c) || !*c) continue;
+        char *end;
+        long i = strtol(c, &end, 10);
+        if (end == c) return false;
+        c = end;
+        idx[k] = i < 0 ? counts[k] + i : i - 1;
+        if (idx[k] < 0 || idx[k] >= counts[k]) return false;
     }
+    return true;
 }
+}  // namespace
+
+MeshData load_obj(const string &path) {
+    std::ifstream ifile(path);
+    if (!ifile) throw runtime_error("cannot open mesh file " + path);
+    vector<float> v, vt, vn;
+    MeshData d;
+    // one mesh vertex per distinct v/vt/vn combination
+    map<std::tuple<int, int, int>, int> vertex_ids;
+    bool has_uv = true, has_normal = true;
+    vector<std::tuple<int, int, int>> corners;
+    vector<int> face;
+    string line;
+    int line_no = 0;
+    while (getline(ifile, line)) {
+        line_no++;
+        const char *c = line.c_str();
+        while (isspace(*c)) c++;
+        if (c[0] == 'v' && (c[1] == ' ' || c[1] == 't' || c[1] == 'n')) {
+            vector<float> &dst = c[1] == 't' ? vt : (c[1] == 'n' ? vn : v);
+            c += c[1] == ' ' ? 1 : 2;
+            int count = c[-1] == 't' ? 2 : 3;
+            for (int k = 0; k < count; k++) {
+                char *end;
+                dst.push_back(strtof(c, &end));
+                if (end == c)
+                    throw runtime_error(path + ":" + to_string(line_no) +
+                                        ": bad vertex");
+                c = end;
+            }
+        } else if (c[0] == 'f' && c[1] == ' ') {
+            c++;
+            face.clear();
+            while (true) {
+                while (isspace(*c)) c++;
+                if (!*c) break;
+                int idx[3];
+                if (!parse_face_vertex(c, v.size() / 3, vt.size() / 2,
+                                       vn.size() / 3, idx))
+                    throw runtime_error(path + ":" + to_string(line_no) +
+                                        ": bad face");
+                has_uv = has_uv && idx[1] >= 0;
+                has_normal = has_normal && idx[2] >= 0;
+                auto key = std::make_tuple(idx[0], idx[1], idx[2]);
+                auto it = vertex_ids.find(key);
+                if (it == vertex_ids.end()) {
+                    it = vertex_ids.emplace(key, corners.size()).first;
+                    corners.push_back(key);
+                }
+                face.push_back(it->second);
+            }
+            // polygons as triangle fans
+            for (int k = 2; k < (int)face.size(); k++) {
+                d.indices.push_back(face[0]);
+                d.indices.push_back(face[k - 1]);
+                d.indices.push_back(face[k]);
+            }
+        }
+    }
+    if (d.indices.empty()) throw runtime_error(path + ": no faces");
 
-pair<string, Material *> parse_material(const json &j) {
-    string name = j["name"];
-    Vector3f Ka = get_vector3f(j["Ka"]);
-    Vector3f Kd = get_vector3f(j["Kd"]);
-    Vector3f Ks = get_vector3f(j["Ks"]);
-    Vector3f Krg = get_vector3f(j["Krg"]);
-    Vector3f Ktg = get_vector3f(j["Ktg"]);
-    float refractive_index = j["ri"], specular_coeff = j["sc"];
-    Material *m =
-        new Material(Ka, Kd, Ks, Krg, Ktg, refractive_index, specular_coeff);
-    return std::make_pair(name, m);
-}
-
-void get_materials(const json &j,
-                   unordered_map<string, Material *> &materials) {
-    if (j.find("materials") == j.end()) return;
-    json jm = j["materials"];
-    for (auto &el : jm) {
-        pair<string, Material *> m = parse_material(el);
-        materials[m.first] = m.second;
+    for (const auto &[iv, ivt, ivn] : corners) {
+        d.px.push_back(v[3 * iv]);
+        d.py.push_back(v[3 * iv + 1]);
+        d.pz.push_back(v[3 * iv + 2]);
+        // attributes only count if every face has them
+        if (has_uv) {
+            d.u.push_back(vt[2 * ivt]);
+            d.v.push_back(vt[2 * ivt + 1]);
+        }
+        if (has_normal) {
+            d.nx.push_back(vn[3 * ivn]);
+            d.ny.push_back(vn[3 * ivn + 1]);
+            d.nz.push_back(vn[3 * ivn + 2]);
+        }
     }
+    return d;
 }
 
-Light *parse_light(const json &j) {
-    Vector3f loc = get_vector3f(j["loc"]);
-    Vector3f intensity = get_vector3f(j["intensity"]);
-    return new Light(loc, intensity);
+static WrapMode parse_wrap_mode(const string &name) {
+    if (name == "repeat") return WrapMode::REPEAT;
+    if (name == "clamp") return WrapMode::CLAMP;
+    if (name == "mirror") return WrapMode::MIRROR;
+    throw runtime_error("unknown texture wrap mode " + name);
 }
 
-void get_lights(const json &j, vector<Light *> &lights) {
-    json lj = j["lights"];
-    for (auto &el : lj) {
-        lights.push_back(parse_light(el));
+TextureSampler get_texture_sampler(const json &j) {
+    TextureSampler s;
+    if (j.find("filter") != j.end()) {
+        string filter = j["filter"];
+        if (filter == "nearest") s.filter = TextureFilter::NEAREST;
+        else if (filter == "bilinear") s.filter = TextureFilter::BILINEAR;
+        else if (filter == "trilinear") s.filter = TextureFilter::TRILINEAR;
+        else throw runtime_error("unknown texture filter " + filter);
     }
+    if (j.find("wrap") != j.end()) {
+        // one mode for both axes or [u, v]
+        const json &jw = j["wrap"];
+        if (jw.is_array()) {
+            if (jw.size() != 2) throw runtime_error("wrap: expected [u, v]");
+            s.wrap_u = parse_wrap_mode(jw[0]);
+            s.wrap_v = parse_wrap_mode(jw[1]);
+        } else {
+            s.wrap_u = s.wrap_v = parse_wrap_mode(jw);
+        }
+    }
+    return s;
+}
+
+pair<string, MaterialId> parse_material(const json &j) {
+    string name = get_key(j, "name");
+    Vector3f Ka = get_vector3f(get_key(j, "Ka"));
+    Vector3f Kd = get_vector3f(get_key(j, "Kd"));
+    Vector3f Ks = get_vector3f(get_key(j, "Ks"));
+    Vector3f Krg = get_vector3f(get_key(j, "Krg"));
+    Vector3f Ktg = get_vector3f(get_key(j, "Ktg"));
+    float refractive_index = get_key(j, "ri"), specular_coeff = get_key(j, "sc");
+    Material m(Ka, Kd, Ks, Krg, Ktg, refractive_index, specular_coeff);
+    m.roulette = j.value("roulette", m.roulette);
+    return std::make_pair(name, material_table().intern(m));
+}
+
+Light *parse_light(const json &j, SceneArena &arena) {
+    Vector3f loc = get_vector3f(get_key(j, "loc"));
+    Vector3f intensity = get_vector3f(get_key(j, "intensity"));
+    return arena.make<Light>(loc, intensity);
 }
 
-Camera *get_camera(const json &j) {
-    json jc = j["camera"];
-    float ar = jc["ar"];
-    float fov = jc["fov"];
-    vector<float> trans_vec = jc["trans"];
-    assert(trans_vec.size() == 16);
+Camera *parse_camera(const json &jc, SceneArena &arena) {
+    float ar = get_key(jc, "ar");
+    float fov = get_key(jc, "fov");
+    vector<float> trans_vec = get_floats(get_key(jc, "trans"), 16);
     Matrix4f trans_matrix(trans_vec.data());
-    Camera *c = new Camera(trans_matrix, ar, fov);
+    Camera *c = arena.make<Camera>(trans_matrix, ar, fov);
     return c;
 }
 
-Background *get_background(const json &j) {
-    json jc = j["background"];
+Background *parse_background(const json &jc, SceneArena &arena,
+                             const string &scene_dir) {
     bool texture_present = jc.find("img")!=jc.end();
 
     if(texture_present) {
-        return new Background(jc["img"]);
+        Material background_material;
+        background_material.setTexture(
+            resolve_path(jc["img"].get<string>(), scene_dir));
+        background_material.sampler = get_texture_sampler(jc);
+        return arena.make<Background>(arena.make<Sphere>(
+            Vector3f::Zero(), 1, material_table().intern(background_material),
+            IDENTITY_TRANS));
     } else {
-        return new Background(get_vector3f(jc["color"]));
+        return arena.make<Background>(get_vector3f(get_key(jc, "color")));
     }
 }
 
-pair<int,int> get_trace_point(const json &j) {
-    json jc = j["tracePoint"];
-    return make_pair(jc[0],jc[1]);
-}
-
-State get_state(string filename) {
-    std::ifstream ifile(filename);
-    json j;
-    ifile >> j;
-    unordered_map<string, Material *> materials;
-    vector<Model *> models;
-    vector<ogl::BaseModel *> oglModels;
-    vector<Light *> lights;
-    Camera *cam;
-    Background* bg;
-    get_materials(j, materials);
-    get_models(j, models, oglModels, materials);
-    get_lights(j, lights);
-    cam = get_camera(j);
-    bg = get_background(j);
-    auto tracePoint = get_trace_point(j);
-    State s = {models, oglModels, lights, materials, cam, bg,tracePoint};
-    return s;
+pair<int,int> parse_trace_point(const json &jc) {
+    if (!jc.is_array() || jc.size() != 2)
+        throw runtime_error("expected [i, j]");
+    return make_pair(jc[0].get<int>(), jc[1].get<int>());
+}
+
+SamplingConfig parse_sampling(const json &js) {
+    SamplingConfig sc;
+    if (!js.is_object()) throw runtime_error("expected an object");
+    sc.min_samples = js.value("min", sc.min_samples);
+    sc.max_samples = js.value("max", std::max(sc.min_samples, sc.max_samples));
+    sc.threshold = js.value("threshold", sc.threshold);
+    if (sc.min_samples < 1 || sc.max_samples < sc.min_samples)
+        throw std::runtime_error("need 1 <= min <= max");
+    if (js.find("sampler") != js.end()) {
+        string sampler = js["sampler"];
+        if (sampler == "random") sc.sampler = SamplerType::RANDOM;
+        else if (sampler == "stratified") sc.sampler = SamplerType::STRATIFIED;
+        else if (sampler == "sobol") sc.sampler = SamplerType::SOBOL;
+        else if (sampler == "halton") sc.sampler = SamplerType::HALTON;
+        else throw runtime_error("unknown sampler " + sampler);
+    }
+    return sc;
+}
+
+TraceConfig parse_tracing(const json &jt) {
+    TraceConfig tc;
+    if (!jt.is_object()) throw runtime_error("expected an object");
+    tc.max_depth = jt.value("max_depth", tc.max_depth);
+    tc.min_contribution = jt.value("min_contribution", tc.min_contribution);
+    tc.roulette_depth = jt.value("roulette_depth", tc.roulette_depth);
+    if (tc.max_depth < 0) throw runtime_error("max_depth: expected >= 0");
+    if (tc.min_contribution < 0)
+        throw runtime_error("min_contribution: expected >= 0");
+    return tc;
+}
+
+State get_state(string filename, bool with_preview) {
+    if (SceneFile::isCompiled(filename)) return SceneFile::read(filename);
+    return load_scene(filename, with_preview);
 }